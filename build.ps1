@@ -2,4 +2,15 @@ clang -Iinclude -c ./src/main.c -o ./bin/main.o -O2
 clang -Iinclude -c ./src/qmath.c -o ./bin/qmath.o -O2
 clang -Iinclude -c ./src/qpixel.c -o ./bin/qpixel.o -O2
 clang -Iinclude -c ./src/qmesh.c -o ./bin/qmesh.o -O2
-clang ./bin/main.o ./bin/qmath.o ./bin/qpixel.o ./bin/qmesh.o -o main.exe
+clang -Iinclude -c ./src/qlod.c -o ./bin/qlod.o -O2
+clang -Iinclude -c ./src/qtime.c -o ./bin/qtime.o -O2
+clang -Iinclude -c ./src/qsched.c -o ./bin/qsched.o -O2
+clang -Iinclude -c ./src/qthread.c -o ./bin/qthread.o -O2
+clang -Iinclude -c ./src/qswap.c -o ./bin/qswap.o -O2
+clang -Iinclude -c ./src/qpipe.c -o ./bin/qpipe.o -O2
+clang -Iinclude -c ./src/qshadow.c -o ./bin/qshadow.o -O2
+clang -Iinclude -c ./src/qpbr.c -o ./bin/qpbr.o -O2
+clang -Iinclude -c ./src/qskin.c -o ./bin/qskin.o -O2
+clang -Iinclude -c ./src/qlight.c -o ./bin/qlight.o -O2
+clang -Iinclude -c ./src/qprofile.c -o ./bin/qprofile.o -O2
+clang ./bin/main.o ./bin/qmath.o ./bin/qpixel.o ./bin/qmesh.o ./bin/qlod.o ./bin/qtime.o ./bin/qsched.o ./bin/qthread.o ./bin/qswap.o ./bin/qpipe.o ./bin/qshadow.o ./bin/qpbr.o ./bin/qskin.o ./bin/qlight.o ./bin/qprofile.o -o main.exe
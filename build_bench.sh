@@ -0,0 +1,14 @@
+#!/bin/sh
+# Headless benchmark, prints JSON: ./bench [frames] [out.json]
+CC=${CC:-clang}
+mkdir -p bin
+$CC -Iinclude -c ./src/bench.c -o ./bin/bench.o -O2
+$CC -Iinclude -c ./src/qmath.c -o ./bin/qmath.o -O2
+$CC -Iinclude -c ./src/qpixel.c -o ./bin/qpixel.o -O2
+$CC -Iinclude -c ./src/qmesh.c -o ./bin/qmesh.o -O2
+$CC -Iinclude -c ./src/qlod.c -o ./bin/qlod.o -O2
+$CC -Iinclude -c ./src/qtga.c -o ./bin/qtga.o -O2
+$CC -Iinclude -c ./src/qshader.c -o ./bin/qshader.o -O2
+$CC -Iinclude -c ./src/qtime.c -o ./bin/qtime.o -O2
+$CC -Iinclude -c ./src/qprofile.c -o ./bin/qprofile.o -O2
+$CC ./bin/bench.o ./bin/qmath.o ./bin/qpixel.o ./bin/qmesh.o ./bin/qlod.o ./bin/qtga.o ./bin/qshader.o ./bin/qtime.o ./bin/qprofile.o -o bench -lm
@@ -4,4 +4,10 @@ clang -Iinclude -c ./src/qpixel.c -o ./bin/qpixel.o -O2
 clang -Iinclude -c ./src/qmesh.c -o ./bin/qmesh.o -O2
 clang -Iinclude -c ./src/qtga.c -o ./bin/qtga.o -O2
 clang -Iinclude -c ./src/utils.c -o ./bin/utils.o -O2
-clang ./bin/demo0.o ./bin/qmath.o ./bin/qpixel.o ./bin/qmesh.o ./bin/qtga.o ./bin/utils.o -o demo0.exe
+clang -Iinclude -c ./src/qlod.c -o ./bin/qlod.o -O2
+clang -Iinclude -c ./src/qtime.c -o ./bin/qtime.o -O2
+clang -Iinclude -c ./src/qsched.c -o ./bin/qsched.o -O2
+clang -Iinclude -c ./src/qthread.c -o ./bin/qthread.o -O2
+clang -Iinclude -c ./src/qswap.c -o ./bin/qswap.o -O2
+clang -Iinclude -c ./src/qprofile.c -o ./bin/qprofile.o -O2
+clang ./bin/demo0.o ./bin/qmath.o ./bin/qpixel.o ./bin/qmesh.o ./bin/qtga.o ./bin/utils.o ./bin/qlod.o ./bin/qtime.o ./bin/qsched.o ./bin/qthread.o ./bin/qswap.o ./bin/qprofile.o -o demo0.exe
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Headless build for Linux / servers, renders to an image file.
+CC=${CC:-clang}
+mkdir -p bin
+$CC -Iinclude -c ./src/headless.c -o ./bin/headless.o -O2
+$CC -Iinclude -c ./src/qmath.c -o ./bin/qmath.o -O2
+$CC -Iinclude -c ./src/qpixel.c -o ./bin/qpixel.o -O2
+$CC -Iinclude -c ./src/qmesh.c -o ./bin/qmesh.o -O2
+$CC -Iinclude -c ./src/qlod.c -o ./bin/qlod.o -O2
+$CC -Iinclude -c ./src/qimage.c -o ./bin/qimage.o -O2
+$CC -Iinclude -c ./src/qtga.c -o ./bin/qtga.o -O2
+$CC -Iinclude -c ./src/qshader.c -o ./bin/qshader.o -O2
+$CC -Iinclude -c ./src/qtime.c -o ./bin/qtime.o -O2
+$CC -Iinclude -c ./src/qsched.c -o ./bin/qsched.o -O2
+$CC -Iinclude -c ./src/qthread.c -o ./bin/qthread.o -O2
+$CC -Iinclude -c ./src/qswap.c -o ./bin/qswap.o -O2
+$CC -Iinclude -c ./src/qpipe.c -o ./bin/qpipe.o -O2
+$CC -Iinclude -c ./src/qprofile.c -o ./bin/qprofile.o -O2
+$CC ./bin/headless.o ./bin/qmath.o ./bin/qpixel.o ./bin/qmesh.o ./bin/qlod.o ./bin/qimage.o ./bin/qtga.o ./bin/qshader.o ./bin/qtime.o ./bin/qsched.o ./bin/qthread.o ./bin/qswap.o ./bin/qpipe.o ./bin/qprofile.o -o headless -lm -lpthread
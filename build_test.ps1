@@ -3,4 +3,7 @@ clang -Iinclude -c ./src/qmath.c -o ./bin/qmath.o -O2
 clang -Iinclude -c ./src/qpixel.c -o ./bin/qpixel.o -O2
 clang -Iinclude -c ./src/qmesh.c -o ./bin/qmesh.o -O2
 clang -Iinclude -c ./src/qtga.c -o ./bin/qtga.o -O2
-clang ./bin/test.o ./bin/qmath.o ./bin/qpixel.o ./bin/qmesh.o ./bin/qtga.o -o test.exe
+clang -Iinclude -c ./src/qlod.c -o ./bin/qlod.o -O2
+clang -Iinclude -c ./src/qtime.c -o ./bin/qtime.o -O2
+clang -Iinclude -c ./src/qprofile.c -o ./bin/qprofile.o -O2
+clang ./bin/test.o ./bin/qmath.o ./bin/qpixel.o ./bin/qmesh.o ./bin/qtga.o ./bin/qlod.o ./bin/qtime.o ./bin/qprofile.o -o test.exe
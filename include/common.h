@@ -1,16 +1,15 @@
 #pragma once
 
-#include <time.h>
-
+#ifdef _WIN32
 #pragma comment(lib, "kernel32.lib")
 #pragma comment(lib, "user32.lib")
 #pragma comment(lib, "gdi32.lib")
 #pragma comment(lib, "comdlg32.lib")
+#endif
 
 #define USER_WIDTH 480
 #define USER_HEIGHT 640
 #define LOG printf
 
-const clock_t CLOCKS_PER_MS = CLOCKS_PER_SEC / 1000;
-
-const clock_t MIN_RESET = 1000 / 30;
+#define FRAME_MS (1000.0 / 60)   // frame interval of the demos
+#define STEP_MS (1000.0 / 30)    // simulation step of the demos
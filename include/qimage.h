@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Writers for frames rendered without a window. Pixels are BGRA, 4 bytes
+// each, top row first, the layout of device->colorBuffer.
+
+/**
+ * @brief Writes a binary (P6) PPM file. Alpha is dropped.
+ * 
+ * @param fn        File name
+ * @param bgra      Pixels
+ * @param width     Width
+ * @param height    Height
+ * @return int  0 if success.
+ */
+int write_ppm(const char *fn, const uint8_t *bgra, int width, int height);
+
+/**
+ * @brief Writes an uncompressed 32 bit TGA file, the pixels are stored as
+ *      they are.
+ * 
+ * @param fn        File name
+ * @param bgra      Pixels
+ * @param width     Width
+ * @param height    Height
+ * @return int  0 if success.
+ */
+int write_tga(const char *fn, const uint8_t *bgra, int width, int height);
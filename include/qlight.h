@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include "qmath.h"
+#include "qpixel.h"
+
+#define CLUSTER_TILE 64             // pixels per cluster side on screen
+#define CLUSTER_SLICES 16           // depth slices, exponential near to far
+#define CLUSTER_MAX_LIGHTS 65536    // light indices are 16 bit
+
+/**
+ * @brief Point lights binned into clusters, screen tiles by depth slices of
+ *      the view frustum. Built once per frame; a fragment then loops over
+ *      the lights of its cluster only, not over every light. The lists are
+ *      packed: the lights of cluster c are indices[offsets[c]] up to
+ *      indices[offsets[c + 1]].
+ */
+typedef struct
+{
+    int      tiles_x, tiles_y;
+    float    near, far;     // of the projection
+    float    slice_scale;   // slices per log depth
+    float    p00, p11;      // projection scale of x and y
+
+    const point_light_t *lights;    // of the frame, not owned
+    vec3_t   *view_pos;     // per light, view space
+    uint32_t n_lights;
+    uint32_t light_capacity;
+
+    uint32_t *offsets;      // per cluster, and one past the last
+    uint16_t *indices;
+    uint32_t n_indices;
+    uint32_t index_capacity;
+    uint32_t max_per_cluster;   // of the last build
+} light_clusters_t;
+
+/**
+ * @brief Allocate the cluster grid of a screen.
+ *
+ * @param lc        Clusters
+ * @param width     Screen width in pixels
+ * @param height    Screen height in pixels
+ * @return int      0 on success
+ */
+int light_clusters_init(light_clusters_t *lc, int width, int height);
+
+/**
+ * @brief Free the clusters.
+ */
+void light_clusters_destroy(light_clusters_t *lc);
+
+/**
+ * @brief Bin lights for a view. Each light goes to the clusters its
+ *      sphere's screen rectangle and depth range overlap, conservative.
+ *      Lights behind the camera or beyond far are dropped.
+ *
+ * @param lc            Clusters
+ * @param m_project     Perspective projection, symmetric
+ * @param m_camera      World -> view
+ * @param lights        Lights, must stay until the frame is shaded
+ * @param n_lights      Up to CLUSTER_MAX_LIGHTS
+ */
+void light_clusters_build(light_clusters_t *lc, mat4_t *m_project,
+                          mat4_t *m_camera, const point_light_t *lights,
+                          uint32_t n_lights);
+
+/**
+ * @brief Lights that may reach a point.
+ *
+ * @param lc        Clusters
+ * @param p         View space position
+ * @param indices   Output, into the lights passed to light_clusters_build
+ * @return uint32_t Number of indices
+ */
+uint32_t light_clusters_find(light_clusters_t *lc, vec3_t p,
+                             const uint16_t **indices);
+
+/**
+ * @brief Windowed inverse square falloff, 0 at the light's radius.
+ *
+ * @param d2        Squared distance to the light
+ * @param radius    Radius of the light
+ * @return float    Attenuation
+ */
+float point_light_falloff(float d2, float radius);
+
+/**
+ * @brief Lambert lighting of a point by the lights of its cluster.
+ *
+ * @param lc    Clusters
+ * @param p     View space position
+ * @param n     View space normal, normalized
+ * @return vec3_t  Sum of the light colors times falloff and n.l
+ */
+vec3_t light_clusters_diffuse(light_clusters_t *lc, vec3_t p, vec3_t n);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "qmesh.h"
+
+#define MESH_LOD_MAX 8
+
+/**
+ * @brief A chain of progressively simplified meshes. levels[0] is the source
+ *      mesh, every following level keeps about `ratio` of the faces of the
+ *      previous one.
+ */
+typedef struct
+{
+    uint32_t n_levels;
+    mesh_t   *levels[MESH_LOD_MAX];
+    float    errors[MESH_LOD_MAX];  // geometric error in object space units
+    vec3_t   center;                // bounding box center of levels[0]
+} mesh_lod_t;
+
+/**
+ * @brief Simplify mesh by quadric error edge collapse
+ *
+ * @param mesh          Source mesh
+ * @param target_faces  Number of faces to reach (best effort)
+ * @param error         Output geometric error of the result, may be NULL
+ * @return mesh_t*      A new mesh. Submeshes and batches are kept.
+ */
+mesh_t *simplify_mesh(mesh_t *mesh, uint32_t target_faces, float *error);
+
+/**
+ * @brief Build LOD chain for mesh. Generation stops early once the mesh
+ *      can't be simplified any further.
+ *
+ * @param mesh      Source mesh, stored as levels[0] (not copied). Levels get
+ *                  meshlets if mesh has them.
+ * @param n_levels  Number of levels including the source, <= MESH_LOD_MAX
+ * @param ratio     Face ratio between two neighbouring levels, e.g. 0.5
+ * @return mesh_lod_t*  The LOD chain
+ */
+mesh_lod_t *build_mesh_lod(mesh_t *mesh, uint32_t n_levels, float ratio);
+
+/**
+ * @brief Release the generated levels. levels[0] is not released.
+ *
+ * @param lod   The LOD chain
+ */
+void destroy_mesh_lod(mesh_lod_t *lod);
+
+/**
+ * @brief Select the coarsest level whose error projected to screen stays
+ *      within the budget.
+ *
+ * @param lod           The LOD chain
+ * @param pixels_per_unit   Screen size (pixels) of one object space unit
+ * @param error_budget  Allowed error in pixels
+ * @return uint32_t     Level index
+ */
+uint32_t select_mesh_lod(mesh_lod_t *lod, float pixels_per_unit,
+                         float error_budget);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 #define PI 3.1415926
 
 typedef struct { float x, y, z, w; } vec4_t;
@@ -61,15 +63,62 @@ float calc_det3(mat4_t * m, int r, int c);
 float calc_adjugate_mat(mat4_t * m, mat4_t * out);
 
 /**
- * @brief Mat4 multiply, a <- a * b
+ * @brief Mat4 multiply, a <- a * b. a and b may be the same matrix.
  * 
  * @param a     Mat a
  * @param b     Mat b
  */
 void mat4_mul(mat4_t * a, mat4_t * b);
 
+/**
+ * @brief Mat4 multiply, out <- a * b. out may be a or b.
+ * 
+ * @param a     Mat a
+ * @param b     Mat b
+ * @param out   Result
+ */
+void mat4_mul_to(mat4_t * a, mat4_t * b, mat4_t * out);
+
+/**
+ * @brief n multiplies, out[i] <- a[i] * b[i]. With SSE the products run 4
+ *      at a time (8 with AVX), each lane of a register holding the same
+ *      element of a different matrix.
+ * 
+ * @param a     Left matrices
+ * @param b     Right matrices
+ * @param out   Results, out[i] may be a[i] or b[i] but no other input
+ * @param n     Number of products
+ */
+void mat4_mul_batch(mat4_t ** a, mat4_t ** b, mat4_t ** out, uint32_t n);
+
 void calc_inv_mat(mat4_t * m, mat4_t * out);
 
+/**
+ * @brief Inverse of an affine matrix (last row 0, 0, 0, 1) in closed form,
+ *      much cheaper than calc_inv_mat
+ * 
+ * @param m     Affine matrix
+ * @param out   The inverse
+ */
+void calc_affine_inv_mat(mat4_t * m, mat4_t * out);
+
+/**
+ * @brief Inverse of a rotation + translation matrix, e.g. a lookat matrix
+ * 
+ * @param m     Rigid matrix
+ * @param out   The inverse
+ */
+void calc_rigid_inv_mat(mat4_t * m, mat4_t * out);
+
+/**
+ * @brief Normal matrix, the inverse transpose of the upper 3x3 of m. Keeps
+ *      normals perpendicular to surfaces under non-uniform scale.
+ * 
+ * @param m     Affine matrix
+ * @param out   The normal matrix, no translation
+ */
+void calc_normal_mat(mat4_t * m, mat4_t * out);
+
 float clip_float(float x, float a, float b);
 
 float lerp(float a, float b, float x);
@@ -96,12 +145,49 @@ vec3_t vec3_cross(vec3_t a, vec3_t b);
 
 float  vec3_dot(vec3_t a, vec3_t b);
 
+float  rsqrt(float x);
+
 vec3_t vec3_normalize(vec3_t v);
 
 vec3_t vec3_mat_mul(vec3_t, mat4_t *);
 
 vec3_t vec3_clip(vec3_t v, float a, float b);
 
+/**
+ * @brief Transforms n points (w = 1) by m, out[i] = m * (in[i], 1)
+ * 
+ * @param m     The matrix
+ * @param in    Points
+ * @param out   Homogeneous results
+ * @param n     Number of points
+ */
+void mat4_transform_points(mat4_t * m, const vec3_t * in, vec4_t * out,
+    uint32_t n);
+
+/**
+ * @brief Transforms n directions (w = 0) by the upper 3x3 of m. in and out
+ *      may be the same array.
+ * 
+ * @param m     The matrix
+ * @param in    Directions
+ * @param out   Results
+ * @param n     Number of directions
+ */
+void mat4_transform_vectors(mat4_t * m, const vec3_t * in, vec3_t * out,
+    uint32_t n);
+
+/**
+ * @brief Same as mat4_transform_vectors, results are normalized. Pass the
+ *      inverse transpose of the world matrix for normals.
+ * 
+ * @param m     The matrix
+ * @param in    Normals
+ * @param out   Normalized results
+ * @param n     Number of normals
+ */
+void mat4_transform_normals(mat4_t * m, const vec3_t * in, vec3_t * out,
+    uint32_t n);
+
 /**
  * @brief Calculates new aabb after the translation
  * 
@@ -127,3 +213,14 @@ quat_t quat_from_axis_angle(vec3_t u, float theta);
  * @param q     Quaterion (normalized)
  */
 void mat4_from_quat(mat4_t * m, quat_t q);
+
+/**
+ * @brief Spherical interpolation along the shorter arc, normalized lerp
+ *      when a and b are nearly the same
+ * 
+ * @param a         Rotation at t = 0 (normalized)
+ * @param b         Rotation at t = 1 (normalized)
+ * @param t         Blend factor in [0, 1]
+ * @return quat_t   Normalized quaternion
+ */
+quat_t quat_slerp(quat_t a, quat_t b, float t);
@@ -4,12 +4,53 @@
 #include <stdint.h>
 #include "qmath.h"
 
+#define MESH_NAME_LEN 64
+#define MESHLET_MAX_FACES 64
+#define MESH_MAX_INFLUENCES 4      // joints per skinned vertex
+
 typedef enum
 {
     T_TEXCOORD = 1,
     T_NORMAL = 2
 } mesh_type_t;
 
+/**
+ * @brief A run of faces sharing one object / group name and one material.
+ */
+typedef struct
+{
+    char     name[MESH_NAME_LEN];   // object or group name ("o" / "g")
+    uint32_t material;              // index into mesh->material_names
+    uint32_t first_face;
+    uint32_t n_faces;
+} submesh_t;
+
+/**
+ * @brief Contiguous faces drawn with one material. Submeshes are reordered at
+ *      load time so that every material owns exactly one draw range.
+ */
+typedef struct
+{
+    uint32_t material;
+    uint32_t first_face;
+    uint32_t n_faces;
+} draw_range_t;
+
+/**
+ * @brief A cluster of neighbouring faces with bounds for culling whole
+ *      clusters before any of their vertices is processed.
+ */
+typedef struct
+{
+    uint32_t first_face;
+    uint32_t n_faces;
+    vec3_t   center;        // bounding sphere
+    float    radius;
+    vec3_t   cone_axis;     // average face normal
+    float    cone_cutoff;   // sin of the normal cone half angle, > 1 if the
+                            //   cluster can't be backface culled
+} meshlet_t;
+
 typedef struct
 {
     vec3_t *vertices;
@@ -24,6 +65,22 @@ typedef struct
     uint32_t n_normals;
     uint32_t n_faces;
 
+    submesh_t *submeshes;
+    uint32_t n_submeshes;
+
+    char (*material_names)[MESH_NAME_LEN];  // "usemtl" names, "" if unnamed
+    uint32_t n_materials;
+
+    draw_range_t *batches;          // one per material, ordered by material
+    uint32_t n_batches;
+
+    meshlet_t *meshlets;            // ordered by first_face, NULL if not built
+    uint32_t n_meshlets;
+
+    // per vertex, NULL if not skinned (see mesh_set_skin in qskin.h)
+    uint8_t (*joints)[MESH_MAX_INFLUENCES];
+    float (*weights)[MESH_MAX_INFLUENCES];  // sum to 1, unused joints 0
+
     mesh_type_t mesh_type;
 } mesh_t;
 
@@ -35,10 +92,14 @@ typedef struct
 void destroy_mesh(mesh_t *mesh);
 
 /**
- * @brief Read obj and build mesh from it
+ * @brief Read obj and build mesh from it. Polygons are fan-triangulated while
+ *      reading, and faces are split into submeshes whenever "o", "g" or
+ *      "usemtl" changes. Every face index is valid after loading: corners
+ *      without texcoord point to an appended (0, 0) texcoord and polygons
+ *      without normals get appended flat normals.
  * 
  * @param fn  The filename
- * @return mesh_t*  The mesh. NULL if any error.
+ * @return mesh_t*  The mesh. NULL if any error (e.g. index out of range).
  */
 mesh_t *load_mesh(const char *fn);
 
@@ -50,3 +111,13 @@ mesh_t *load_mesh(const char *fn);
  * @return vec3_t 
  */
 vec3_t mesh_center(mesh_t *mesh);
+
+
+/**
+ * @brief Partition faces into meshlets of neighbouring faces. Faces are
+ *      reordered within their submesh, so submeshes and batches stay valid.
+ * 
+ * @param mesh      The mesh
+ * @param max_faces Maximum faces per meshlet, e.g. MESHLET_MAX_FACES
+ */
+void build_meshlets(mesh_t *mesh, uint32_t max_faces);
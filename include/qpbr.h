@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+#include "qmath.h"
+
+#define PBR_ENV_SIZE 64             // texels per side of the sharpest level
+#define PBR_ENV_LEVELS 5            // roughness 0 to 1 in even steps
+#define PBR_LUT_SIZE 32             // BRDF LUT, n.v by roughness
+#define PBR_PREFILTER_SAMPLES 128   // GGX samples per prefiltered texel
+#define PBR_LUT_SAMPLES 256         // GGX samples per LUT entry
+#define PBR_SH_SAMPLES 4096         // directions projected onto SH
+
+/**
+ * @brief Radiance arriving from direction dir, world space.
+ */
+typedef vec3_t (*radiance_fn_t)(void *user, vec3_t dir);
+
+/**
+ * @brief Image based lighting, split-sum style, everything precomputed by
+ *      pbr_env_build so shading is table lookups:
+ *
+ *      - levels: the environment in octahedral maps, level i prefiltered
+ *        with GGX of roughness i / (PBR_ENV_LEVELS - 1) and half the size
+ *        of the previous one. Octahedral needs no trigonometry to sample.
+ *      - lut: scale and bias of F0 for the specular integral.
+ *      - sh: diffuse irradiance, 9 spherical harmonics, already divided by
+ *        pi and multiplied by the basis constants.
+ */
+typedef struct
+{
+    float *levels[PBR_ENV_LEVELS];  // RGBA per texel, A unused
+    float sh[9][4];                 // RGB per coefficient, 4 for SIMD
+    float lut[PBR_LUT_SIZE * PBR_LUT_SIZE][2];  // n.v in x, roughness in y
+} pbr_env_t;
+
+/**
+ * @brief Metallic-roughness material.
+ */
+typedef struct
+{
+    vec3_t albedo;          // base color, linear
+    float  metallic;        // 0 dielectric, 1 metal
+    float  roughness;       // perceptual, 0 mirror to 1
+    float  ao;              // ambient occlusion of the image based light
+} pbr_material_t;
+
+/**
+ * @brief Precompute the lighting of an environment. Slow, call at load.
+ *
+ * @param env       Environment
+ * @param radiance  Radiance of the environment per direction
+ * @param user      Passed to radiance
+ * @return int      0 on success
+ */
+int pbr_env_build(pbr_env_t *env, radiance_fn_t radiance, void *user);
+
+/**
+ * @brief Free the prefiltered maps.
+ */
+void pbr_env_destroy(pbr_env_t *env);
+
+/**
+ * @brief A sky for pbr_env_build: blue gradient above the horizon, brown
+ *      ground below and a sun.
+ *
+ * @param user  vec3_t * direction towards the sun, NULL for straight up
+ * @param dir   Direction
+ * @return vec3_t  Radiance
+ */
+vec3_t pbr_sky_radiance(void *user, vec3_t dir);
+
+/**
+ * @brief Prefiltered environment, trilinear between the two levels around
+ *      roughness.
+ *
+ * @param env       Environment
+ * @param dir       Direction, normalized
+ * @param roughness Perceptual roughness
+ * @return vec3_t   Radiance
+ */
+vec3_t pbr_sample_env(const pbr_env_t *env, vec3_t dir, float roughness);
+
+/**
+ * @brief Diffuse irradiance from the SH, divided by pi.
+ *
+ * @param env   Environment
+ * @param n     Normal, normalized
+ * @return vec3_t  Outgoing radiance of a white Lambertian surface
+ */
+vec3_t pbr_irradiance(const pbr_env_t *env, vec3_t n);
+
+/**
+ * @brief Shade a point with one directional light and the environment.
+ *      Direct light is GGX with a Smith visibility approximation and
+ *      Schlick Fresnel, one square root and no powf; the environment is
+ *      the split-sum. All directions in the space of the environment.
+ *
+ * @param env       Environment, NULL for direct light only
+ * @param m         Material
+ * @param n         Normal, normalized
+ * @param v         Towards the eye, normalized
+ * @param l         Towards the light, normalized
+ * @param light     Light color times intensity, and shadowing
+ * @return vec3_t   Linear RGB
+ */
+vec3_t pbr_shade(const pbr_env_t *env, const pbr_material_t *m, vec3_t n,
+                 vec3_t v, vec3_t l, vec3_t light);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include "qpixel.h"
+#include "qthread.h"
+
+#define PIPELINE_MAX_LATENCY 2
+
+/**
+ * @brief What the back end needs to draw a frame. Recording copies the
+ *      matrices, LOD level and materials of every object, so the app can
+ *      move objects while the frame renders. Meshes and material contents
+ *      must stay unchanged until the frame is done (pipeline_wait_idle).
+ */
+typedef struct
+{
+    draw_list_t draws;      // set draws.keep_order to skip sorting
+    point_light_t *lights;  // copy of the scene's
+    uint32_t n_lights;
+    uint32_t light_capacity;
+    mat4_t   m_project;
+    mat4_t   m_camera;
+    uint64_t frame;         // 1 for the first frame submitted
+    void     *user;         // per frame data of the app
+} frame_snapshot_t;
+
+/**
+ * @brief Renders a snapshot on the render thread. The device already has
+ *      the snapshot's m_project and m_camera. Typically binds a target,
+ *      clears it, calls draw_list_execute(device, &frame->draws) and
+ *      presents.
+ */
+typedef void (*frame_render_fn_t)(void *user, device_t *device,
+                                  frame_snapshot_t *frame);
+
+/**
+ * @brief Two-stage frame pipeline. The app thread updates the scene and
+ *      records frame N + 1 (culling input, LOD selection, sorting) while a
+ *      render thread executes frame N (vertex, raster, shading). latency
+ *      is how many recorded frames may wait for or be in the render
+ *      thread, 1 or 2, and uses latency + 1 snapshots.
+ */
+typedef struct
+{
+    int               latency;
+    int               n_snapshots;
+    frame_snapshot_t  snapshots[PIPELINE_MAX_LATENCY + 1];
+    device_t          front;        // view settings for recording only
+    device_t          *device;      // owned by the render thread
+
+    uint64_t          submitted;    // frames handed to the render thread
+    uint64_t          completed;    // frames it has finished
+
+    frame_render_fn_t render;
+    void              *user;
+    thread_t          thread;
+    mutex_t           lock;
+    cond_t            cond;
+    int               quit;
+} frame_pipeline_t;
+
+/**
+ * @brief Start the render thread. From now on only it may use device.
+ *      The size and lod_error of device are used for recording.
+ * 
+ * @param latency 1 or 2
+ * @return int  0 on success
+ */
+int pipeline_init(frame_pipeline_t *p, int latency, device_t *device,
+                  frame_render_fn_t render, void *user);
+
+/**
+ * @brief Finish the submitted frames, stop the thread and free the
+ *      snapshots. The device can be used by the caller again.
+ */
+void pipeline_destroy(frame_pipeline_t *p);
+
+/**
+ * @brief Wait for a free snapshot to record the next frame into.
+ */
+frame_snapshot_t *pipeline_begin_frame(frame_pipeline_t *p);
+
+/**
+ * @brief Record scene into frame with the frame's m_project and m_camera,
+ *      call after scene_update. The scene's lights are copied.
+ */
+void pipeline_record(frame_pipeline_t *p, frame_snapshot_t *frame,
+                     scene_t *scene);
+
+/**
+ * @brief Hand frame to the render thread.
+ * 
+ * @return uint64_t  Frame number, see pipeline_wait_frame
+ */
+uint64_t pipeline_submit(frame_pipeline_t *p, frame_snapshot_t *frame);
+
+/**
+ * @brief Block until frame has been rendered.
+ */
+void pipeline_wait_frame(frame_pipeline_t *p, uint64_t frame);
+
+/**
+ * @brief Block until every submitted frame has been rendered.
+ */
+void pipeline_wait_idle(frame_pipeline_t *p);
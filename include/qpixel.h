@@ -1,9 +1,22 @@
 #pragma once
 
-#include <windows.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <math.h>
 #include "qmath.h"
 #include "qmesh.h"
+#include "qlod.h"
+#include "qprofile.h"
+
+#define TRIANGLE_BATCH 8     // triangles set up together by draw_triangles
+#define FRAGMENT_BATCH 256   // fragments rasterized before they are shaded
+#define DEBUG_TILE 16        // tile size of DEBUG_VIEW_TRIANGLES
+#define MSAA_SAMPLES 4       // samples per pixel of set_msaa
+#define SHADING_TILE 16      // tile size of the shading rate map
+#define MAX_SHADING_RATE 4   // coarsest shading block, pixels per side
+#define MIN_RENDER_SCALE 0.25f  // lowest scale of set_render_scale
+#define RT_MAX_COLORS 4      // color attachments of a render target
+#define SCENE_MAX_DEPTH 32   // levels of a transform hierarchy, roots at 0
 
 typedef unsigned char * color_buffer_t;
 typedef float *         depth_buffer_t;
@@ -12,6 +25,87 @@ typedef struct { float b, g, r; } color3_t;
 
 typedef struct device_t device_t;
 
+/**
+ * @brief Debug views replace the color output with a heatmap of what the
+ *      raster path counted while drawing the frame.
+ */
+typedef enum
+{
+    DEBUG_VIEW_NONE = 0,
+    DEBUG_VIEW_TESTED,          // fragments depth tested per pixel
+    DEBUG_VIEW_SHADED,          // fragments shaded per pixel
+    DEBUG_VIEW_DEPTH_FAIL,      // fragments failing the depth test per pixel
+    DEBUG_VIEW_TRIANGLES,       // triangles per DEBUG_TILE tile
+    N_DEBUG_VIEWS
+} debug_view_t;
+
+/**
+ * @brief Color and depth buffers a device can draw into in place of its
+ *      own, see bind_render_target. Every attachment is laid out as
+ *      colorBuffer, so what was drawn is read back as a texture where it
+ *      is, with render_target_sample.
+ */
+typedef struct
+{
+    int      width;
+    int      height;
+    int      n_colors;                  // color attachments, 1 or more
+    uint8_t  *colors[RT_MAX_COLORS];    // BGRA, top row first
+    float    *depth;                    // 1 / w, 0 where nothing was drawn
+} render_target_t;
+
+// the device's own buffers, and what is sized for them, while a render
+// target is bound
+typedef struct
+{
+    int      width, height;
+    int      out_width, out_height;
+    uint8_t  *color;
+    uint8_t  *out_color;
+    float    *depth;
+    uint8_t  *rate_map;
+    debug_view_t debug_view;
+    uint32_t *heat;
+} screen_binding_t;
+
+// a sample that passed the depth test, waiting for the fragment shader
+typedef struct
+{
+    int   x, y;
+    float l0, l1, l2;       // barycentric
+    float w;                // interpolated 1 / w
+    uint32_t mask;          // samples covered and in front for MSAA, pixels
+                            //   of the block for coarse shading
+    int   block;            // coarse shading block size, x, y its top left
+                            //   pixel in buffer rows, 0 for a pixel
+} fragment_t;
+
+typedef struct
+{
+    uint32_t first;     // first face
+    uint32_t count;     // number of faces
+} face_range_t;
+
+// camera in object space, for culling before vertex processing
+typedef struct
+{
+    vec4_t planes[6];
+    vec3_t eye;
+} cull_view_t;
+
+/**
+ * @brief Per instance state of draw_instanced, computed once per call.
+ */
+typedef struct
+{
+    cull_view_t view;
+    mat4_t m_world;         // model-view
+    mat4_t m_world_inv;
+    mat4_t m_normal;
+    mat4_t m_mvp;           // m_project * m_world
+    float  *unif;           // uniform block of the instance, may be NULL
+} instance_t;
+
 typedef void (*drawer_t)(device_t *device, mesh_t *mesh, void *material);
 typedef void (*vertex_shader_t)(device_t *device, float *unif, float *attr, float *vary);
 typedef void (*fragment_shader_t)(device_t *device, float *unif, float *vary, float w, color3_t * out);
@@ -20,21 +114,65 @@ typedef struct device_t
 {
     int             width;
     int             height;
-    color_buffer_t  colorBuffer;
+    color_buffer_t  colorBuffer;    // BGRA, 4 bytes per pixel
     depth_buffer_t  depthBuffer;
+    int             owns_depth;     // depthBuffer is freed by destroy_device
     mat4_t          m_project;
     mat4_t          m_camera;
-    mat4_t          m_world;
-    mat4_t          m_world_inv;
+    mat4_t          m_world;        // model-view in draw_scene
+    mat4_t          m_world_inv;    // inverse of m_world
+    mat4_t          m_normal;       // normal matrix of m_world
 
-    vec3_t          vertex[3];      // vertex
+    vec3_t          vertex[3 * TRIANGLE_BATCH];     // vertex
+
+    face_range_t    *ranges;        // faces the drawer should walk
+    uint32_t        n_ranges;
+    face_range_t    *range_buffer;  // storage of visible meshlet ranges
+    uint32_t        range_capacity;
 
     float           *unif;          // uniform
     size_t          unif_size;
-    float           *attr;          // attribute
+    float           *attr;          // attribute, 3 * TRIANGLE_BATCH corners
     size_t          attr_size;
-    float           *vary;          // varying
+    float           *vary;          // varying, 3 * TRIANGLE_BATCH corners
     size_t          vary_size;
+    float           *frag_vary;     // varying of the current fragment
+    size_t          frag_capacity;
+    fragment_t      fragments[FRAGMENT_BATCH];
+    uint32_t        n_fragments;
+
+    instance_t      *instances;     // visible instances of draw_instanced
+    uint32_t        n_instances;    // 0 outside draw_instanced
+    uint32_t        instance_capacity;
+    float           *instance;      // uniform block of the current instance
+
+    float           lod_error;      // LOD error budget in pixels
+    profiler_t      *profiler;      // stage timings, NULL to disable
+
+    int             msaa;           // samples per pixel, set by set_msaa
+    uint8_t         *msaa_color;    // BGRA per sample, pixels as depthBuffer
+    float           *msaa_depth;    // 1 / w per sample
+
+    int             shading_rate;   // fs once per rate x rate pixels of
+                                    //   the following draws, 1, 2 or 4
+    uint8_t         *rate_map;      // rate per SHADING_TILE tile, top row
+                                    //   first, NULL for none
+
+    float           render_scale;   // set by set_render_scale
+    int             out_width;      // output size, width and height are the
+    int             out_height;     //   render resolution within a frame
+    uint8_t         *out_color;     // output colorBuffer within a frame
+    uint8_t         *scaled_color;  // rendered into below full scale
+
+    render_target_t *target;        // bound by bind_render_target, NULL
+                                    //   for the device's own buffers
+    screen_binding_t screen;        // those buffers while a target is bound
+    color3_t        mrt_out[RT_MAX_COLORS - 1];    // fs output of color
+                                    //   attachments 1 and up of the target
+
+    debug_view_t    debug_view;     // set by set_debug_view
+    uint32_t        *heat;          // counts of the debug view, NULL if none
+    float           heat_scale;     // count shown as the hottest color
 
     drawer_t            drawer;
     vertex_shader_t     vs;
@@ -44,17 +182,15 @@ typedef struct device_t
     uint32_t object_count;
     uint32_t triangle_count;
     uint32_t texel_count;
+    uint32_t meshlet_count;
+    uint32_t meshlet_culled;
+    uint32_t instance_culled;       // instances with no visible meshlet
+    uint32_t culled_frustum;        // triangles rejected before raster
+    uint32_t culled_backface;
+    uint32_t culled_degenerate;
+    uint32_t culled_no_sample;      // cover no pixel center
 } device_t;
 
-typedef struct {
-    HDC             dc;             /* compatible DC */
-    HBITMAP         bmp;            /* device independent bitmap */
-    unsigned char   *buffer;        /* buffer */
-    int             width;
-    int             height;
-    int             pitch;
-} screen_t;
-
 typedef struct
 {
     vec3_t eye;
@@ -64,25 +200,94 @@ typedef struct
     float  aspect;
 } camera_t;
 
-typedef struct
+typedef struct object3d_t object3d_t;
+
+typedef struct object3d_t
 {
-    mesh_t *mesh;
+    mesh_t *mesh;           // NULL for a pure transform node
     void   *material;
+    void   **materials;     // per mesh material, NULL to use material for all
+    mesh_lod_t *lod;        // levels of mesh, NULL to always draw mesh
+
+    object3d_t *parent;     // NULL for a root, set by scene_set_parent
+    uint32_t depth;         // level in the hierarchy, 0 for roots
+    int    dirty;           // position / rotation / scale changed
+    int    moved;           // m_world changed in the last scene_update
 
-    vec3_t position;
+    vec3_t position;        // relative to parent
     quat_t rotation;
     vec3_t scale;
+    mat4_t m_local;         // parent space
     mat4_t m_world;
+    mat4_t m_world_inv;
+    mat4_t m_normal;        // inverse transpose of m_world, for normals
 } object3d_t;
 
+/**
+ * @brief An object recorded by draw_list_add, with everything the draw needs.
+ *      Executing it does not read the object, which may change meanwhile.
+ */
+typedef struct
+{
+    object3d_t *object;
+    mesh_t *mesh;           // LOD level picked for the object
+    void   **materials;     // of the object when recorded
+    void   *material;
+    void   *state;          // materials table, or material if there is none
+    float  depth;           // view depth of the object origin
+    mat4_t m_world;         // model-view
+    mat4_t m_world_inv;
+    mat4_t m_normal;
+} draw_item_t;
+
+/**
+ * @brief Objects of a frame, executed front-to-back and grouped by mesh and
+ *      material.
+ */
+typedef struct
+{
+    draw_item_t *items;
+    uint64_t *keys;         // sort keys, 2 * capacity with the scratch half
+    uint32_t *order;        // item indices, 2 * capacity
+    uint32_t n_items;
+    uint32_t capacity;
+
+    int keep_order;         // execute in submission order, for comparison
+
+    uint32_t state_changes_unsorted;    // mesh / material switches, submitted
+    uint32_t state_changes;             //   and executed order
+} draw_list_t;
+
+/**
+ * @brief A point light, reaching as far as radius.
+ */
+typedef struct
+{
+    vec3_t position;        // world space
+    float  radius;          // no light beyond
+    vec3_t color;           // color times intensity
+} point_light_t;
+
 typedef struct
 {
     int n_objects;
     object3d_t **objects;
+    draw_list_t draws;      // used by draw_scene
+
+    point_light_t *lights;  // see qlight.h for culling them per cluster
+    uint32_t n_lights;
+
+    object3d_t **order;     // objects sorted by depth, built by scene_update
+    int n_order;
+    int order_dirty;        // hierarchy changed, order is rebuilt
 } scene_t;
 
 /**
- * @brief Draw scene
+ * @brief Draw scene. device->m_world, m_world_inv and m_normal are set to
+ *      the model-view matrices of each object. Objects with a LOD chain draw
+ *      the coarsest level whose projected error is within device->lod_error
+ *      pixels. Objects go through scene->draws, sorted unless
+ *      scene->draws.keep_order is set.
  * 
  * @param device    Device handle
  * @param scene     Scene
@@ -90,8 +295,78 @@ typedef struct
 void draw_scene(device_t *device, scene_t *scene);
 
 
+/**
+ * @brief Start recording a new frame into list.
+ * 
+ * @param list  Draw list
+ */
+void draw_list_begin(draw_list_t *list);
+
+
+/**
+ * @brief Record obj with its model-view matrices and LOD level for the
+ *      current device->m_camera.
+ * 
+ * @param device    Device handle
+ * @param list      Draw list
+ * @param obj       Object, must have a mesh
+ */
+void draw_list_add(device_t *device, draw_list_t *list, object3d_t *obj);
+
+
+/**
+ * @brief Record the objects of scene that have a mesh and sort them unless
+ *      list->keep_order is set, the first half of draw_scene.
+ * 
+ * @param device    Device handle, for the camera and LOD selection
+ * @param list      Draw list
+ * @param scene     Scene
+ */
+void draw_list_record(device_t *device, draw_list_t *list, scene_t *scene);
+
+
+/**
+ * @brief Free the storage of list.
+ * 
+ * @param list  Draw list
+ */
+void draw_list_free(draw_list_t *list);
+
+
+/**
+ * @brief Radix sort the recorded objects by a 64 bit key: coarse view depth,
+ *      then mesh, then material, then exact depth. Counts the state changes
+ *      of the submitted and sorted orders.
+ * 
+ * @param list  Draw list
+ */
+void draw_list_sort(draw_list_t *list);
+
+
+/**
+ * @brief Draw the recorded objects in sorted order (submission order if
+ *      draw_list_sort was not called).
+ * 
+ * @param device    Device handle
+ * @param list      Draw list
+ */
+void draw_list_execute(device_t *device, draw_list_t *list);
+
+
+/**
+ * @brief Shaded fragments per covered pixel of the current frame. 1 means
+ *      every fragment that was shaded is visible.
+ * 
+ * @param device    Device handle
+ * @return float    Overdraw, 0 for an empty frame
+ */
+float get_overdraw(device_t *device);
+
+
 /**
  * @brief This will use device->drawer to assemble uniforms, varyings, etc.
+ *      The drawer walks the faces in device->ranges. If the mesh has
+ *      meshlets, the ones outside the frustum or facing away are skipped.
  * 
  * @param device  Device Handle
  * @param mesh  Mesh
@@ -100,6 +375,41 @@ void draw_scene(device_t *device, scene_t *scene);
 void draw_mesh(device_t *device, mesh_t *mesh, void *material);
 
 
+/**
+ * @brief Draw n_instances copies of mesh with one drawer call. The faces are
+ *      fetched once per triangle batch and set up for every instance, with
+ *      device->m_world, m_world_inv, m_normal and device->instance switched
+ *      per instance and restored on return. Meshlets are culled against
+ *      all instances at once and instances that see none of them are
+ *      skipped.
+ * 
+ * @param device        Device handle
+ * @param mesh          Mesh
+ * @param material      Material shared by all instances
+ * @param m_world       Object to world matrix per instance
+ * @param inst_unif     Uniform blocks, inst_unif_size floats per instance.
+ *                      May be NULL.
+ * @param inst_unif_size Floats per instance uniform block
+ * @param n_instances   Number of instances
+ */
+void draw_instanced(device_t *device, mesh_t *mesh, void *material,
+                    mat4_t *m_world, float *inst_unif, size_t inst_unif_size,
+                    uint32_t n_instances);
+
+
+/**
+ * @brief Draw mesh->batches, one drawer call per material.
+ * 
+ * @param device    Device handle
+ * @param mesh      Mesh
+ * @param materials Materials indexed by mesh material. A NULL entry (or a
+ *                  NULL table) falls back to material.
+ * @param material  Default material
+ */
+void draw_mesh_batches(device_t *device, mesh_t *mesh, void **materials,
+                       void *material);
+
+
 /**
  * @brief Draw triangle specified by vertices, unifroms and attributes.
  * 
@@ -108,6 +418,19 @@ void draw_mesh(device_t *device, mesh_t *mesh, void *material);
 void draw_triangle(device_t *device);
 
 
+/**
+ * @brief Draw n triangles at once. Triangle t uses device->vertex[3t..3t+2]
+ *      and the attributes of the same corners. Positions are set up together
+ *      and triangles outside the frustum, backfacing, with zero area or
+ *      covering no pixel center are rejected before the vertex shader runs.
+ *      Inside draw_instanced the batch is drawn once per instance.
+ * 
+ * @param device Device handle
+ * @param n      Number of triangles, <= TRIANGLE_BATCH
+ */
+void draw_triangles(device_t *device, int n);
+
+
 
 /**
  * @brief Setup device, initialize the depth buffer and color buffer according
@@ -124,6 +447,200 @@ void setup_device(device_t *device,
                   uint8_t *screen_buffer);
 
 
+/**
+ * @brief Setup device on caller owned memory, no window is involved.
+ * 
+ * @param device        Device handle
+ * @param width         Width
+ * @param height        Height
+ * @param color_buffer  width * height BGRA pixels
+ * @param depth_buffer  width * height floats, NULL to let the device
+ *                      allocate it
+ */
+void setup_device_offscreen(device_t *device,
+                            uint32_t width,
+                            uint32_t height,
+                            uint8_t *color_buffer,
+                            float *depth_buffer);
+
+
+/**
+ * @brief Free the buffers the device allocated itself. Caller owned color,
+ *      depth and shader buffers are left alone.
+ * 
+ * @param device Device handle
+ */
+void destroy_device(device_t *device);
+
+
+/**
+ * @brief Multisampling. With MSAA_SAMPLES, coverage and depth are tested
+ *      per sample of a rotated grid and fs runs once per pixel and triangle
+ *      (at the pixel center, or a covered sample when the center is
+ *      outside). resolve_msaa writes the frame into colorBuffer and
+ *      depthBuffer.
+ * 
+ * @param device  Device handle
+ * @param samples 1 to turn it off, or MSAA_SAMPLES
+ * @return int    0 on success, -1 for an unsupported count or with a
+ *                render target bound
+ */
+int set_msaa(device_t *device, int samples);
+
+
+/**
+ * @brief Average the samples of every pixel into colorBuffer and keep the
+ *      nearest sample depth in depthBuffer. Call before resolve_debug_view
+ *      and get_overdraw. Nothing happens without multisampling.
+ * 
+ * @param device Device handle
+ */
+void resolve_msaa(device_t *device);
+
+
+/**
+ * @brief Render below the output resolution. From the next clear_buffer
+ *      the frame is drawn into a device owned buffer of scale times the
+ *      output size per axis and resolve_render_scale filters it up into
+ *      colorBuffer. Depth, MSAA and the debug views work at the render
+ *      resolution, resolve them first. Call between frames.
+ * 
+ * @param device Device handle
+ * @param scale  Per axis, clamped to [MIN_RENDER_SCALE, 1], 1 for off
+ */
+void set_render_scale(device_t *device, float scale);
+
+
+/**
+ * @brief Bilinear upscale of the frame into the output colorBuffer, the
+ *      depth buffer is spread nearest. Restores the output size. Nothing
+ *      to do at full scale.
+ * 
+ * @param device Device handle
+ */
+void resolve_render_scale(device_t *device);
+
+
+/**
+ * @brief Coarse shading. fs runs once per rate x rate block, at the first
+ *      pixel of the block the triangle covers, and the color goes to every
+ *      covered pixel of the block. Coverage and depth stay per pixel. Set
+ *      device->shading_rate per draw, the rate map per screen tile; the
+ *      coarser of the two applies. Ignored with MSAA.
+ * 
+ * @param device Device handle
+ * @param rates  Rate of every SHADING_TILE tile of the output size, top
+ *               row first, copied.
+ *               NULL removes the map.
+ */
+void set_shading_rate_map(device_t *device, const uint8_t *rates);
+
+
+/**
+ * @brief Rate map that keeps full rate near the screen center and shades
+ *      2x2 and then 4x4 towards the edges.
+ * 
+ * @param device Device handle
+ * @param inner  Full rate within this fraction of the center to corner
+ *               distance
+ * @param outer  2x2 within this fraction, 4x4 beyond
+ */
+void set_foveated_rate_map(device_t *device, float inner, float outer);
+
+
+/**
+ * @brief Allocate a render target, cleared: black colors, empty depth.
+ *
+ * @param rt        Render target
+ * @param width     Width
+ * @param height    Height
+ * @param n_colors  Color attachments, 1 to RT_MAX_COLORS
+ * @return int      0 on success
+ */
+int render_target_init(render_target_t *rt, int width, int height,
+                       int n_colors);
+
+
+/**
+ * @brief Free the buffers of a render target. Unbind it first.
+ */
+void render_target_destroy(render_target_t *rt);
+
+
+/**
+ * @brief Draw into a render target from the next clear_buffer on, instead
+ *      of the device's color and depth buffers; NULL goes back to those,
+ *      as they were when the target was bound. Attachment 0 takes the
+ *      color of fs as usual, attachment i > 0 the color fs writes to
+ *      device->mrt_out[i - 1] in the same invocation. clear_buffer clears
+ *      attachment 0 as the screen and the others to black. fs_vertex_color
+ *      writes attachment 0 only.
+ *      Render scale, the shading rate map and the debug views apply to the
+ *      device's own buffers and are off while a target is bound; change
+ *      them with no target bound.
+ *
+ * @param device Device handle
+ * @param rt     Render target, NULL for the device's own buffers
+ * @return int   0 on success, -1 with MSAA on
+ */
+int bind_render_target(device_t *device, render_target_t *rt);
+
+
+/**
+ * @brief Bilinear read of a color attachment, clamped to the edges.
+ *      Texture coordinates are those of the raster: (0, 0) is the bottom
+ *      left corner of the target, (1, 1) the top right.
+ *
+ * @param rt        Render target
+ * @param index     Color attachment
+ * @param uv        Texture coordinates
+ * @return color3_t The color
+ */
+color3_t render_target_sample(const render_target_t *rt, int index,
+                              vec2_t uv);
+
+
+/**
+ * @brief Nearest read of the depth of a render target, 1 / w as drawn.
+ *
+ * @param rt        Render target
+ * @param uv        Texture coordinates, as render_target_sample
+ * @return float    1 / w, 0 where nothing was drawn
+ */
+float render_target_depth(const render_target_t *rt, vec2_t uv);
+
+
+/**
+ * @brief Built-in fragment shader for lighting done per vertex (Gouraud):
+ *      the color is the first three varyings, in color3_t order. With it
+ *      as device->fs only those are interpolated, and without MSAA, coarse
+ *      shading or a debug view the raster writes the color itself, with no
+ *      fragment batch or shader call.
+ */
+void fs_vertex_color(device_t *device, float *unif, float *vary, float w,
+                     color3_t *out);
+
+
+/**
+ * @brief Select a debug view. The raster path counts for it from the next
+ *      clear_buffer on, resolve_debug_view shows the counts.
+ * 
+ * @param device Device handle
+ * @param view   Debug view, DEBUG_VIEW_NONE to turn counting off
+ */
+void set_debug_view(device_t *device, debug_view_t view);
+
+
+/**
+ * @brief Overwrite the color buffer with the heatmap of the current debug
+ *      view, black (none) through blue, green and yellow to red (heat_scale
+ *      or more). Nothing happens without a debug view.
+ * 
+ * @param device Device handle
+ */
+void resolve_debug_view(device_t *device);
+
+
 /**
  * @brief Reset color buffer and depth buffer for new frame
  * 
@@ -133,8 +650,41 @@ void clear_buffer(device_t *device);
 
 
 /**
- * @brief Update world matrix
+ * @brief Update world matrix, its inverse and the normal matrix. The parent's
+ *      m_world must be up to date.
  * 
  * @param obj Object
  */
 void object_update_m_world(object3d_t * obj);
+
+
+/**
+ * @brief Mark the local transform of obj as changed, it and its subtree are
+ *      recomputed by the next scene_update.
+ * 
+ * @param obj Object
+ */
+void object_mark_dirty(object3d_t * obj);
+
+
+/**
+ * @brief Attach obj to parent (NULL to make it a root). Both must be in the
+ *      scene. The hierarchy stays acyclic and below SCENE_MAX_DEPTH levels:
+ *      obj can't go under itself or one of its descendants, and its
+ *      deepest descendant has to end up at a depth below SCENE_MAX_DEPTH.
+ * 
+ * @param scene     Scene
+ * @param obj       Child
+ * @param parent    New parent
+ * @return int      0 on success, -1 if refused, the hierarchy is unchanged
+ */
+int scene_set_parent(scene_t *scene, object3d_t *obj, object3d_t *parent);
+
+
+/**
+ * @brief Recompute the world matrices of dirty objects and their subtrees,
+ *      one hierarchy level at a time. Untouched subtrees cost a flag check.
+ * 
+ * @param scene     Scene
+ */
+void scene_update(scene_t *scene);
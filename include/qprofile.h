@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include "qtime.h"
+
+/**
+ * @brief Pipeline stages timed by the device. Zones nest (e.g. raster and
+ *      shade inside clip), totals are inclusive.
+ */
+typedef enum
+{
+    PROF_CLEAR = 0,
+    PROF_CULL,              // meshlet and instance culling
+    PROF_VERTEX,            // clip space transform and vertex shader
+    PROF_CLIP,              // homogeneous clipping of triangles that cross
+    PROF_SETUP,             // snapping, bounds, face and size rejection
+    PROF_RASTER,            // coverage and depth test
+    PROF_SHADE,             // fragment shader and color write
+    PROF_RESOLVE,           // MSAA resolve and upscale to the output
+    N_PROF_ZONES
+} prof_zone_t;
+
+typedef struct
+{
+    uint64_t start;         // ns, get_time_ns
+    uint64_t end;
+    uint32_t zone;
+    uint32_t thread;
+} prof_event_t;
+
+/**
+ * @brief Zone timings of one thread. A profiler is only written by the
+ *      thread that owns it, give every worker its own and merge them when
+ *      exporting.
+ */
+typedef struct
+{
+    uint64_t total[N_PROF_ZONES];   // ns since prof_reset
+    uint32_t count[N_PROF_ZONES];
+
+    int      record;                // keep every zone for the trace
+    uint32_t thread;                // tid in the trace
+    prof_event_t *events;
+    uint32_t n_events;
+    uint32_t capacity;
+} profiler_t;
+
+/**
+ * @brief Start of a zone, 0 if p is NULL (profiling off).
+ */
+static inline uint64_t prof_begin(profiler_t *p)
+{
+    return p ? get_time_ns() : 0;
+}
+
+void prof_add(profiler_t *p, prof_zone_t zone, uint64_t start, uint64_t end);
+
+/**
+ * @brief End of a zone started by prof_begin, nothing if p is NULL.
+ */
+static inline void prof_end(profiler_t *p, prof_zone_t zone, uint64_t start)
+{
+    if (p) prof_add(p, zone, start, get_time_ns());
+}
+
+/**
+ * @brief Clear totals and recorded events, keeps the event storage.
+ * 
+ * @param p Profiler
+ */
+void prof_reset(profiler_t *p);
+
+/**
+ * @brief Free the recorded events.
+ * 
+ * @param p Profiler
+ */
+void prof_destroy(profiler_t *p);
+
+/**
+ * @brief Name of a zone, as shown in the trace.
+ */
+const char *prof_zone_name(prof_zone_t zone);
+
+/**
+ * @brief Writes the recorded events of n profilers as Chrome trace event
+ *      JSON (chrome://tracing, Perfetto), one track per thread.
+ * 
+ * @param fn        File name
+ * @param profilers Profilers, one per thread
+ * @param n         Number of profilers
+ * @return int  0 if success.
+ */
+int prof_write_trace(const char *fn, profiler_t **profilers, int n);
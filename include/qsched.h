@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+#include "qtime.h"
+
+/**
+ * @brief Paces frames on the monotonic clock and runs the simulation in
+ *      fixed steps, so it advances the same whatever the frame rate.
+ *      A frame is:
+ * 
+ *          scheduler_begin_frame(&s);
+ *          while (scheduler_step(&s)) update(s.step_ms);
+ *          render(scheduler_alpha(&s));
+ *          scheduler_end_frame(&s);
+ *          scheduler_wait(&s);
+ * 
+ *      Render blends the previous and current step by alpha.
+ */
+typedef struct
+{
+    double   frame_ms;      // frame interval, 0 to run as fast as possible
+    double   step_ms;       // fixed simulation step
+    int      max_steps;     // steps in one frame at most, later ones dropped
+    int      virtual_clock; // a frame always takes frame_ms and never sleeps,
+                            // deterministic for headless runs
+
+    uint64_t now;           // ns, start of the current frame
+    uint64_t deadline;      // ns, start of the next frame
+    double   lag_ms;        // time not simulated yet
+    int      steps;         // steps taken in the current frame
+    uint32_t frame;         // frames begun
+    double   frame_time_ms; // measured interval of the last two frames
+} frame_scheduler_t;
+
+/**
+ * @brief Initialize a scheduler, the first frame starts now.
+ * 
+ * @param s Scheduler
+ * @param frame_ms Target frame interval, 0 for unpaced
+ * @param step_ms Simulation step
+ */
+void scheduler_init(frame_scheduler_t *s, double frame_ms, double step_ms);
+
+/**
+ * @brief Start a frame, the time since the last one becomes simulation lag.
+ */
+void scheduler_begin_frame(frame_scheduler_t *s);
+
+/**
+ * @brief Take one fixed step out of the lag.
+ * 
+ * @return int  1 if the caller should simulate one more step
+ */
+int scheduler_step(frame_scheduler_t *s);
+
+/**
+ * @brief How far the frame is between the last two steps.
+ * 
+ * @return float  In [0, 1), 0 at the latest step
+ */
+float scheduler_alpha(frame_scheduler_t *s);
+
+/**
+ * @brief Finish a frame and set the deadline of the next one. A late frame
+ *      moves the cadence instead of rushing the following frames.
+ */
+void scheduler_end_frame(frame_scheduler_t *s);
+
+/**
+ * @brief Time left until the next frame is due.
+ * 
+ * @return double  Milliseconds, 0 if due
+ */
+double scheduler_remaining_ms(frame_scheduler_t *s);
+
+/**
+ * @brief Sleep until the next frame is due.
+ */
+void scheduler_wait(frame_scheduler_t *s);
+
+/**
+ * @brief Picks the render resolution from measured render time. Pixels,
+ *      and so roughly render time, go with scale squared. The scale drops
+ *      after a few frames over budget and creeps back up only after many
+ *      frames well under it, so it does not flicker around the budget.
+ */
+typedef struct
+{
+    double   target_ms;     // render time budget of a frame
+    float    scale;         // render resolution per axis, output size 1
+    float    min_scale;
+    double   avg_ms;        // smoothed render time, at the current scale
+    int      over;          // frames in a row over budget
+    int      under;         // frames in a row under the headroom
+} resolution_controller_t;
+
+/**
+ * @brief Initialize a controller at full resolution.
+ * 
+ * @param c Controller
+ * @param target_ms Render time budget
+ * @param min_scale Lowest scale it may pick, in (0, 1]
+ */
+void resolution_init(resolution_controller_t *c, double target_ms,
+                     float min_scale);
+
+/**
+ * @brief Feed the render time of a frame.
+ * 
+ * @param c Controller
+ * @param render_ms Time the frame took at c->scale
+ * @return float  Scale for the next frame
+ */
+float resolution_update(resolution_controller_t *c, double render_ms);
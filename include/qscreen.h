@@ -0,0 +1,38 @@
+#pragma once
+
+// GDI presentation of the device color buffer, win32 demos only
+
+#include <windows.h>
+#include "qsched.h"
+
+typedef struct {
+    HDC             dc;             /* compatible DC */
+    HBITMAP         bmp;            /* device independent bitmap */
+    unsigned char   *buffer;        /* buffer */
+    int             width;
+    int             height;
+    int             pitch;
+} screen_t;
+
+/**
+ * @brief Wait for the next frame of the scheduler, returns early when a
+ *      window message arrives so input is not delayed by a frame.
+ */
+static inline void screen_wait_frame(frame_scheduler_t *s)
+{
+    double remaining;
+    while ((remaining = scheduler_remaining_ms(s)) > 0.0)
+    {
+        if (remaining < 1.0)
+        {
+            // too short for the message wait, finish on the clock
+            scheduler_wait(s);
+            return;
+        }
+        if (MsgWaitForMultipleObjects(0, NULL, FALSE, (DWORD)remaining,
+            QS_ALLINPUT) == WAIT_OBJECT_0)
+        {
+            return;
+        }
+    }
+}
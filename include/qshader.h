@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdio.h>
+#include "qmath.h"
+#include "qpixel.h"
+#include "qtga.h"
+
+// Directional light shading shared by the offscreen tools (headless,
+// bench), so they render the same way.
+
+typedef struct
+{
+    vec3_t c_diffuse;       // Diffuse color
+    vec3_t c_ambient;       // Ambient color
+    vec3_t c_light;         // Light color
+    vec3_t dir_light;       // Light direction
+    tga_t  *texture;        // Base color, NULL for c_diffuse
+} lit_uniform_t;
+
+typedef struct
+{
+    vec3_t normal;          // Vertex normal
+    vec2_t texcoord;        // Texture coordinates
+} lit_attribute_t;
+
+typedef struct
+{
+    vec3_t normal;
+    vec2_t texcoord;
+} lit_varying_t;
+
+/**
+ * @brief Fetches the faces of device->ranges with normals and texcoords,
+ *      (0, 0) for a mesh without texcoords. material is a lit_uniform_t.
+ */
+void lit_drawer(device_t *device, mesh_t *mesh, void *material);
+
+/**
+ * @brief View space normal, texcoords passed through.
+ */
+void lit_vs(device_t *device, float *unif, float *attr, float *vary);
+
+/**
+ * @brief (light * n.l + ambient) times the texture or diffuse color.
+ */
+void lit_fs(device_t *device, float *unif, float *vary, float w,
+            color3_t *out);
+
+/**
+ * @brief Nearest texel, repeated outside [0, 1).
+ *
+ * @param tex       Texture, rows bottom-up as OBJ texcoords
+ * @param uv        Texture coordinates
+ * @return vec3_t   Color, r g b in x y z
+ */
+vec3_t sample_texture(tga_t *tex, vec2_t uv);
+
+/**
+ * @brief Allocate the uniform, attribute and varying buffers of the lit
+ *      shader and make it the device's drawer, vs and fs.
+ *
+ * @param device Device handle
+ * @return int   0 on success
+ */
+int lit_shader_bind(device_t *device);
+
+/**
+ * @brief Free the buffers of lit_shader_bind.
+ *
+ * @param device Device handle
+ */
+void lit_shader_release(device_t *device);
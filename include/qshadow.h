@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include "qmath.h"
+#include "qmesh.h"
+#include "qpixel.h"
+
+#define SHADOW_BIAS 0.002f          // default constant depth offset
+#define SHADOW_SLOPE_BIAS 1.5f      // default offset per texel of slope
+
+/**
+ * @brief Depth seen from a directional light. Drawing only transforms the
+ *      positions, once per mesh vertex, and rasterizes the triangles
+ *      straight into depth: no drawer, vertex shader, varyings or
+ *      fragments. Both faces are drawn, so open meshes cast too.
+ */
+typedef struct
+{
+    int      size;          // width and height in texels
+    float    *depth;        // [0, 1] from the light, 1 is far, rows bottom up
+    mat4_t   m_light;       // world -> light clip space, orthographic
+    mat4_t   m_texture;     // world -> texels in x, y and depth in z
+    float    bias;          // depth offset of every triangle
+    float    slope_bias;    // and per texel its depth changes at most
+
+    vec4_t   *clip;         // light clip position per mesh vertex
+    uint32_t clip_capacity;
+    uint32_t triangle_count;    // rasterized since shadow_map_clear
+} shadow_map_t;
+
+/**
+ * @brief Allocate a shadow map. The light looks down -z until
+ *      shadow_map_set_light.
+ *
+ * @param sm    Shadow map
+ * @param size  Texels per side
+ * @return int  0 on success
+ */
+int shadow_map_init(shadow_map_t *sm, int size);
+
+/**
+ * @brief Free the buffers of a shadow map.
+ */
+void shadow_map_destroy(shadow_map_t *sm);
+
+/**
+ * @brief Fit the light's orthographic view around a bounding sphere of the
+ *      casters and receivers.
+ *
+ * @param sm        Shadow map
+ * @param dir       Direction the light travels, world space
+ * @param center    Sphere center, world space
+ * @param radius    Sphere radius
+ */
+void shadow_map_set_light(shadow_map_t *sm, vec3_t dir, vec3_t center,
+                          float radius);
+
+/**
+ * @brief Reset every texel to far.
+ */
+void shadow_map_clear(shadow_map_t *sm);
+
+/**
+ * @brief Draw the faces of a mesh into the shadow map.
+ *
+ * @param sm        Shadow map
+ * @param mesh      The mesh
+ * @param m_model   Model -> world
+ */
+void shadow_map_draw(shadow_map_t *sm, mesh_t *mesh, mat4_t *m_model);
+
+/**
+ * @brief Draw every item of a recorded draw list, at the LOD picked for
+ *      the camera.
+ *
+ * @param sm        Shadow map
+ * @param list      Draw list, its matrices are model-view
+ * @param m_camera  World -> view the list was recorded with
+ */
+void shadow_map_draw_list(shadow_map_t *sm, draw_list_t *list,
+                          mat4_t *m_camera);
+
+/**
+ * @brief Matrix from view space to shadow map texels, for vertex shaders
+ *      that get model-view matrices: m_shadow * m_world.
+ *
+ * @param sm        Shadow map
+ * @param m_camera  World -> view
+ * @param out       View -> texels and depth
+ */
+void shadow_map_view_mat(shadow_map_t *sm, mat4_t *m_camera, mat4_t *out);
+
+/**
+ * @brief Percentage-closer filtered lookup: 3x3 texels weighted
+ *      bilinearly over a 4x4 footprint, so the penumbra is smooth. The
+ *      comparisons run 4 texels at a time with SSE.
+ *
+ * @param sm    Shadow map
+ * @param p     Point in m_texture space, texels and depth
+ * @return float  Lit fraction, 0 in shadow to 1, 1 outside the map
+ */
+float shadow_pcf(shadow_map_t *sm, vec3_t p);
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdint.h>
+#include "qmath.h"
+#include "qmesh.h"
+
+#define SKIN_MAX_JOINTS 256         // joint indices are 8 bit
+
+/**
+ * @brief Joint hierarchy in the bind pose. Joints are ordered so that a
+ *      parent comes before its children, poses are evaluated in one pass.
+ */
+typedef struct
+{
+    uint32_t n_joints;
+    int32_t  *parents;      // -1 for roots
+    mat4_t   *inv_bind;     // model -> joint space in the bind pose
+    mat4_t   *global;       // joint -> model of the last pose, scratch
+} skeleton_t;
+
+/**
+ * @brief Keyframes of one joint, in its parent's space. Rotations are
+ *      slerped and translations lerped between the two keys around a time.
+ */
+typedef struct
+{
+    uint32_t n_keys;
+    float    *times;        // seconds, increasing
+    quat_t   *rotations;
+    vec3_t   *translations;
+} joint_track_t;
+
+/**
+ * @brief A looping clip, one track per joint of a skeleton.
+ */
+typedef struct
+{
+    float    duration;      // seconds
+    uint32_t n_tracks;
+    joint_track_t *tracks;
+} animation_t;
+
+/**
+ * @brief Skinned copy of a mesh. It shares the faces, texcoords and
+ *      materials of the bind pose mesh and owns the vertices and normals,
+ *      rewritten by skin_mesh once per frame. Draw it as a regular mesh:
+ *      vertex shaders, shadow maps and culling see the posed geometry.
+ *      Meshlets are dropped as their bounds would go stale, and LOD levels
+ *      of the bind mesh are not skinned.
+ */
+typedef struct
+{
+    mesh_t   mesh;          // posed, draw this one
+    mesh_t   *bind;         // with joints and weights
+    uint32_t *normal_vertex;    // a vertex per normal, lends its influences
+    float    (*skin)[4][4]; // per joint of the last pose, column major
+    uint32_t n_joints;      // of skin
+} skinned_mesh_t;
+
+/**
+ * @brief Attach joint influences to a mesh. Weights are normalized, a
+ *      vertex without any weight follows joint 0.
+ *
+ * @param mesh      The mesh
+ * @param joints    MESH_MAX_INFLUENCES joint indices per vertex
+ * @param weights   Their weights
+ * @return int      0 on success
+ */
+int mesh_set_skin(mesh_t *mesh, const uint8_t (*joints)[MESH_MAX_INFLUENCES],
+                  const float (*weights)[MESH_MAX_INFLUENCES]);
+
+/**
+ * @brief Allocate a skeleton, every joint a root with identity inv_bind.
+ *
+ * @param s         Skeleton
+ * @param n_joints  Up to SKIN_MAX_JOINTS
+ * @return int      0 on success
+ */
+int skeleton_init(skeleton_t *s, uint32_t n_joints);
+
+/**
+ * @brief Free the arrays of a skeleton.
+ */
+void skeleton_destroy(skeleton_t *s);
+
+/**
+ * @brief Local transforms of every joint at a time of the clip, wrapped to
+ *      its duration.
+ *
+ * @param anim          The clip
+ * @param time          Seconds
+ * @param rotations     Per track, output
+ * @param translations  Per track, output
+ */
+void animation_sample(animation_t *anim, float time, quat_t *rotations,
+                      vec3_t *translations);
+
+/**
+ * @brief Pose a skinned mesh: the clip is sampled, joints are concatenated
+ *      down the hierarchy and the skin matrices (global * inv_bind) kept
+ *      for skin_mesh. Joints without a track keep their bind pose. A
+ *      skeleton with more joints than sk was made for, or a clip with more
+ *      tracks than joints, is refused and the last pose stays.
+ *
+ * @param sk    Skinned mesh
+ * @param s     Its skeleton
+ * @param anim  Clip with a track per joint
+ * @param time  Seconds
+ * @return int  0 on success
+ */
+int skeleton_pose(skinned_mesh_t *sk, skeleton_t *s, animation_t *anim,
+                   float time);
+
+/**
+ * @brief Make a drawable copy of a mesh with joint influences. Every
+ *      weighted joint index of the mesh has to be below n_joints.
+ *
+ * @param sk        Skinned mesh
+ * @param bind      Mesh with joints and weights, must outlive sk
+ * @param n_joints  Joints of the skeleton it will be posed with, up to
+ *                  SKIN_MAX_JOINTS
+ * @return int      0 on success, -1 for a joint index out of range
+ */
+int skinned_mesh_init(skinned_mesh_t *sk, mesh_t *bind, uint32_t n_joints);
+
+/**
+ * @brief Free what the skinned mesh owns, not the bind mesh.
+ */
+void skinned_mesh_destroy(skinned_mesh_t *sk);
+
+/**
+ * @brief Linear-blend skinning of every vertex and normal with the skin
+ *      matrices of the last skeleton_pose. Each is blended once, not once
+ *      per triangle corner, 4 floats at a time with SSE. Normals use the
+ *      blended matrix itself, exact for rotations and uniform scales.
+ *      Call where the mesh isn't being drawn, e.g. on the render thread
+ *      before the draw list executes.
+ *
+ * @param sk    Skinned mesh
+ */
+void skin_mesh(skinned_mesh_t *sk);
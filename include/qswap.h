@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+#include "qpixel.h"
+#include "qthread.h"
+
+#define SWAPCHAIN_MAX_BUFFERS 3
+
+/**
+ * @brief Shows or encodes a finished frame, runs on the present thread.
+ * 
+ * @param user User pointer given to swapchain_init
+ * @param index Buffer index
+ * @param color BGRA pixels, valid until the callback returns
+ * @param fence Fence value of the frame, 1 for the first one
+ */
+typedef void (*present_fn_t)(void *user, int index, uint8_t *color,
+                             int width, int height, uint64_t fence);
+
+typedef enum
+{
+    SWAP_FREE = 0,          // can be acquired
+    SWAP_RENDERING,         // acquired, bound to a device
+    SWAP_QUEUED,            // submitted, waits for the present thread
+    SWAP_PRESENTING
+} swap_state_t;
+
+typedef struct
+{
+    uint8_t  *color;        // BGRA, 4 bytes per pixel
+    float    *depth;
+    int      state;         // swap_state_t
+    uint64_t fence;         // fence of the last frame submitted in it
+} swap_buffer_t;
+
+/**
+ * @brief Two or three color / depth buffer sets. Frames are rendered into
+ *      one while a dedicated thread presents the ones before it in order.
+ *      Every submit returns a fence value that is signaled once that frame
+ *      has been presented.
+ */
+typedef struct
+{
+    int           n_buffers;
+    int           width;
+    int           height;
+    swap_buffer_t buffers[SWAPCHAIN_MAX_BUFFERS];
+    int           current;          // acquired buffer, -1 if none
+
+    int           queue[SWAPCHAIN_MAX_BUFFERS];     // submitted, FIFO
+    int           queue_head;
+    int           queue_count;
+    uint64_t      submitted;        // last fence handed out
+    uint64_t      completed;        // last fence signaled
+
+    present_fn_t  present;
+    void          *user;
+    thread_t      thread;
+    mutex_t       lock;
+    cond_t        cond;
+    int           quit;
+} swapchain_t;
+
+/**
+ * @brief Allocate the buffers and start the present thread.
+ * 
+ * @param n_buffers 2 or 3
+ * @param present Called on the present thread for every submitted frame
+ * @return int  0 on success
+ */
+int swapchain_init(swapchain_t *sc, int n_buffers, int width, int height,
+                   present_fn_t present, void *user);
+
+/**
+ * @brief Present what was submitted, stop the thread and free the buffers.
+ */
+void swapchain_destroy(swapchain_t *sc);
+
+/**
+ * @brief Wait for the next buffer in turn to be presented and bind it as
+ *      the color and depth target of device. The device must not own its
+ *      depth, set it up with setup_device_offscreen on buffers[0].
+ * 
+ * @return int  Buffer index
+ */
+int swapchain_acquire(swapchain_t *sc, device_t *device);
+
+/**
+ * @brief Queue the acquired buffer for presenting.
+ * 
+ * @return uint64_t  Fence of the frame
+ */
+uint64_t swapchain_submit(swapchain_t *sc);
+
+/**
+ * @brief 1 if the frame of fence has been presented.
+ */
+int swapchain_fence_signaled(swapchain_t *sc, uint64_t fence);
+
+/**
+ * @brief Block until the frame of fence has been presented.
+ */
+void swapchain_wait_fence(swapchain_t *sc, uint64_t fence);
+
+/**
+ * @brief Block until buffer index is no longer queued or being presented,
+ *      e.g. to read it back.
+ */
+void swapchain_wait_buffer(swapchain_t *sc, int index);
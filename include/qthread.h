@@ -0,0 +1,44 @@
+#pragma once
+
+// Minimal threads, mutexes and condition variables over win32 / pthreads
+
+#ifdef _WIN32
+typedef struct { void *handle; } thread_t;     // HANDLE
+typedef struct { void *ptr; } mutex_t;         // SRWLOCK
+typedef struct { void *ptr; } cond_t;          // CONDITION_VARIABLE
+#else
+#include <pthread.h>
+typedef struct { pthread_t handle; } thread_t;
+typedef struct { pthread_mutex_t m; } mutex_t;
+typedef struct { pthread_cond_t c; } cond_t;
+#endif
+
+typedef void (*thread_fn_t)(void *arg);
+
+/**
+ * @brief Start a thread running fn(arg).
+ * 
+ * @return int  0 on success
+ */
+int thread_create(thread_t *t, thread_fn_t fn, void *arg);
+
+/**
+ * @brief Wait for a thread to return.
+ */
+void thread_join(thread_t *t);
+
+void mutex_init(mutex_t *m);
+void mutex_destroy(mutex_t *m);
+void mutex_lock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+void cond_init(cond_t *c);
+void cond_destroy(cond_t *c);
+
+/**
+ * @brief Release m, sleep until signaled and lock m again. May wake
+ *      spuriously, wait in a loop on the condition.
+ */
+void cond_wait(cond_t *c, mutex_t *m);
+void cond_signal(cond_t *c);
+void cond_broadcast(cond_t *c);
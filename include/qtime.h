@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Monotonic clock, unaffected by wall clock changes.
+ * 
+ * @return uint64_t  Nanoseconds since an arbitrary start
+ */
+uint64_t get_time_ns();
+
+/**
+ * @brief Monotonic clock in milliseconds.
+ * 
+ * @return double  Milliseconds since an arbitrary start
+ */
+double get_time_ms();
+
+/**
+ * @brief Sleep until the monotonic clock reaches t, returns at once if it
+ *      already has.
+ * 
+ * @param t Deadline in nanoseconds of get_time_ns
+ */
+void sleep_until_ns(uint64_t t);
@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "qpixel.h"
+#include "qtga.h"
+#include "qshader.h"
+#include "qtime.h"
+#include "qprofile.h"
+
+// Renders fixed scenes with fixed camera paths and reports frame time
+// percentiles and throughput as JSON.
+// usage: bench [frames] [out.json] [trace.json]
+// With a trace file the stages are timed (which costs some time), their
+// mean is added to the JSON and the last frame of every scene is written
+// as a Chrome trace.
+
+#define CUBE_PATH "./models/cube.obj"
+#define HELMET_PATH "./models/helmet.obj"
+#define HELMET_TEXTURE_PATH "./models/helmet_basecolor.tga"
+
+#define BENCH_FRAMES 200
+#define BENCH_WARMUP 10
+#define N_BENCH_OBJECTS 256
+#define GRID_ROW 5
+#define GRID_COL 5
+
+typedef struct
+{
+    const char *name;
+    scene_t    scene;
+
+    float      distance;    // camera orbits the origin at this distance
+    float      height;      //   and height, one turn over the run
+    float      fov;
+    vec3_t     up;
+} bench_scene_t;
+
+typedef struct
+{
+    double ms_p50;
+    double ms_p95;
+    double ms_p99;
+    double ms_mean;
+    double triangles;       // per frame
+    double fragments;
+    double triangles_per_sec;
+    double fragments_per_sec;
+    double stage_ms[N_PROF_ZONES];  // per frame, with a profiler
+} bench_result_t;
+
+object3d_t object_pool[N_BENCH_OBJECTS + GRID_ROW * GRID_COL + 1];
+object3d_t *object_ptrs[N_BENCH_OBJECTS + GRID_ROW * GRID_COL + 1];
+int n_pool = 0;
+uint32_t seed = 1;
+
+
+// ==================
+// Scenes
+// ==================
+
+// same numbers on every platform, unlike rand()
+float bench_rand(float a, float b)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (float)(seed >> 8) / (1 << 24) * (b - a) + a;
+}
+
+
+object3d_t *new_object(scene_t *scene, mesh_t *mesh, lit_uniform_t *material)
+{
+    object3d_t *obj = &object_pool[n_pool];
+    object_ptrs[n_pool ++] = obj;
+    memset(obj, 0, sizeof(object3d_t));
+    obj->mesh = mesh;
+    obj->material = material;
+    obj->rotation = quat_from_axis_angle((vec3_t){ 1.0f, 0.0f, 0.0f }, 0.0f);
+    obj->scale = (vec3_t){ 1.0f, 1.0f, 1.0f };
+    scene->n_objects ++;
+    return obj;
+}
+
+
+// the 5x5 board of demo0
+void setup_grid(bench_scene_t *b, mesh_t *cube, lit_uniform_t *material)
+{
+    float y = - ((GRID_ROW - 1.0f) / 2.0f);
+    b->scene.objects = &object_ptrs[n_pool];
+    for (int i = 0; i < GRID_ROW; i ++)
+    {
+        float x = - ((GRID_COL - 1.0f) / 2.0f);
+        for (int j = 0; j < GRID_COL; j ++)
+        {
+            object3d_t *obj = new_object(&b->scene, cube, material);
+            obj->position = (vec3_t){ x, y, 0.0f };
+            obj->scale = (vec3_t){ 0.4f, 0.4f, 0.1f };
+            object_update_m_world(obj);
+            x += 1.0f;
+        }
+        y += 1.0f;
+    }
+    b->name = "grid";
+    b->distance = 20.0f * cosf(0.25f * PI);
+    b->height = 20.0f * sinf(0.25f * PI);
+    b->fov = 30.0f;
+    b->up = (vec3_t){ 0.0f, 0.0f, 1.0f };
+}
+
+
+// the random objects of main.c, with cubes and a fixed seed
+void setup_random(bench_scene_t *b, mesh_t *cube, lit_uniform_t *material)
+{
+    b->scene.objects = &object_ptrs[n_pool];
+    seed = 1;
+    for (int i = 0; i < N_BENCH_OBJECTS; i ++)
+    {
+        object3d_t *obj = new_object(&b->scene, cube, material);
+        obj->position = (vec3_t){ bench_rand(-5, 5), bench_rand(-5, 5),
+            bench_rand(-5, 5) };
+        obj->scale = (vec3_t){ bench_rand(0.1f, 0.2f), bench_rand(0.1f, 0.2f),
+            bench_rand(0.1f, 0.2f) };
+        obj->rotation = quat_from_axis_angle(vec3_normalize(
+            (vec3_t){ bench_rand(-1, 1), bench_rand(-1, 1), bench_rand(-1, 1) }
+            ), bench_rand(0, PI));
+        object_update_m_world(obj);
+    }
+    b->name = "random";
+    b->distance = 20.0f;
+    b->height = 0.0f;
+    b->fov = 45.0f;
+    b->up = (vec3_t){ 0.0f, 1.0f, 0.0f };
+}
+
+
+void setup_helmet(bench_scene_t *b, mesh_t *helmet, lit_uniform_t *material)
+{
+    b->scene.objects = &object_ptrs[n_pool];
+    object3d_t *obj = new_object(&b->scene, helmet, material);
+    object_update_m_world(obj);
+    b->name = "helmet";
+    b->distance = 3.0f;
+    b->height = 0.5f;
+    b->fov = 45.0f;
+    b->up = (vec3_t){ 0.0f, 1.0f, 0.0f };
+}
+
+
+// ==================
+// Run
+// ==================
+
+int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+// nearest rank of sorted values
+double percentile(double *sorted, int n, double p)
+{
+    int i = (int)ceil(p / 100.0 * n) - 1;
+    return sorted[i < 0 ? 0 : i];
+}
+
+
+void set_camera(device_t *device, bench_scene_t *b, int frame, int n_frames)
+{
+    float t = 2.0f * PI * frame / n_frames;
+    vec3_t eye;
+    if (b->up.z > 0.5f)
+    {
+        eye = (vec3_t){ cosf(t) * b->distance, sinf(t) * b->distance,
+            b->height };
+    }
+    else
+    {
+        eye = (vec3_t){ sinf(t) * b->distance, b->height,
+            cosf(t) * b->distance };
+    }
+    get_projection_mat(&device->m_project, b->fov,
+        (float)device->width / device->height, 1.0f, 100.0f);
+    get_lookat_mat(&device->m_camera, eye, (vec3_t){ 0.0f, 0.0f, 0.0f },
+        b->up);
+}
+
+
+void run_scene(device_t *device, bench_scene_t *b, int n_frames,
+               bench_result_t *r)
+{
+    double *ms = (double *)malloc(n_frames * sizeof(double));
+    double total = 0.0, triangles = 0.0, fragments = 0.0;
+    profiler_t *prof = device->profiler;
+    uint64_t stage_ns[N_PROF_ZONES] = { 0 };
+
+    for (int i = 0; i < BENCH_WARMUP; i ++)
+    {
+        set_camera(device, b, i, n_frames);
+        clear_buffer(device);
+        draw_scene(device, &b->scene);
+    }
+    if (prof) memcpy(stage_ns, prof->total, sizeof(stage_ns));
+    for (int i = 0; i < n_frames; i ++)
+    {
+        set_camera(device, b, i, n_frames);
+        if (prof) prof->record = i == n_frames - 1;
+        double t0 = get_time_ms();
+        clear_buffer(device);
+        draw_scene(device, &b->scene);
+        ms[i] = get_time_ms() - t0;
+        total += ms[i];
+        triangles += device->triangle_count;
+        fragments += device->texel_count;
+    }
+    if (prof) prof->record = 0;
+
+    qsort(ms, n_frames, sizeof(double), compare_double);
+    r->ms_p50 = percentile(ms, n_frames, 50.0);
+    r->ms_p95 = percentile(ms, n_frames, 95.0);
+    r->ms_p99 = percentile(ms, n_frames, 99.0);
+    r->ms_mean = total / n_frames;
+    r->triangles = triangles / n_frames;
+    r->fragments = fragments / n_frames;
+    r->triangles_per_sec = triangles / (total * 1e-3);
+    r->fragments_per_sec = fragments / (total * 1e-3);
+    for (int i = 0; i < N_PROF_ZONES; i ++)
+    {
+        r->stage_ms[i] = prof
+            ? (prof->total[i] - stage_ns[i]) * 1e-6 / n_frames : 0.0;
+    }
+    free(ms);
+}
+
+
+int main(int argc, char **argv)
+{
+    int n_frames = argc > 1 ? atoi(argv[1]) : BENCH_FRAMES;
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    int width = USER_WIDTH, height = USER_HEIGHT;
+    device_t device;
+    bench_scene_t scenes[3];
+    bench_result_t results[3];
+    lit_uniform_t plain, textured;
+    const char *trace = argc > 3 ? argv[3] : NULL;
+    profiler_t prof;
+
+    if (n_frames <= 0 || out == NULL) return 1;
+
+    mesh_t *cube = load_mesh(CUBE_PATH);
+    mesh_t *helmet = load_mesh(HELMET_PATH);
+    tga_t *texture = read_tga(HELMET_TEXTURE_PATH);
+    if (cube == NULL || helmet == NULL || texture == NULL) return 1;
+    build_meshlets(cube, MESHLET_MAX_FACES);
+    build_meshlets(helmet, MESHLET_MAX_FACES);
+
+    plain.c_diffuse = (vec3_t){ 0.8f, 0.8f, 0.8f };
+    plain.c_ambient = (vec3_t){ 0.4f, 0.4f, 0.4f };
+    plain.c_light = (vec3_t){ 0.8f, 0.8f, 0.8f };
+    plain.dir_light = vec3_normalize((vec3_t){ -1.0f, -1.0f, -1.0f });
+    plain.texture = NULL;
+    textured = plain;
+    textured.texture = texture;
+
+    uint8_t *color = (uint8_t *)malloc((size_t)width * height * 4);
+    memset(&device, 0, sizeof(device_t));
+    setup_device_offscreen(&device, width, height, color, NULL);
+    if (lit_shader_bind(&device) != 0) return 1;
+    memset(&prof, 0, sizeof(profiler_t));
+    if (trace != NULL) device.profiler = &prof;
+
+    memset(scenes, 0, sizeof(scenes));
+    setup_grid(&scenes[0], cube, &plain);
+    setup_random(&scenes[1], cube, &plain);
+    setup_helmet(&scenes[2], helmet, &textured);
+
+    fprintf(out, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n"
+        "  \"scenes\": [\n", width, height, n_frames);
+    for (int i = 0; i < 3; i ++)
+    {
+        bench_result_t *r = &results[i];
+        run_scene(&device, &scenes[i], n_frames, r);
+        fprintf(out, "    {\n      \"name\": \"%s\",\n"
+            "      \"ms_p50\": %.3f,\n      \"ms_p95\": %.3f,\n"
+            "      \"ms_p99\": %.3f,\n      \"ms_mean\": %.3f,\n"
+            "      \"triangles_per_frame\": %.0f,\n"
+            "      \"fragments_per_frame\": %.0f,\n"
+            "      \"triangles_per_sec\": %.0f,\n"
+            "      \"fragments_per_sec\": %.0f",
+            scenes[i].name, r->ms_p50, r->ms_p95, r->ms_p99, r->ms_mean,
+            r->triangles, r->fragments, r->triangles_per_sec,
+            r->fragments_per_sec);
+        if (device.profiler != NULL)
+        {
+            fprintf(out, ",\n      \"stage_ms\": {");
+            for (int j = 0; j < N_PROF_ZONES; j ++)
+            {
+                fprintf(out, "%s\"%s\": %.3f", j ? ", " : " ",
+                    prof_zone_name(j), r->stage_ms[j]);
+            }
+            fprintf(out, " }");
+        }
+        fprintf(out, "\n    }%s\n", i < 2 ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout) fclose(out);
+
+    if (trace != NULL)
+    {
+        profiler_t *profilers[1] = { &prof };
+        if (prof_write_trace(trace, profilers, 1) != 0)
+        {
+            LOG("Write %s failed.\n", trace);
+        }
+        prof_destroy(&prof);
+    }
+
+    destroy_device(&device);
+    lit_shader_release(&device);
+    free(color);
+    return 0;
+}
@@ -7,10 +7,13 @@
 #include <stdio.h>
 #include "common.h"
 #include "qpixel.h"
+#include "qscreen.h"
+#include "qswap.h"
 
 #define N_OBJ_MAX 1024
 #define MAP_ROW 5
 #define MAP_COL 5
+#define SWAP_BUFFERS 2
 
 typedef struct
 {
@@ -28,11 +31,14 @@ typedef struct
     device_t device;
     scene_t  scene;
     mesh_t   *cube;
+    frame_scheduler_t sched;
+
+    HWND     hwnd;
+    swapchain_t swap;       // rendered here, shown by the present thread
+    WCHAR    info[SWAPCHAIN_MAX_BUFFERS][512];  // debug text per buffer
 } demo_t;
 
 demo_t demo;
-clock_t last_tick = 0;
-clock_t should_tick = 0;
 
 
 /**
@@ -57,19 +63,35 @@ void init_scene();
 
 
 /**
- * @brief Set camera, animation, and render
+ * @brief Advance the animation by one fixed step
+ * 
+ */
+void step_demo_scene();
+
+
+/**
+ * @brief Set camera, blend the animation, and render
  * 
+ * @param alpha     Blend of the previous and the current step
  */
-void draw_demo_scene();
+void draw_demo_scene(float alpha);
 
 
 /**
- * @brief The entrance of drawing functionality
+ * @brief The entrance of drawing functionality, renders a frame into the
+ *      swapchain and submits it
  * 
  * @param hwnd      Window handle
  */
 void on_draw(HWND hwnd);
 
+
+/**
+ * @brief Show a finished frame, runs on the present thread
+ */
+void present_frame(void *user, int index, uint8_t *color, int width,
+                   int height, uint64_t fence);
+
 // ==================
 // Setup GDI window & dib, events, etc.
 // ==================
@@ -92,7 +114,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd,
         return 0;
 
     case WM_PAINT:
-        on_draw(hwnd);
+        // the present thread repaints with the next frame
+        ValidateRect(hwnd, NULL);
         return 0;
 
     case WM_MOUSEMOVE:
@@ -179,27 +202,32 @@ int WINAPI wWinMain(HINSTANCE hInstance,
     ShowWindow(hwnd, nCmdShow);
     UpdateWindow(hwnd);
 
-    // Run the message loop. 
-    // SetTimer(hwnd, 1, MIN_RESET, NULL);
+    // Run the message loop, sleeps between frames instead of spinning
+    frame_scheduler_t *sched = &demo.sched;
+    scheduler_init(sched, FRAME_MS, STEP_MS);
 
     MSG msg = { };
     while (1)
     {
-        if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
         {
+            if (msg.message == WM_QUIT)
+            {
+                swapchain_destroy(&demo.swap);
+                return 0;
+            }
             TranslateMessage(&msg);
             DispatchMessage(&msg);
         }
-        else
+
+        scheduler_begin_frame(sched);
+        while (scheduler_step(sched))
         {
-            
-            clock_t current = clock();
-            clock_t diff_tick = current - last_tick;
-            if (diff_tick >= should_tick - 10 * CLOCKS_PER_MS)
-            {
-                InvalidateRect(hwnd, NULL, TRUE);
-            }
+            step_demo_scene();
         }
+        on_draw(hwnd);
+        scheduler_end_frame(sched);
+        screen_wait_frame(sched);
     }
 
     return 0;
@@ -227,6 +255,11 @@ typedef struct
     vec3_t dir_light;       // Light direction
 } uniform_t;
 
+typedef struct
+{
+    float glow;             // Glow intensity, scales c_glow
+} instance_uniform_t;
+
 typedef struct
 {
     vec3_t normal;          // Vertex normal
@@ -246,27 +279,35 @@ void drawer(device_t *device, mesh_t *mesh, void *material)
     material_t *mtl = (material_t *)material;
     uniform_t *uniforms = (uniform_t *)device->unif;
     attribute_t *attributes = (attribute_t *)device->attr;
-    uint32_t n_faces = mesh->n_faces;
-    uint32_t fi = 0;
+
+    int n = 0;
 
     // device->debug[0] = n_faces;
     memcpy(uniforms, mtl, sizeof(uniform_t));
-    for (int i = 0; i < n_faces; i ++)
+    for (uint32_t r = 0; r < device->n_ranges; r ++)
     {
-        uint32_t *vidx = &mesh->vertex_idx[fi];
-        uint32_t *nidx = &mesh->normal_idx[fi];
-        uint32_t *tidx = &mesh->texcoord_idx[fi];
-        for (int j = 0; j < 3; j ++)
+        face_range_t range = device->ranges[r];
+        for (uint32_t fi = range.first * 3;
+             fi < (range.first + range.count) * 3; fi += 3)
         {
-            attributes[j].normal = vec3_normalize(vec3_mat_mul(
-                mesh->normals[nidx[j] - 1], &device->m_world
-            ));
-            attributes[j].texcoord = mesh->texcoords[tidx[j] - 1];
-            v[j] = mesh->vertices[vidx[j] - 1];
+            uint32_t *vidx = &mesh->vertex_idx[fi];
+            uint32_t *nidx = &mesh->normal_idx[fi];
+            uint32_t *tidx = &mesh->texcoord_idx[fi];
+            for (int j = 0; j < 3; j ++)
+            {
+                attribute_t *a = &attributes[n * 3 + j];
+                a->normal = mesh->normals[nidx[j] - 1];
+                a->texcoord = mesh->texcoords[tidx[j] - 1];
+                v[n * 3 + j] = mesh->vertices[vidx[j] - 1];
+            }
+            if (++ n == TRIANGLE_BATCH)
+            {
+                draw_triangles(device, n);
+                n = 0;
+            }
         }
-        draw_triangle(device);
-        fi += 3;
     }
+    if (n > 0) draw_triangles(device, n);
 }
 
 
@@ -275,7 +316,9 @@ void vs(device_t *device, float *unif, float *attr, float *vary)
     attribute_t *attributes = (attribute_t *)attr;
     varying_t *varyings = (varying_t *)vary;
 
-    varyings->normal = attributes->normal;
+    // only corners of visible triangles get here
+    varyings->normal = vec3_normalize(
+        vec3_mat_mul(attributes->normal, &device->m_normal));
     varyings->texcoord = attributes->texcoord;
 }
 
@@ -288,6 +331,7 @@ void fs(device_t *device, float *unif, float *vary, float w, color3_t *out)
     
     uniform_t *uniforms = (uniform_t *)unif;
     varying_t *varyings = (varying_t *)vary;
+    instance_uniform_t *instance = (instance_uniform_t *)device->instance;
     
     vec3_t diffuse = uniforms->c_diffuse;
 
@@ -296,7 +340,7 @@ void fs(device_t *device, float *unif, float *vary, float w, color3_t *out)
     vec3_t color = vec3_mul(uniforms->c_light, intensity);
     color = vec3_add(color, uniforms->c_ambient);
     color = vec3_add(color, diffuse);
-    color = vec3_add(color, uniforms->c_glow);
+    color = vec3_add(color, vec3_mul(uniforms->c_glow, instance->glow));
     color = vec3_clip(color, 0.0f, 1.0f);
     
     memcpy(out, &color, sizeof(float) * 3);
@@ -311,6 +355,7 @@ void init_demo()
 
     // Load cube mesh
     demo.cube = load_mesh("./models/cube.obj");
+    build_meshlets(demo.cube, MESHLET_MAX_FACES);
 
     // Setup scene
     init_scene();
@@ -323,17 +368,19 @@ void init_demo()
     demo.target = (vec3_t){ 0.0f, 0.0f, 0.0f };
     demo.up = (vec3_t){ 0.0f, 0.0f, 1.0f };
 
-    // Setup device buffer -> screen buffer / DIB
-    setup_device(device, screen->width, screen->height, screen->buffer);
-    clear_buffer(device);
+    // Setup device buffer -> swapchain, the present thread copies to the DIB
+    swapchain_init(&demo.swap, SWAP_BUFFERS, screen->width, screen->height,
+        &present_frame, NULL);
+    setup_device_offscreen(device, screen->width, screen->height,
+        demo.swap.buffers[0].color, demo.swap.buffers[0].depth);
     
     // Setup shader
     device->unif_size = sizeof(uniform_t) / sizeof(float);
     device->unif = calloc(1, sizeof(uniform_t));
     device->attr_size = sizeof(attribute_t) / sizeof(float);
-    device->attr = calloc(3, sizeof(attribute_t));
+    device->attr = calloc(3 * TRIANGLE_BATCH, sizeof(attribute_t));
     device->vary_size = sizeof(varying_t) / sizeof(float);
-    device->vary = calloc(3, sizeof(varying_t));
+    device->vary = calloc(3 * TRIANGLE_BATCH, sizeof(varying_t));
 
     device->drawer = &drawer;
     device->vs = &vs;
@@ -346,6 +393,7 @@ int init_dib(HWND hwnd)
     int w = USER_WIDTH;
     int h = USER_HEIGHT;
     screen_t * screen = &demo.screen;
+    demo.hwnd = hwnd;
     screen->width = w;
     screen->height = h;
     screen->pitch = 4;
@@ -370,48 +418,54 @@ int init_dib(HWND hwnd)
 void on_draw(HWND hwnd)
 {
     static float fps_mean = 0.0f;
-    clock_t current = clock();
-    clock_t diff_tick = current - last_tick;
-    should_tick = should_tick + MIN_RESET * CLOCKS_PER_MS - diff_tick;
-    float ms = (float)diff_tick / CLOCKS_PER_MS;
-    last_tick = current;
+    float ms = (float)demo.sched.frame_time_ms;
+    if (ms > 0.0f) fps_mean = 1000.0f / ms;
 
-    fps_mean = 1000.0f / ms;
+    // Render, waits if the buffer is still being shown
+    int index = swapchain_acquire(&demo.swap, &demo.device);
+    draw_demo_scene(scheduler_alpha(&demo.sched));
 
-    InvalidateRect(hwnd, NULL, TRUE);
-    PAINTSTRUCT ps;
-    HDC hdc = BeginPaint(hwnd, &ps);
-    RECT rect;
-
-    // Render
-    draw_demo_scene();
-    BitBlt(hdc, 0, 0, USER_WIDTH, USER_HEIGHT, demo.screen.dc, 0, 0, SRCCOPY);
-    
-    // Draw debug info
-    WCHAR debugInfo[256];
+    // Debug info, drawn with the frame
     device_t *dev = &demo.device;
-    GetClientRect(hwnd, &rect);
-
-
-    swprintf(debugInfo, 256, TEXT("%.2f fps\n%u triangles\n%u texels\n%u objects\n%f %f %f %f\n%f %f %f %f\n%f %f %f %f\n%f %f %f %f\n"),
+    swprintf(demo.info[index], 512, TEXT("%.2f fps\n%u triangles\n%u texels\n%u objects\n%u instances culled\n%u/%u meshlets culled\n%u frustum %u backface %u degenerate %u no sample\n%f %f %f %f\n%f %f %f %f\n%f %f %f %f\n%f %f %f %f\n"),
         fps_mean, demo.device.triangle_count, demo.device.texel_count,
-        demo.device.object_count,
+        demo.device.object_count, dev->instance_culled,
+        demo.device.meshlet_culled, demo.device.meshlet_count,
+        dev->culled_frustum, dev->culled_backface, dev->culled_degenerate,
+        dev->culled_no_sample,
         dev->debug[0], dev->debug[1], dev->debug[2], dev->debug[3],
         dev->debug[4], dev->debug[5], dev->debug[6], dev->debug[7],
         dev->debug[8], dev->debug[9], dev->debug[10], dev->debug[11],
         dev->debug[12], dev->debug[13], dev->debug[14], dev->debug[15]);
-    DrawText(hdc, debugInfo, -1, &rect,
-                DT_LEFT | DT_TOP );
+    swapchain_submit(&demo.swap);
+}
+
 
-    EndPaint(hwnd, &ps);
+void present_frame(void *user, int index, uint8_t *color, int width,
+                   int height, uint64_t fence)
+{
+    HWND hwnd = demo.hwnd;
+    RECT rect;
+
+    // the DIB and its DC are only touched by this thread
+    memcpy(demo.screen.buffer, color, (size_t)width * height * 4);
+    HDC hdc = GetDC(hwnd);
+    BitBlt(hdc, 0, 0, width, height, demo.screen.dc, 0, 0, SRCCOPY);
+    GetClientRect(hwnd, &rect);
+    DrawText(hdc, demo.info[index], -1, &rect, DT_LEFT | DT_TOP);
+    ReleaseDC(hwnd, hdc);
 }
 
 // ===============
 // Scene objects
 // ===============
 object3d_t object_pool[N_OBJ_MAX];
-material_t material_pool[N_OBJ_MAX];
-float      glow_pool[N_OBJ_MAX];
+mat4_t     world_pool[N_OBJ_MAX];
+float      glow_pool[N_OBJ_MAX];    // glow of the current step
+float      glow_prev[N_OBJ_MAX];    // glow of the previous step
+float      glow_draw[N_OBJ_MAX];    // blended for the frame
+material_t cube_material;   // shared, glow comes from glow_draw per cube
+object3d_t board;           // parent of all cubes
 
 void init_scene()
 {
@@ -423,9 +477,23 @@ void init_scene()
     scene->objects = calloc(N_OBJ_MAX, sizeof(object3d_t *));
     memset(scene->objects, 0, sizeof(object3d_t *) * N_OBJ_MAX);
 
-    // init material pool
-    memset(object_pool, 0, sizeof(material_t) * N_OBJ_MAX);
-    memset(material_pool, 0, sizeof(material_t) * N_OBJ_MAX);
+    memset(object_pool, 0, sizeof(object3d_t) * N_OBJ_MAX);
+    memset(glow_pool, 0, sizeof(float) * N_OBJ_MAX);
+    memset(glow_prev, 0, sizeof(float) * N_OBJ_MAX);
+
+    // all cubes share one material
+    material_t *mtl = &cube_material;
+    mtl->c_glow = (vec3_t){ 0.0f, 1.0f, 1.0f };
+    mtl->c_diffuse = (vec3_t){ 0.2f, 0.2f, 0.2f };
+    mtl->c_light = (vec3_t){ 0.2f, 0.2f, 0.2f };
+    mtl->c_ambient = (vec3_t){ 0.1f, 0.1f, 0.1f };
+    mtl->dir_light = vec3_normalize((vec3_t){ -1.0f, -1.0f, -1.0f });
+
+    // transform node only, the cubes are placed relative to it
+    board.rotation = quat_from_axis_angle((vec3_t){ 0.0f, 0.0f, 1.0f }, 0.0f);
+    board.scale = (vec3_t){ 1.0f, 1.0f, 1.0f };
+    object_mark_dirty(&board);
+    scene->objects[scene->n_objects ++] = &board;
 
     int n = 0;
     float y = - ((MAP_ROW - 1.0f) / 2.0f), x;
@@ -434,26 +502,17 @@ void init_scene()
         x = - ((MAP_COL - 1.0f) / 2.0f);
         for (int j = 0; j < MAP_COL; j ++)
         {
+            // transform only, the cubes are drawn instanced
             object3d_t *obj = &object_pool[n];
-            obj->mesh = demo.cube;
-            obj->material = &material_pool[n];
             obj->position = (vec3_t){ x, y, 0.0f };
             obj->rotation = quat_from_axis_angle(
                 (vec3_t){ 1.0f, 0.0f, 0.0f }, 0.0f);
             obj->scale = (vec3_t){ 0.4f, 0.4f, 0.1f };
-            object_update_m_world(obj);
+            scene->objects[scene->n_objects ++] = obj;
+            scene_set_parent(scene, obj, &board);
 
             // memcpy(device->debug, &obj->m_world, 16 * sizeof(float));
 
-            material_t *mtl = &material_pool[n];
-            mtl->c_glow = (vec3_t){ 0.0f, 0.0f, 0.0f };
-            mtl->c_diffuse = (vec3_t){ 0.2f, 0.2f, 0.2f };
-            mtl->c_light = (vec3_t){ 0.2f, 0.2f, 0.2f };
-            mtl->c_ambient = (vec3_t){ 0.1f, 0.1f, 0.1f };
-            mtl->dir_light = vec3_normalize((vec3_t){ -1.0f, -1.0f, -1.0f });
-
-            scene->objects[n] = obj;
-            scene->n_objects ++;
             n ++;
             x += 1.0f;
         }
@@ -462,7 +521,22 @@ void init_scene()
 }
 
 
-void draw_demo_scene()
+void step_demo_scene()
+{
+    // Random Glow
+    int n_cubes = MAP_ROW * MAP_COL;
+    for (int i = 0; i < n_cubes; i ++)
+    {
+        glow_prev[i] = glow_pool[i];
+        glow_pool[i] -= 0.1f;
+        glow_pool[i] = glow_pool[i] > 0 ? glow_pool[i] : 0.0f;
+    }
+    int lit = rand() % n_cubes;
+    glow_pool[lit] = 1.0f;
+}
+
+
+void draw_demo_scene(float alpha)
 {
     device_t *device = &demo.device;
     scene_t *scene = &demo.scene;
@@ -484,21 +558,30 @@ void draw_demo_scene()
     get_lookat_mat(&device->m_camera, demo.eye, demo.target, demo.up);
 
     // memcpy(device->debug, &device->m_camera, 16 * sizeof(float));
-    // Random Glow
-    // srand((unsigned int)time(NULL));
-    for (int i = 0; i < scene->n_objects; i ++)
+    // blend the last two steps, smooth at any frame rate
+    int n_cubes = MAP_ROW * MAP_COL;
+    for (int i = 0; i < n_cubes; i ++)
     {
-        glow_pool[i] -= 0.1f;
-        glow_pool[i] = glow_pool[i] > 0 ? glow_pool[i] : 0.0f;
+        glow_draw[i] = glow_prev[i] + (glow_pool[i] - glow_prev[i]) * alpha;
     }
-    int lit = rand() % scene->n_objects;
-    glow_pool[lit] = 1.0f;
-    for (int i = 0; i < scene->n_objects; i ++)
+    for (int i = 0; i < n_cubes; i ++)
     {
-        material_t *mtl = scene->objects[i]->material;
-        mtl->c_glow = vec3_mul((vec3_t){ 0.0f, 1.0f, 1.0f }, glow_pool[i]);
+        object3d_t *obj = &object_pool[i];
+        float z = 0.2f * glow_draw[i];
+        // glowing cubes pop up, only they are updated
+        if (obj->position.z != z)
+        {
+            obj->position.z = z;
+            object_mark_dirty(obj);
+        }
     }
 
+    scene_update(scene);
+    for (int i = 0; i < n_cubes; i ++)
+    {
+        world_pool[i] = object_pool[i].m_world;
+    }
     clear_buffer(device);
-    draw_scene(device, scene);
+    draw_instanced(device, demo.cube, &cube_material, world_pool, glow_draw,
+        sizeof(instance_uniform_t) / sizeof(float), n_cubes);
 }
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "qpixel.h"
+#include "qimage.h"
+#include "qsched.h"
+#include "qswap.h"
+#include "qpipe.h"
+#include "qshader.h"
+
+// Renders a mesh into memory and writes it as PPM or TGA, no window needed.
+// usage: headless [model.obj] [out.ppm|out.tga] [width] [height] [view]
+//                 [frames] [latency] [samples] [scale]
+// view is a debug_view_t, e.g. 2 for fragments shaded per pixel.
+// samples is 1, or 4 for MSAA.
+// scale below 1 renders smaller and upscales to width x height.
+// frames > 1 spins the model on the demos' frame scheduler with a virtual
+// clock, so every run gives the same frames. An output name with %d gets
+// every frame, otherwise only the last one is written. Frames are encoded
+// on the swapchain's present thread while the next one renders, which in
+// turn overlaps recording of the one after it (latency 1 or 2 frames).
+
+#define DEFAULT_MODEL "./models/helmet.obj"
+#define DEFAULT_OUTPUT "./headless.ppm"
+#define SPIN_PER_STEP 0.05f
+#define SWAP_BUFFERS 2
+
+typedef struct
+{
+    const char *output;     // file name, may hold a %d for the frame
+    int frames;
+    int failed;             // written on the present thread only
+} encoder_t;
+
+
+// true if fn ends with ext
+int has_extension(const char *fn, const char *ext)
+{
+    size_t n = strlen(fn), m = strlen(ext);
+    return n >= m && strcmp(fn + n - m, ext) == 0;
+}
+
+
+void encode_frame(void *user, int index, uint8_t *color, int width,
+                  int height, uint64_t fence)
+{
+    encoder_t *enc = (encoder_t *)user;
+    char fn[512];
+    int f = (int)fence - 1;
+
+    if (strchr(enc->output, '%') == NULL && f != enc->frames - 1) return;
+    snprintf(fn, sizeof(fn), enc->output, f);
+    int ret = has_extension(fn, ".tga")
+        ? write_tga(fn, color, width, height)
+        : write_ppm(fn, color, width, height);
+    if (ret != 0)
+    {
+        LOG("Write %s failed.\n", fn);
+        enc->failed = 1;
+    }
+}
+
+
+// render thread of the pipeline, draws a snapshot into the next buffer
+void render_frame(void *user, device_t *device, frame_snapshot_t *frame)
+{
+    swapchain_t *swap = (swapchain_t *)user;
+
+    swapchain_acquire(swap, device);
+    clear_buffer(device);
+    draw_list_execute(device, &frame->draws);
+    resolve_msaa(device);
+    resolve_debug_view(device);
+    resolve_render_scale(device);
+    LOG("frame %d: %u triangles, %u texels\n", (int)frame->frame - 1,
+        device->triangle_count, device->texel_count);
+    swapchain_submit(swap);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *model = argc > 1 ? argv[1] : DEFAULT_MODEL;
+    const char *output = argc > 2 ? argv[2] : DEFAULT_OUTPUT;
+    int width = argc > 3 ? atoi(argv[3]) : USER_WIDTH;
+    int height = argc > 4 ? atoi(argv[4]) : USER_HEIGHT;
+    int view = argc > 5 ? atoi(argv[5]) : DEBUG_VIEW_NONE;
+    int frames = argc > 6 ? atoi(argv[6]) : 1;
+    int latency = argc > 7 ? atoi(argv[7]) : 1;
+    int samples = argc > 8 ? atoi(argv[8]) : 1;
+    float scale = argc > 9 ? (float)atof(argv[9]) : 1.0f;
+    device_t device;
+    scene_t scene;
+    object3d_t object, *objects[1] = { &object };
+    lit_uniform_t material;
+    frame_scheduler_t sched;
+    swapchain_t swap;
+    frame_pipeline_t pipe;
+    encoder_t enc = { output, frames, 0 };
+    float angle = 0.0f, angle_prev = 0.0f;
+
+    mesh_t *mesh = load_mesh(model);
+    if (mesh == NULL) return 1;
+    build_meshlets(mesh, MESHLET_MAX_FACES);
+
+    // frames live in the swapchain, acquire binds one to the device
+    if (swapchain_init(&swap, SWAP_BUFFERS, width, height, &encode_frame,
+        &enc) != 0)
+    {
+        return 1;
+    }
+    memset(&device, 0, sizeof(device_t));
+    setup_device_offscreen(&device, width, height, swap.buffers[0].color,
+        swap.buffers[0].depth);
+    if (lit_shader_bind(&device) != 0)
+    {
+        swapchain_destroy(&swap);
+        return 1;
+    }
+    if (set_msaa(&device, samples) != 0)
+    {
+        LOG("%d samples per pixel are not supported.\n", samples);
+    }
+    set_render_scale(&device, scale);
+    if (view > DEBUG_VIEW_NONE && view < N_DEBUG_VIEWS)
+    {
+        set_debug_view(&device, view);
+    }
+
+    // white and a raised ambient, the flat gray the tool always had
+    material.c_diffuse = (vec3_t){ 1.0f, 1.0f, 1.0f };
+    material.c_ambient = (vec3_t){ 0.3f, 0.3f, 0.3f };
+    material.c_light = (vec3_t){ 0.5f, 0.5f, 0.5f };
+    material.dir_light = vec3_normalize((vec3_t){ -1.0f, -1.0f, -1.0f });
+    material.texture = NULL;
+
+    memset(&object, 0, sizeof(object3d_t));
+    object.mesh = mesh;
+    object.material = &material;
+    object.rotation = quat_from_axis_angle((vec3_t){ 0.0f, 1.0f, 0.0f }, 0.0f);
+    object.scale = (vec3_t){ 1.0f, 1.0f, 1.0f };
+    object_update_m_world(&object);
+    memset(&scene, 0, sizeof(scene_t));
+    scene.n_objects = 1;
+    scene.objects = objects;
+
+    // the device belongs to the render thread from here
+    if (pipeline_init(&pipe, latency, &device, &render_frame, &swap) != 0)
+    {
+        LOG("Latency must be 1 to %d.\n", PIPELINE_MAX_LATENCY);
+        swapchain_destroy(&swap);
+        return 1;
+    }
+
+    scheduler_init(&sched, FRAME_MS, STEP_MS);
+    sched.virtual_clock = 1;
+    for (int f = 0; f < frames; f ++)
+    {
+        frame_snapshot_t *frame = pipeline_begin_frame(&pipe);
+        scheduler_begin_frame(&sched);
+        while (scheduler_step(&sched))
+        {
+            angle_prev = angle;
+            angle += SPIN_PER_STEP;
+        }
+        float a = angle_prev + (angle - angle_prev) * scheduler_alpha(&sched);
+        object.rotation = quat_from_axis_angle(
+            (vec3_t){ 0.0f, 1.0f, 0.0f }, a);
+        object_update_m_world(&object);
+
+        get_projection_mat(&frame->m_project, 45.0f, (float)width / height,
+            1.0f, 100.0f);
+        get_lookat_mat(&frame->m_camera, (vec3_t){ 0.0f, 0.0f, 3.0f },
+            (vec3_t){ 0.0f, 0.0f, 0.0f }, (vec3_t){ 0.0f, 1.0f, 0.0f });
+        pipeline_record(&pipe, frame, &scene);
+        pipeline_submit(&pipe, frame);
+        scheduler_end_frame(&sched);
+    }
+
+    // waits for the last frames to be rendered and written
+    pipeline_destroy(&pipe);
+    swapchain_destroy(&swap);
+    destroy_device(&device);
+    lit_shader_release(&device);
+    return enc.failed;
+}
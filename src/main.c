@@ -4,13 +4,37 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <time.h>
 #include "common.h"
 #include "qpixel.h"
+#include "qscreen.h"
+#include "qswap.h"
+#include "qpipe.h"
+#include "qshadow.h"
+#include "qpbr.h"
+#include "qskin.h"
+#include "qlight.h"
 
 /* ========= GLOBAL INFO =========== */
-// #define MESH_FILE_NAME "./models/helmet.obj"
-#define MESH_FILE_NAME "./models/cube.obj"
+#define MESH_FILE_NAME "./models/helmet.obj"
+// #define MESH_FILE_NAME "./models/cube.obj"
 #define N_OBJECT_MAX 256
+#define N_LOD_LEVELS 6
+#define SWAP_BUFFERS 2
+#define PIPELINE_LATENCY 1  // frames recorded ahead of the one rendering
+#define FOVEA_INNER 0.3f    // full rate within this share of center to corner
+#define FOVEA_OUTER 0.6f    // 2x2 within this, 4x4 beyond
+#define RENDER_BUDGET_MS (FRAME_MS * 0.8)   // leaves time to present
+#define LIGHT_DIR ((vec3_t){ -1.0f, -1.0f, -1.0f })  // world space
+#define SHADOW_MAP_SIZE 1024
+#define SHADOW_RADIUS 9.0f  // bounds the objects, spread over -5 to 5
+#define N_PBR_MATERIALS 8   // shared by the objects, few state changes
+#define PBR_LIGHT 3.0f      // sun intensity, white
+#define N_JOINTS 4          // chain up the mesh, swaying
+#define SKINNED_EVERY 4     // every 4th object draws the skinned mesh
+#define SWAY_ANGLE 0.35f    // per joint, radians
+#define N_POINT_LIGHTS 256  // orbiting the center among the objects
+#define POINT_LIGHT_RADIUS 1.5f
 
 float sample_vary[9];
 
@@ -23,14 +47,76 @@ int mouseX = 100, mouseY = 100;
 float distance = 20.0f;
 
 mesh_t *mesh;
+mesh_lod_t *lod;
+object3d_t object_pool[N_OBJECT_MAX];
+skeleton_t skeleton;
+animation_t sway;
+skinned_mesh_t skinned;                 // posed on the render thread
+point_light_t point_lights[N_POINT_LIGHTS];
+vec3_t point_light_orbits[N_POINT_LIGHTS];  // radius, height, phase
+light_clusters_t clusters;              // render thread only
+
+frame_scheduler_t sched;
+resolution_controller_t resolution;     // render thread only
+shadow_map_t shadow;                    // render thread only
+mat4_t m_shadow_view;                   // view -> shadow map, this frame
+vec3_t dir_light_view;                  // light direction in view space
+int shadows_on;                         // of the frame being rendered
+mat4_t m_view_world;                    // view -> world rotation, this frame
+int pbr_on;                             // of the frame being rendered
+int gouraud_on;                         // of the frame being rendered
+pbr_env_t env;                          // read only after setup_scene
+pbr_material_t pbr_materials[N_PBR_MATERIALS];
+
+// device belongs to the render thread of pipe, the UI thread records
+// frames and only touches these
+HWND window;
+swapchain_t swap;
+frame_pipeline_t pipe;
+mat4_t m_project;
+int keep_order = 0;
+int debug_view = DEBUG_VIEW_NONE;
+int msaa = 1;
+int shading_rate = 1;
+int foveated = 0;
+int dynamic_resolution = 1;
+int shadows = 1;
+int pbr = 1;
+int animate = 1;
+float anim_time = 0.0f;                 // seconds of animation played
+int point_lights_on = 1;
+int gouraud = 0;
 
-clock_t last_tick = 0;
+typedef struct
+{
+    float ms;               // measured frame interval when recorded
+    int   debug_view;       // heatmap to show
+    int   msaa;             // samples per pixel
+    int   shading_rate;     // pixels per shaded block side
+    int   foveated;         // coarser shading away from the center
+    int   dynamic_resolution;   // render size follows render time
+    int   shadows;          // shadow map pass and lookups
+    int   pbr;              // metallic-roughness with image based light
+    int   gouraud;          // Lambert per vertex, overrides pbr
+    int   animate;          // the pose advances
+    float anim_time;        // pose of the skinned objects
+} frame_info_t;
+
+frame_info_t frame_info[PIPELINE_MAX_LATENCY + 1];  // per snapshot
+WCHAR debug_info[SWAPCHAIN_MAX_BUFFERS][512];       // per swapchain buffer
 
 void setup_render_info(device_t * device);
 
+void fs(device_t *device, float *unif, float *vary, float w, color3_t *out);
+
 void setup_scene(device_t * device);
 
-void render(device_t * device);
+void render(device_t * device, frame_snapshot_t *frame);
+
+void render_frame(void *user, device_t *device, frame_snapshot_t *frame);
+
+void present_frame(void *user, int index, uint8_t *color, int width,
+                   int height, uint64_t fence);
 
 void fill_ramp(int);
 
@@ -108,24 +194,43 @@ int WINAPI wWinMain(HINSTANCE hInstance,
     SelectObject(screen.dc, screen.bmp);
     screen.buffer = (unsigned char*)ptr;
     memset(screen.buffer, 0, w * h * 4);
-    // Set Device
-    setup_device(&device, screen.width, screen.height, screen.buffer);
-    clear_buffer(&device);
+    window = hwnd;
+    // Set Device, renders into the swapchain, presented into the DIB
+    swapchain_init(&swap, SWAP_BUFFERS, screen.width, screen.height,
+        &present_frame, NULL);
+    setup_device_offscreen(&device, screen.width, screen.height,
+        swap.buffers[0].color, swap.buffers[0].depth);
     setup_render_info(&device);
     setup_scene(&device);
+    m_project = device.m_project;
+    resolution_init(&resolution, RENDER_BUDGET_MS, MIN_RENDER_SCALE);
+    pipeline_init(&pipe, PIPELINE_LATENCY, &device, &render_frame, NULL);
 
     ShowWindow(hwnd, nCmdShow);
     UpdateWindow(hwnd);
 
-    // Run the message loop.
-
-    SetTimer(hwnd, 1, MIN_RESET, NULL);
+    // Run the message loop, one frame per scheduler deadline
+    scheduler_init(&sched, FRAME_MS, FRAME_MS);
 
     MSG msg = { };
-    while (GetMessage(&msg, NULL, 0, 0) > 0)
+    while (1)
     {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+        {
+            if (msg.message == WM_QUIT)
+            {
+                pipeline_destroy(&pipe);
+                swapchain_destroy(&swap);
+                return 0;
+            }
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+
+        scheduler_begin_frame(&sched);
+        on_draw(hwnd);
+        scheduler_end_frame(&sched);
+        screen_wait_frame(&sched);
     }
 
     return 0;
@@ -144,12 +249,12 @@ LRESULT CALLBACK WindowProc(HWND hwnd,
             return 0;
         }
     case WM_DESTROY:
-        KillTimer(hwnd, 1);
         PostQuitMessage(0);
         return 0;
 
     case WM_PAINT:
-        on_draw(hwnd);
+        // the present thread repaints with the next frame
+        ValidateRect(hwnd, NULL);
         return 0;
 
     case WM_MOUSEMOVE:
@@ -168,17 +273,50 @@ LRESULT CALLBACK WindowProc(HWND hwnd,
         case VK_DOWN:
             distance *= 1.2f;
             break;
+        case 'S':
+            // compare with submission order
+            keep_order = !keep_order;
+            break;
+        case 'D':
+            // next heatmap, then back to shading
+            debug_view = (debug_view + 1) % N_DEBUG_VIEWS;
+            break;
+        case 'M':
+            // multisampling on / off
+            msaa = msaa == 1 ? MSAA_SAMPLES : 1;
+            break;
+        case 'C':
+            // shade 1x1, 2x2 then 4x4 blocks
+            shading_rate = shading_rate < MAX_SHADING_RATE
+                ? shading_rate * 2 : 1;
+            break;
+        case 'F':
+            foveated = !foveated;
+            break;
+        case 'R':
+            // dynamic resolution on / off
+            dynamic_resolution = !dynamic_resolution;
+            break;
+        case 'L':
+            shadows = !shadows;
+            break;
+        case 'P':
+            pbr = !pbr;
+            break;
+        case 'A':
+            animate = !animate;
+            break;
+        case 'O':
+            point_lights_on = !point_lights_on;
+            break;
+        case 'G':
+            gouraud = !gouraud;
+            break;
         defaut: break;
         }
         distance = distance < 0.5f ? 0.5f : distance;
         return 0;
 
-    case WM_TIMER:
-        // Fix window size & redraw
-        // SetWindowPos(hwnd, NULL, 0, 0, USER_WIDTH, USER_HEIGHT, SWP_NOMOVE);
-        InvalidateRect(hwnd, NULL, TRUE);
-        return 0;
-
     }
     return DefWindowProc(hwnd, uMsg, wParam, lParam);
 }
@@ -206,47 +344,131 @@ void fill_ramp(int t)
 
 void on_draw(HWND hwnd)
 {
-    static int t = 0;
-    PAINTSTRUCT ps;
-    HDC hdc = BeginPaint(hwnd, &ps);
-    RECT rect;
+    // record the next frame while the render thread draws the last one
+    frame_snapshot_t *frame = pipeline_begin_frame(&pipe);
+    frame_info_t *info = &frame_info[frame - pipe.snapshots];
+    info->ms = (float)sched.frame_time_ms;
+    info->debug_view = debug_view;
+    info->msaa = msaa;
+    info->shading_rate = shading_rate;
+    info->foveated = foveated;
+    info->dynamic_resolution = dynamic_resolution;
+    info->shadows = shadows;
+    info->pbr = pbr;
+    info->gouraud = gouraud;
+    if (animate) anim_time += (float)(sched.frame_time_ms / 1000.0);
+    info->animate = animate;
+    info->anim_time = anim_time;
+    for (int i = 0; i < N_POINT_LIGHTS; i ++)
+    {
+        vec3_t o = point_light_orbits[i];
+        float a = o.z + anim_time * 0.5f;
+        point_lights[i].position = (vec3_t){ o.x * cosf(a), o.y, o.x * sinf(a) };
+    }
+    scene.n_lights = point_lights_on ? N_POINT_LIGHTS : 0;
+    frame->user = info;
+    frame->draws.keep_order = keep_order;
+    frame->m_project = m_project;
+    render(&device, frame);
+    pipeline_submit(&pipe, frame);
+}
 
-    // All painting occurs here, between BeginPaint and EndPaint.
+void render_frame(void *user, device_t *device, frame_snapshot_t *frame)
+{
+    frame_info_t *info = (frame_info_t *)frame->user;
+    draw_list_t *draws = &frame->draws;
 
-    // fill_ramp(t);
+    // a view switched on the UI thread takes effect here
+    if (device->debug_view != info->debug_view)
+    {
+        set_debug_view(device, info->debug_view);
+    }
+    if (device->msaa != info->msaa) set_msaa(device, info->msaa);
+    device->shading_rate = info->shading_rate;
+    if ((device->rate_map != NULL) != info->foveated)
+    {
+        if (info->foveated)
+        {
+            set_foveated_rate_map(device, FOVEA_INNER, FOVEA_OUTER);
+        }
+        else
+        {
+            set_shading_rate_map(device, NULL);
+        }
+    }
 
-    render(&device);
+    // fixed is full size, the controller starts over from there
+    if (!info->dynamic_resolution)
+    {
+        resolution_init(&resolution, RENDER_BUDGET_MS, MIN_RENDER_SCALE);
+    }
+    set_render_scale(device, resolution.scale);
 
-    BitBlt(hdc, 0, 0, USER_WIDTH, USER_HEIGHT, screen.dc, 0, 0, SRCCOPY);
-    
-    // Debug info
+    // once for all skinned objects, before any pass reads the mesh
+    skeleton_pose(&skinned, &skeleton, &sway, info->anim_time);
+    skin_mesh(&skinned);
 
-    WCHAR debugInfo[256];
-    // FillRect(hdc, &ps.rcPaint, (HBRUSH) (COLOR_WINDOW+1));
-    GetClientRect(hwnd, &rect);
-    float dpi = GetDpiForSystem();
+    // the light is fixed in the world, shaders light in view space
+    vec3_t dir = vec3_normalize(LIGHT_DIR);
+    mat4_transform_vectors(&frame->m_camera, &dir, &dir_light_view, 1);
+    shadows_on = info->shadows;
+    if (shadows_on)
+    {
+        shadow_map_clear(&shadow);
+        shadow_map_draw_list(&shadow, draws, &frame->m_camera);
+        shadow_map_view_mat(&shadow, &frame->m_camera, &m_shadow_view);
+    }
+    light_clusters_build(&clusters, &frame->m_project, &frame->m_camera,
+        frame->lights, frame->n_lights);
 
-    // calculate tick
-    clock_t current = clock();
-    float ms = (float)(current - last_tick) / CLOCKS_PER_MS;
-    last_tick = current;
-    
-    // swprintf(debugInfo, 256, TEXT("%ld, %ld, %ld, %ld\n%ld, %ld\n%f\n"),
-    //     rect.left, rect.top, rect.right, rect.bottom,
-    //     mouseX, mouseY,
-    //     device.debug);
-    // mat4_t *m = &device.m_world;
-    // float *d = device.debug;
-    // swprintf(debugInfo, 256, TEXT("%f %f %f\n%f"),
-    //     d[0], d[1], d[2], d[3]);
-    swprintf(debugInfo, 256, TEXT("%.2f fps\n%u triangles\n%u texels\n"),
-        1000.0f / ms, device.triangle_count, device.texel_count);
-    
-    DrawText(hdc, debugInfo, -1, &rect,
-                DT_LEFT | DT_TOP );
-    EndPaint(hwnd, &ps);
+    // the environment is in world space, pbr shades there
+    pbr_on = info->pbr && !info->gouraud;
+    gouraud_on = info->gouraud;
+    device->fs = gouraud_on ? &fs_vertex_color : &fs;
+    calc_rigid_inv_mat(&frame->m_camera, &m_view_world);
+
+    int index = swapchain_acquire(&swap, device);
+    double t0 = get_time_ms();
+    clear_buffer(device);
+    draw_list_execute(device, draws);
+    resolve_msaa(device);
+    resolve_debug_view(device);
+    float overdraw = get_overdraw(device);
+    int render_width = device->width, render_height = device->height;
+    resolve_render_scale(device);
+    if (info->dynamic_resolution)
+    {
+        resolution_update(&resolution, get_time_ms() - t0);
+    }
 
-    t++;
+    swprintf(debug_info[index], 512, TEXT("%.2f fps\n%u triangles\n%u texels\n%ls (S)\n%u -> %u state changes\n%.2f overdraw\n%dx MSAA (M)\n%dx%d shading (C)\n%ls (F)\n%dx%d %ls resolution (R)\n%ls shadows (L)\n%ls (P, G)\n%ls (A)\n%u lights, %u per cluster at most (O)\n"),
+        info->ms > 0.0f ? 1000.0f / info->ms : 0.0f,
+        device->triangle_count, device->texel_count,
+        draws->keep_order ? L"unsorted" : L"sorted",
+        draws->state_changes_unsorted, draws->state_changes,
+        overdraw, device->msaa, device->shading_rate,
+        device->shading_rate, info->foveated ? L"foveated" : L"uniform",
+        render_width, render_height,
+        info->dynamic_resolution ? L"dynamic" : L"fixed",
+        info->shadows ? L"with" : L"no",
+        info->gouraud ? L"Gouraud" : (info->pbr ? L"PBR" : L"Lambert"),
+        info->animate ? L"animated" : L"paused",
+        frame->n_lights, clusters.max_per_cluster);
+    swapchain_submit(&swap);
+}
+
+void present_frame(void *user, int index, uint8_t *color, int width,
+                   int height, uint64_t fence)
+{
+    RECT rect;
+
+    // the DIB and its DC are only touched by this thread
+    memcpy(screen.buffer, color, (size_t)width * height * 4);
+    HDC hdc = GetDC(window);
+    BitBlt(hdc, 0, 0, width, height, screen.dc, 0, 0, SRCCOPY);
+    GetClientRect(window, &rect);
+    DrawText(hdc, debug_info[index], -1, &rect, DT_LEFT | DT_TOP);
+    ReleaseDC(window, hdc);
 }
 
 
@@ -260,17 +482,31 @@ typedef struct
     vec3_t dir_light;
     vec3_t c_ambient;
     vec3_t c_light;
+
+    mat4_t m_shadow;        // model -> shadow map texels
+    int    shadows;
+
+    pbr_material_t material;
+    mat4_t m_view_world;    // view -> world, rotation only is used
+    vec3_t to_light;        // world space
+    int    pbr;
+    int    gouraud;         // vs lights, fs_vertex_color passes it on
 } uniform_t;
 
 typedef struct
 {
     vec3_t normal;
+    vec3_t position;
     // vec2_t texcoord;
 } attribute_t;
 
 typedef struct
 {
-    vec3_t normal;
+    vec3_t normal;          // world space with pbr, the lit color with
+                            //   gouraud, else view space
+    vec3_t eye;             // towards the eye, world space, pbr only
+    vec3_t view;            // position in view space, finds the cluster
+    vec3_t shadow;          // shadow map texels and depth
     // vec2_t texcoord;
 } varying_t;
 
@@ -292,37 +528,78 @@ void drawer_build_attribute(mesh_t *mesh, uint32_t fi, uniform_t *unif, attribut
     
     for (int i = 0; i < 3; i++)
     {
-        attr[i].normal = vec3_normalize(
-            vec3_mat_mul(mesh->normals[nidx[i] - 1], &unif->m_world)
-        );
+        attr[i].normal = mesh->normals[nidx[i] - 1];
+        attr[i].position = mesh->vertices[vidx[i] - 1];
         // attr[i].texcoord = mesh->texcoords[tidx[i] - 1];
     }
 }
 
-void drawer(device_t *device, mesh_t *mesh)
+void drawer(device_t *device, mesh_t *mesh, void *material)
 {
     uniform_t *uniforms = (uniform_t *)device->unif;
     attribute_t *attributes = (attribute_t *)device->attr;
     varying_t *varyings = (varying_t *)device->vary;
     vec3_t *v = device->vertex;
-    uint32_t n_faces = mesh->n_faces;
-    uint32_t fi = 0;
 
     uniforms->m_world = device->m_world;
     uniforms->m_project = device->m_project;
     uniforms->m_world_inv = device->m_world_inv;
     uniforms->c_ambient = (vec3_t){ 0.1f, 0.1f, 0.1f };
     uniforms->c_light = (vec3_t){ 0.5f, 0.5f, 0.5f };
-    uniforms->dir_light = vec3_normalize((vec3_t){ -1.0f, -1.0f, -1.0f });
+    uniforms->dir_light = dir_light_view;
+    uniforms->shadows = shadows_on;
+    mat4_mul_to(&m_shadow_view, &device->m_world, &uniforms->m_shadow);
+    uniforms->pbr = pbr_on;
+    uniforms->gouraud = gouraud_on;
+    uniforms->m_view_world = m_view_world;
+    uniforms->to_light = vec3_mul(vec3_normalize(LIGHT_DIR), -1.0f);
+    if (material != NULL)
+    {
+        uniforms->material = *(pbr_material_t *)material;
+    }
+    else
+    {
+        uniforms->material = pbr_materials[0];
+    }
 
-    for (int i = 0; i < n_faces; i ++)
+    int n = 0;
+    for (uint32_t r = 0; r < device->n_ranges; r ++)
     {
-        drawer_build_attribute(mesh, fi, (uniform_t *)device->unif, (attribute_t *)device->attr);
-        v[0] = mesh->vertices[mesh->vertex_idx[fi++] - 1];
-        v[1] = mesh->vertices[mesh->vertex_idx[fi++] - 1];
-        v[2] = mesh->vertices[mesh->vertex_idx[fi++] - 1];
-        draw_triangle(device);
+        face_range_t range = device->ranges[r];
+        uint32_t fi = range.first * 3;
+        for (uint32_t i = 0; i < range.count; i ++)
+        {
+            drawer_build_attribute(mesh, fi, (uniform_t *)device->unif, attributes + n * 3);
+            v[n * 3 + 0] = mesh->vertices[mesh->vertex_idx[fi++] - 1];
+            v[n * 3 + 1] = mesh->vertices[mesh->vertex_idx[fi++] - 1];
+            v[n * 3 + 2] = mesh->vertices[mesh->vertex_idx[fi++] - 1];
+            if (++ n == TRIANGLE_BATCH)
+            {
+                draw_triangles(device, n);
+                n = 0;
+            }
+        }
     }
+    if (n > 0) draw_triangles(device, n);
+}
+
+// the sun with its shadow, the point lights and ambient, all view space
+vec3_t lambert(uniform_t *uniforms, vec3_t normal, vec3_t view,
+               vec3_t shadow_pos)
+{
+    vec3_t diffuse = (vec3_t){ 0.5f, 0.5f, 0.5f };
+
+    float intensity = - vec3_dot(normal, uniforms->dir_light);
+    intensity = clip_float(intensity, 0.0f, 1.0f);
+    if (uniforms->shadows && intensity > 0.0f)
+    {
+        intensity *= shadow_pcf(&shadow, shadow_pos);
+    }
+    vec3_t color = vec3_mul(uniforms->c_light, intensity);
+    color = vec3_add(color, light_clusters_diffuse(&clusters, view, normal));
+    color = vec3_add(color, uniforms->c_ambient);
+    color = vec3_add(color, diffuse);
+    return vec3_clip(color, 0.0f, 1.0f);
 }
 
 void vs(device_t *device, float *unif, float *attr, float *vary)
@@ -335,7 +612,28 @@ void vs(device_t *device, float *unif, float *attr, float *vary)
     attribute_t *attributes = (attribute_t *)attr;
     varying_t *varyings = (varying_t *)vary;
 
-    varyings->normal = attributes->normal;
+    vec4_t e = vec4_mat_mul(get_vec4(attributes->position),
+        &uniforms->m_world);
+    varyings->view = (vec3_t){ e.x, e.y, e.z };
+    varyings->normal = vec3_normalize(
+        vec3_mat_mul(attributes->normal, &device->m_normal));
+    if (uniforms->pbr)
+    {
+        // the eye is the view space origin
+        varyings->normal = vec3_mat_mul(varyings->normal,
+            &uniforms->m_view_world);
+        varyings->eye = vec3_mat_mul((vec3_t){ -e.x, -e.y, -e.z },
+            &uniforms->m_view_world);
+    }
+    vec4_t p = vec4_mat_mul(get_vec4(attributes->position),
+        &uniforms->m_shadow);
+    varyings->shadow = (vec3_t){ p.x, p.y, p.z };
+    if (uniforms->gouraud)
+    {
+        // first in the varyings, where fs_vertex_color reads it
+        varyings->normal = lambert(uniforms, varyings->normal,
+            varyings->view, varyings->shadow);
+    }
     // varyings->texcoord = attributes->texcoord;
 }
 
@@ -361,15 +659,42 @@ void fs(device_t *device, float *unif, float *vary, float w, color3_t *out)
     // {
     //     diffuse = (vec3_t){ 0.5f, 0.5f, 0.5f };
     // }
-    vec3_t diffuse = (vec3_t){ 0.5f, 0.5f, 0.5f };
-
-    float intensity = - vec3_dot(varyings->normal, uniforms->dir_light);
-    intensity = clip_float(intensity, 0.0f, 1.0f);
-    vec3_t color = vec3_mul(uniforms->c_light, intensity);
-    color = vec3_add(color, uniforms->c_ambient);
-    color = vec3_add(color, diffuse);
-    color = vec3_clip(color, 0.0f, 1.0f);
-    
+    if (uniforms->pbr)
+    {
+        vec3_t n = vec3_normalize(varyings->normal);
+        vec3_t v = vec3_normalize(varyings->eye);
+        float lit = PBR_LIGHT;
+        if (uniforms->shadows && vec3_dot(n, uniforms->to_light) > 0.0f)
+        {
+            lit *= shadow_pcf(&shadow, varyings->shadow);
+        }
+        vec3_t color = pbr_shade(&env, &uniforms->material, n, v,
+            uniforms->to_light, (vec3_t){ lit, lit, lit });
+
+        // point lights of the cluster, the eye is where view space starts
+        const uint16_t *idx;
+        uint32_t count = light_clusters_find(&clusters, varyings->view, &idx);
+        mat4_t *m = &uniforms->m_view_world;
+        vec3_t p = vec3_sub((vec3_t){ m->m[0][3], m->m[1][3], m->m[2][3] },
+            varyings->eye);
+        for (uint32_t i = 0; i < count; i ++)
+        {
+            const point_light_t *pl = &clusters.lights[idx[i]];
+            vec3_t l = vec3_sub(pl->position, p);
+            float d2 = vec3_dot(l, l);
+            if (d2 >= pl->radius * pl->radius) continue;
+            color = vec3_add(color, pbr_shade(NULL, &uniforms->material, n, v,
+                vec3_mul(l, rsqrt(d2)),
+                vec3_mul(pl->color, point_light_falloff(d2, pl->radius))));
+        }
+        color = vec3_clip(color, 0.0f, 1.0f);
+        out->r = color.x;
+        out->g = color.y;
+        out->b = color.z;
+        return;
+    }
+    vec3_t color = lambert(uniforms, varyings->normal, varyings->view,
+        varyings->shadow);
     memcpy(out, &color, sizeof(float) * 3);
 }
 
@@ -379,8 +704,8 @@ void setup_render_info(device_t * device)
     device->attr_size = sizeof(attribute_t) / sizeof(float);
     device->vary_size = sizeof(varying_t) / sizeof(float);
     device->unif = (float *)malloc(sizeof(uniform_t));
-    device->attr = (float *)malloc(sizeof(attribute_t) * 3);
-    device->vary = (float *)malloc(sizeof(varying_t) * 3);
+    device->attr = (float *)malloc(sizeof(attribute_t) * 3 * TRIANGLE_BATCH);
+    device->vary = (float *)malloc(sizeof(varying_t) * 3 * TRIANGLE_BATCH);
 
     device->drawer = &drawer;
     device->vs = &vs;
@@ -403,18 +728,130 @@ inline float rfloat(float a, float b)
     return ((float)rand() / RAND_MAX) * (b - a) + a;
 }
 
+/**
+ * @brief Skin a mesh to a chain of joints from its bottom to its top and
+ *      make a clip swaying each joint back and forth.
+ */
+void setup_skin(mesh_t *mesh)
+{
+    float y0 = mesh->vertices[0].y, y1 = y0;
+    for (uint32_t v = 1; v < mesh->n_vertices; v ++)
+    {
+        y0 = fminf(y0, mesh->vertices[v].y);
+        y1 = fmaxf(y1, mesh->vertices[v].y);
+    }
+    float seg = (y1 - y0) / (N_JOINTS - 1);
+
+    // between the two joints around its height
+    uint8_t (*joints)[MESH_MAX_INFLUENCES] =
+        calloc(mesh->n_vertices, sizeof(*joints));
+    float (*weights)[MESH_MAX_INFLUENCES] =
+        calloc(mesh->n_vertices, sizeof(*weights));
+    for (uint32_t v = 0; v < mesh->n_vertices; v ++)
+    {
+        float t = (mesh->vertices[v].y - y0) / seg;
+        int j = (int)t < N_JOINTS - 1 ? (int)t : N_JOINTS - 2;
+        joints[v][0] = j;
+        joints[v][1] = j + 1;
+        weights[v][0] = 1.0f - (t - j);
+        weights[v][1] = t - j;
+    }
+    mesh_set_skin(mesh, (const uint8_t (*)[MESH_MAX_INFLUENCES])joints,
+        (const float (*)[MESH_MAX_INFLUENCES])weights);
+    free(joints);
+    free(weights);
+
+    skeleton_init(&skeleton, N_JOINTS);
+    for (int j = 0; j < N_JOINTS; j ++)
+    {
+        skeleton.parents[j] = j - 1;
+        get_world_mat(&skeleton.inv_bind[j],
+            (vec3_t){ 0.0f, -(y0 + seg * j), 0.0f },
+            (quat_t){ 1.0f, 0.0f, 0.0f, 0.0f }, (vec3_t){ 1.0f, 1.0f, 1.0f });
+    }
+
+    // 0, +a, 0, -a, 0 over 4 seconds, each joint a quarter behind
+    static float times[5] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f };
+    static quat_t rotations[N_JOINTS][5];
+    static vec3_t translations[N_JOINTS][5];
+    static joint_track_t tracks[N_JOINTS];
+    const float sway_keys[5] = { 0.0f, 1.0f, 0.0f, -1.0f, 0.0f };
+    for (int j = 0; j < N_JOINTS; j ++)
+    {
+        for (int k = 0; k < 5; k ++)
+        {
+            float a = j == 0 ? 0.0f : SWAY_ANGLE * sway_keys[(k + j) % 4];
+            rotations[j][k] = quat_from_axis_angle(
+                (vec3_t){ 0.0f, 0.0f, 1.0f }, a);
+            translations[j][k] = (vec3_t){ 0.0f, j == 0 ? y0 : seg, 0.0f };
+        }
+        tracks[j] = (joint_track_t){ 5, times, rotations[j], translations[j] };
+    }
+    sway = (animation_t){ 4.0f, N_JOINTS, tracks };
+    skinned_mesh_init(&skinned, mesh, N_JOINTS);
+}
+
 void setup_scene(device_t * device)
 {
     mesh = load_mesh(MESH_FILE_NAME);
 
-    scene.n_objects = N_OBJECT_MAX;
-    scene.objects = calloc(N_OBJECT_MAX, sizeof(object3d_t));
+    // distant objects draw coarser levels
+    lod = build_mesh_lod(mesh, N_LOD_LEVELS, 0.5f);
+    for (uint32_t i = 0; i < lod->n_levels; i ++)
+    {
+        LOG("LOD %u: %u faces, error %f\n", i, lod->levels[i]->n_faces,
+            lod->errors[i]);
+    }
 
+    setup_skin(mesh);
     srand((unsigned int)time(NULL));
+
+    // lights of random colors circle the center at their own radius
+    light_clusters_init(&clusters, device->width, device->height);
+    for (int i = 0; i < N_POINT_LIGHTS; i ++)
+    {
+        point_light_orbits[i] = (vec3_t){ rfloat(1, 7), rfloat(-5, 5),
+            rfloat(0, 2 * PI) };
+        point_lights[i].radius = POINT_LIGHT_RADIUS;
+        point_lights[i].color = vec3_normalize(
+            (vec3_t){ rfloat(0, 1), rfloat(0, 1), rfloat(0, 1) });
+    }
+    scene.lights = point_lights;
+    scene.n_lights = N_POINT_LIGHTS;
+
+    shadow_map_init(&shadow, SHADOW_MAP_SIZE);
+    shadow_map_set_light(&shadow, LIGHT_DIR, (vec3_t){ 0.0f, 0.0f, 0.0f },
+        SHADOW_RADIUS);
+
+    // the sky comes from where the light does
+    vec3_t sun = vec3_mul(LIGHT_DIR, -1.0f);
+    pbr_env_build(&env, &pbr_sky_radiance, &sun);
+    for (int i = 0; i < N_PBR_MATERIALS; i ++)
+    {
+        // half metals, roughness spread evenly
+        pbr_material_t *m = &pbr_materials[i];
+        m->albedo = (vec3_t){ rfloat(0.2, 1), rfloat(0.2, 1), rfloat(0.2, 1) };
+        m->metallic = (float)(i & 1);
+        m->roughness = (float)(i >> 1) / (N_PBR_MATERIALS / 2 - 1);
+        m->ao = 1.0f;
+    }
+
+    scene.n_objects = N_OBJECT_MAX;
+    scene.objects = calloc(N_OBJECT_MAX, sizeof(object3d_t *));
+
     for (int i = 0; i < N_OBJECT_MAX; i ++)
     {
-        object3d_t * obj = scene.objects + i;
+        object3d_t * obj = &object_pool[i];
+        scene.objects[i] = obj;
         obj->mesh = mesh;
+        obj->lod = lod;
+        if (i % SKINNED_EVERY == 0)
+        {
+            // the posed copy, LOD levels would not move with it
+            obj->mesh = &skinned.mesh;
+            obj->lod = NULL;
+        }
+        obj->material = &pbr_materials[rand() % N_PBR_MATERIALS];
         obj->position = \
             (vec3_t){ rfloat(-5, 5), rfloat(-5, 5), rfloat(-5, 5) };
         obj->scale = \
@@ -429,11 +866,12 @@ void setup_scene(device_t * device)
     ready = 1;
 }
 
-void render(device_t * device)
+void render(device_t * device, frame_snapshot_t *frame)
 {
     float r = distance;
-    float z = (1.5f * mouseX / device->width - 0.75f) * PI;
-    float u = (1.0f * mouseY / device->height - 0.5f) * PI;
+    // the window size: device->width is the render thread's, and scaled
+    float z = (1.5f * mouseX / USER_WIDTH - 0.75f) * PI;
+    float u = (1.0f * mouseY / USER_HEIGHT - 0.5f) * PI;
     float ss = sinf(u);
     float cc = cosf(u);
     float s = sinf(z) * cc * r;
@@ -443,8 +881,6 @@ void render(device_t * device)
     vec3_t eye = (vec3_t){ - s, ss * r, c };
     vec3_t tar = (vec3_t){ 0.0, 0.0, 0.0 };
     eye = vec3_add(eye, tar);
-    get_lookat_mat(&device->m_camera, eye, tar, (vec3_t){0.0f, 1.0f, 0.0f});
-
-    clear_buffer(device);
-    draw_scene(device, &scene);
+    get_lookat_mat(&frame->m_camera, eye, tar, (vec3_t){0.0f, 1.0f, 0.0f});
+    pipeline_record(&pipe, frame, &scene);
 }
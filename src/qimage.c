@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "qimage.h"
+
+int write_ppm(const char *fn, const uint8_t *bgra, int width, int height)
+{
+    FILE *f = fopen(fn, "wb");
+    uint8_t *row;
+    int ret = 0;
+
+    if (f == NULL) return -1;
+    row = (uint8_t *)malloc((size_t)width * 3);
+    if (row == NULL)
+    {
+        fclose(f);
+        return -1;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+
+    // one write per row
+    for (int y = 0; y < height && ret == 0; y ++)
+    {
+        const uint8_t *p = bgra + (size_t)y * width * 4;
+        uint8_t *q = row;
+        for (int x = 0; x < width; x ++)
+        {
+            *(q ++) = p[2];
+            *(q ++) = p[1];
+            *(q ++) = p[0];
+            p += 4;
+        }
+        if (fwrite(row, 3, width, f) != (size_t)width) ret = -1;
+    }
+
+    free(row);
+    if (fclose(f) != 0) ret = -1;
+    return ret;
+}
+
+int write_tga(const char *fn, const uint8_t *bgra, int width, int height)
+{
+    FILE *f = fopen(fn, "wb");
+    uint8_t header[18] = { 0 };
+    size_t n = (size_t)width * height;
+    int ret = 0;
+
+    if (f == NULL) return -1;
+
+    // uncompressed true color, 8 bits alpha, top left origin
+    header[2] = 2;
+    header[12] = width & 0xff;
+    header[13] = (width >> 8) & 0xff;
+    header[14] = height & 0xff;
+    header[15] = (height >> 8) & 0xff;
+    header[16] = 32;
+    header[17] = 0x28;
+
+    if (fwrite(header, 1, sizeof(header), f) != sizeof(header)) ret = -1;
+    if (ret == 0 && fwrite(bgra, 4, n, f) != n) ret = -1;
+    if (fclose(f) != 0) ret = -1;
+    return ret;
+}
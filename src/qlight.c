@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "qlight.h"
+
+int light_clusters_init(light_clusters_t *lc, int width, int height)
+{
+    memset(lc, 0, sizeof(light_clusters_t));
+    lc->tiles_x = (width + CLUSTER_TILE - 1) / CLUSTER_TILE;
+    lc->tiles_y = (height + CLUSTER_TILE - 1) / CLUSTER_TILE;
+    uint32_t n = lc->tiles_x * lc->tiles_y * CLUSTER_SLICES;
+    lc->offsets = calloc(n + 1, sizeof(uint32_t));
+    return lc->offsets != NULL ? 0 : -1;
+}
+
+void light_clusters_destroy(light_clusters_t *lc)
+{
+    free(lc->view_pos);
+    free(lc->offsets);
+    free(lc->indices);
+    memset(lc, 0, sizeof(light_clusters_t));
+}
+
+int cluster_slice(light_clusters_t *lc, float z)
+{
+    if (z <= lc->near) return 0;
+    int s = (int)(logf(z / lc->near) * lc->slice_scale);
+    return s < CLUSTER_SLICES - 1 ? s : CLUSTER_SLICES - 1;
+}
+
+int cluster_tile(float ndc, int tiles)
+{
+    int t = (int)floorf((ndc * 0.5f + 0.5f) * tiles);
+    return t < 0 ? 0 : (t < tiles - 1 ? t : tiles - 1);
+}
+
+// clusters touched by light i: x, y and slice ranges, inclusive.
+// Returns 0 if it reaches none.
+int light_cluster_range(light_clusters_t *lc, uint32_t i, int r[6])
+{
+    vec3_t c = lc->view_pos[i];
+    float radius = lc->lights[i].radius;
+    float z0 = -c.z - radius, z1 = -c.z + radius;
+    if (z1 <= lc->near || z0 >= lc->far) return 0;
+
+    r[4] = cluster_slice(lc, z0);
+    r[5] = cluster_slice(lc, z1);
+    if (z0 <= lc->near)
+    {
+        // around the eye, the rectangle is unbounded
+        r[0] = r[2] = 0;
+        r[1] = lc->tiles_x - 1;
+        r[3] = lc->tiles_y - 1;
+        return 1;
+    }
+
+    // box of the sphere projected: each side is widest at the depth
+    // that pulls it outwards
+    float x0 = c.x - radius, x1 = c.x + radius;
+    float y0 = c.y - radius, y1 = c.y + radius;
+    x0 = lc->p00 * x0 / (x0 < 0.0f ? z0 : z1);
+    x1 = lc->p00 * x1 / (x1 > 0.0f ? z0 : z1);
+    y0 = lc->p11 * y0 / (y0 < 0.0f ? z0 : z1);
+    y1 = lc->p11 * y1 / (y1 > 0.0f ? z0 : z1);
+    if (x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f) return 0;
+
+    r[0] = cluster_tile(x0, lc->tiles_x);
+    r[1] = cluster_tile(x1, lc->tiles_x);
+    r[2] = cluster_tile(y0, lc->tiles_y);
+    r[3] = cluster_tile(y1, lc->tiles_y);
+    return 1;
+}
+
+void light_clusters_build(light_clusters_t *lc, mat4_t *m_project,
+                          mat4_t *m_camera, const point_light_t *lights,
+                          uint32_t n_lights)
+{
+    uint32_t n = lc->tiles_x * lc->tiles_y * CLUSTER_SLICES;
+    int r[6];
+
+    // near and far back from the GL style depth row
+    float a = m_project->m[2][2], b = m_project->m[2][3];
+    lc->near = b / (a - 1.0f);
+    lc->far = b / (a + 1.0f);
+    lc->slice_scale = CLUSTER_SLICES / logf(lc->far / lc->near);
+    lc->p00 = m_project->m[0][0];
+    lc->p11 = m_project->m[1][1];
+
+    n_lights = n_lights < CLUSTER_MAX_LIGHTS ? n_lights : CLUSTER_MAX_LIGHTS;
+    lc->lights = lights;
+    lc->n_lights = 0;
+    lc->n_indices = 0;
+    lc->max_per_cluster = 0;
+    memset(lc->offsets, 0, (n + 1) * sizeof(uint32_t));
+    if (n_lights > lc->light_capacity)
+    {
+        vec3_t *view_pos = realloc(lc->view_pos, n_lights * sizeof(vec3_t));
+        if (view_pos == NULL) return;
+        lc->view_pos = view_pos;
+        lc->light_capacity = n_lights;
+    }
+    for (uint32_t i = 0; i < n_lights; i ++)
+    {
+        vec4_t p = vec4_mat_mul(get_vec4(lights[i].position), m_camera);
+        lc->view_pos[i] = (vec3_t){ p.x, p.y, p.z };
+    }
+    lc->n_lights = n_lights;
+
+    // count per cluster, then offsets, then fill
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < n_lights; i ++)
+    {
+        if (!light_cluster_range(lc, i, r)) continue;
+        for (int s = r[4]; s <= r[5]; s ++)
+        {
+            for (int y = r[2]; y <= r[3]; y ++)
+            {
+                uint32_t c = (s * lc->tiles_y + y) * lc->tiles_x;
+                for (int x = r[0]; x <= r[1]; x ++) lc->offsets[c + x] ++;
+            }
+        }
+        total += (r[1] - r[0] + 1) * (r[3] - r[2] + 1) * (r[5] - r[4] + 1);
+    }
+    if (total > lc->index_capacity)
+    {
+        uint16_t *indices = realloc(lc->indices, total * sizeof(uint16_t));
+        if (indices == NULL)
+        {
+            memset(lc->offsets, 0, (n + 1) * sizeof(uint32_t));
+            return;
+        }
+        lc->indices = indices;
+        lc->index_capacity = total;
+    }
+    uint32_t start = 0;
+    for (uint32_t c = 0; c < n; c ++)
+    {
+        uint32_t count = lc->offsets[c];
+        lc->max_per_cluster = count > lc->max_per_cluster
+            ? count : lc->max_per_cluster;
+        lc->offsets[c] = start;
+        start += count;
+    }
+
+    // offsets[c] walks to the start of c + 1 while filling
+    for (uint32_t i = 0; i < n_lights; i ++)
+    {
+        if (!light_cluster_range(lc, i, r)) continue;
+        for (int s = r[4]; s <= r[5]; s ++)
+        {
+            for (int y = r[2]; y <= r[3]; y ++)
+            {
+                uint32_t c = (s * lc->tiles_y + y) * lc->tiles_x;
+                for (int x = r[0]; x <= r[1]; x ++)
+                {
+                    lc->indices[lc->offsets[c + x] ++] = (uint16_t)i;
+                }
+            }
+        }
+    }
+    for (uint32_t c = n; c > 0; c --) lc->offsets[c] = lc->offsets[c - 1];
+    lc->offsets[0] = 0;
+    lc->n_indices = total;
+}
+
+uint32_t light_clusters_find(light_clusters_t *lc, vec3_t p,
+                             const uint16_t **indices)
+{
+    float z = -p.z;
+    if (z <= 0.0f || lc->n_indices == 0)
+    {
+        *indices = NULL;
+        return 0;
+    }
+    int x = cluster_tile(lc->p00 * p.x / z, lc->tiles_x);
+    int y = cluster_tile(lc->p11 * p.y / z, lc->tiles_y);
+    uint32_t c = (cluster_slice(lc, z) * lc->tiles_y + y) * lc->tiles_x + x;
+    *indices = lc->indices + lc->offsets[c];
+    return lc->offsets[c + 1] - lc->offsets[c];
+}
+
+float point_light_falloff(float d2, float radius)
+{
+    float x = d2 / (radius * radius);
+    float w = 1.0f - x * x;
+    return w > 0.0f ? w * w / (d2 + 1.0f) : 0.0f;
+}
+
+vec3_t light_clusters_diffuse(light_clusters_t *lc, vec3_t p, vec3_t n)
+{
+    const uint16_t *idx;
+    uint32_t count = light_clusters_find(lc, p, &idx);
+    vec3_t sum = { 0.0f, 0.0f, 0.0f };
+    for (uint32_t i = 0; i < count; i ++)
+    {
+        vec3_t l = vec3_sub(lc->view_pos[idx[i]], p);
+        float d2 = vec3_dot(l, l);
+        float n_dot_l = vec3_dot(n, l);
+        float radius = lc->lights[idx[i]].radius;
+        if (n_dot_l <= 0.0f || d2 >= radius * radius) continue;
+        float k = n_dot_l * rsqrt(d2) * point_light_falloff(d2, radius);
+        sum = vec3_add(sum, vec3_mul(lc->lights[idx[i]].color, k));
+    }
+    return sum;
+}
@@ -0,0 +1,625 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "qlod.h"
+
+// Quadric error edge collapse, after Garland & Heckbert. Collapses are done
+// in rounds with a growing error threshold instead of a priority queue.
+
+#define LOD_MAX_ITERATIONS 200
+#define LOD_AGGRESSIVENESS 7.0
+#define LOD_MIN_FACES 4
+
+// symmetric 4x4 matrix, upper triangle
+typedef struct { double m[10]; } quadric_t;
+
+typedef struct
+{
+    uint32_t v[3];      // vertex (0-based)
+    uint32_t face;      // face of the source mesh
+    double   err[4];    // error of 3 edges, and the minimum
+    vec3_t   n;         // normal
+    int      deleted;
+    int      dirty;
+} lod_tri_t;
+
+typedef struct
+{
+    vec3_t    p;
+    quadric_t q;
+    uint32_t  tstart;   // first ref
+    uint32_t  tcount;
+    int       border;
+} lod_vertex_t;
+
+typedef struct
+{
+    uint32_t tid;       // triangle
+    uint32_t tvertex;   // corner of the triangle
+} lod_ref_t;
+
+typedef struct
+{
+    lod_tri_t    *tris;
+    uint32_t     n_tris;
+    lod_vertex_t *verts;
+    uint32_t     n_verts;
+    lod_ref_t    *refs;
+    uint32_t     n_refs;
+    uint32_t     cap_refs;
+
+    int          *deleted0;  // scratch for flipped()
+    int          *deleted1;
+    uint32_t     cap_deleted;
+
+    uint32_t     alive;
+    uint32_t     iteration;
+    double       max_error;
+    double       scale;      // positions are normalized by the bbox size
+    vec3_t       offset;
+} lod_state_t;
+
+quadric_t quadric_from_plane(double a, double b, double c, double d)
+{
+    return (quadric_t){{ a * a, a * b, a * c, a * d,
+                                b * b, b * c, b * d,
+                                       c * c, c * d,
+                                              d * d }};
+}
+
+void quadric_add(quadric_t *q, const quadric_t *r)
+{
+    for (int i = 0; i < 10; i ++) q->m[i] += r->m[i];
+}
+
+double quadric_error(const quadric_t *q, double x, double y, double z)
+{
+    const double *m = q->m;
+    return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+         + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+         + m[7] * z * z + 2 * m[8] * z
+         + m[9];
+}
+
+void push_ref(lod_state_t *s, lod_ref_t ref)
+{
+    if (s->n_refs == s->cap_refs)
+    {
+        s->cap_refs = s->cap_refs * 2 + 64;
+        s->refs = realloc(s->refs, s->cap_refs * sizeof(lod_ref_t));
+    }
+    s->refs[s->n_refs ++] = ref;
+}
+
+// error of collapsing i0, i1 into one vertex, which is written to p
+double collapse_error(lod_state_t *s, uint32_t i0, uint32_t i1, vec3_t *p)
+{
+    quadric_t q = s->verts[i0].q;
+    const double *m = q.m;
+    int border = s->verts[i0].border & s->verts[i1].border;
+    vec3_t p0 = s->verts[i0].p, p1 = s->verts[i1].p;
+    vec3_t mid = vec3_mul(vec3_add(p0, p1), 0.5f);
+    double det, trace;
+
+    quadric_add(&q, &s->verts[i1].q);
+    det = m[0] * (m[4] * m[7] - m[5] * m[5])
+        - m[1] * (m[1] * m[7] - m[5] * m[2])
+        + m[2] * (m[1] * m[5] - m[4] * m[2]);
+    trace = m[0] + m[4] + m[7];
+
+    // nearly flat neighbourhoods are ill-conditioned, the optimum may slide
+    // far away along the surface
+    if (fabs(det) > 1e-6 * trace * trace * trace && !border)
+    {
+        // solve the 3x3 system for the optimal position (Cramer's rule)
+        double b0 = -m[3], b1 = -m[6], b2 = -m[8];
+        double inv = 1.0 / det;
+        double x = (b0 * (m[4] * m[7] - m[5] * m[5])
+                  - m[1] * (b1 * m[7] - m[5] * b2)
+                  + m[2] * (b1 * m[5] - m[4] * b2)) * inv;
+        double y = (m[0] * (b1 * m[7] - m[5] * b2)
+                  - b0 * (m[1] * m[7] - m[5] * m[2])
+                  + m[2] * (m[1] * b2 - b1 * m[2])) * inv;
+        double z = (m[0] * (m[4] * b2 - b1 * m[5])
+                  - m[1] * (m[1] * b2 - b1 * m[2])
+                  + b0 * (m[1] * m[5] - m[4] * m[2])) * inv;
+        vec3_t d = vec3_sub((vec3_t){ (float)x, (float)y, (float)z }, mid);
+        vec3_t e = vec3_sub(p1, p0);
+        if (vec3_dot(d, d) <= vec3_dot(e, e))
+        {
+            *p = (vec3_t){ (float)x, (float)y, (float)z };
+            return quadric_error(&q, x, y, z);
+        }
+    }
+
+    // pick the best of both ends and the middle
+    vec3_t c[3] = { p0, p1, mid };
+    double best = 0.0;
+    for (int i = 0; i < 3; i ++)
+    {
+        double e = quadric_error(&q, c[i].x, c[i].y, c[i].z);
+        if (i == 0 || e < best)
+        {
+            best = e;
+            *p = c[i];
+        }
+    }
+    return best;
+}
+
+void update_tri_error(lod_state_t *s, lod_tri_t *t)
+{
+    vec3_t p;
+    for (int j = 0; j < 3; j ++)
+    {
+        t->err[j] = collapse_error(s, t->v[j], t->v[(j + 1) % 3], &p);
+    }
+    t->err[3] = fmin(t->err[0], fmin(t->err[1], t->err[2]));
+}
+
+// rebuild vertex -> triangle references from the alive triangles
+void update_refs(lod_state_t *s)
+{
+    for (uint32_t i = 0; i < s->n_verts; i ++)
+    {
+        s->verts[i].tstart = 0;
+        s->verts[i].tcount = 0;
+    }
+    for (uint32_t i = 0; i < s->n_tris; i ++)
+    {
+        lod_tri_t *t = &s->tris[i];
+        if (t->deleted) continue;
+        for (int j = 0; j < 3; j ++) s->verts[t->v[j]].tcount ++;
+    }
+    uint32_t tstart = 0;
+    for (uint32_t i = 0; i < s->n_verts; i ++)
+    {
+        s->verts[i].tstart = tstart;
+        tstart += s->verts[i].tcount;
+        s->verts[i].tcount = 0;
+    }
+    s->n_refs = 0;
+    for (uint32_t i = 0; i < tstart; i ++) push_ref(s, (lod_ref_t){ 0, 0 });
+    for (uint32_t i = 0; i < s->n_tris; i ++)
+    {
+        lod_tri_t *t = &s->tris[i];
+        if (t->deleted) continue;
+        for (int j = 0; j < 3; j ++)
+        {
+            lod_vertex_t *v = &s->verts[t->v[j]];
+            s->refs[v->tstart + v->tcount ++] = (lod_ref_t){ i, j };
+        }
+    }
+}
+
+// quadrics, border flags and edge errors of the source mesh
+void init_quadrics(lod_state_t *s)
+{
+    uint32_t *count = calloc(s->n_verts, sizeof(uint32_t));
+    uint32_t *ids = calloc(s->n_verts, sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < s->n_verts; i ++)
+    {
+        lod_vertex_t *v = &s->verts[i];
+        uint32_t n_ids = 0;
+        for (uint32_t k = 0; k < v->tcount; k ++)
+        {
+            lod_tri_t *t = &s->tris[s->refs[v->tstart + k].tid];
+            for (int j = 0; j < 3; j ++)
+            {
+                uint32_t id = t->v[j], m = 0;
+                while (m < n_ids && ids[m] != id) m ++;
+                if (m == n_ids)
+                {
+                    ids[n_ids ++] = id;
+                    count[m] = 1;
+                }
+                else count[m] ++;
+            }
+        }
+        // an edge used by a single triangle is on the border
+        for (uint32_t m = 0; m < n_ids; m ++)
+        {
+            if (count[m] == 1) s->verts[ids[m]].border = 1;
+        }
+    }
+    free(count);
+    free(ids);
+
+    for (uint32_t i = 0; i < s->n_tris; i ++)
+    {
+        lod_tri_t *t = &s->tris[i];
+        vec3_t p0 = s->verts[t->v[0]].p;
+        vec3_t c = vec3_cross(vec3_sub(s->verts[t->v[1]].p, p0),
+                              vec3_sub(s->verts[t->v[2]].p, p0));
+        float len = sqrtf(vec3_dot(c, c));
+        t->n = len > 0.0f ? vec3_div(c, len) : (vec3_t){ 0.0f, 0.0f, 0.0f };
+        quadric_t q = quadric_from_plane(t->n.x, t->n.y, t->n.z,
+            -vec3_dot(t->n, p0));
+        for (int j = 0; j < 3; j ++) quadric_add(&s->verts[t->v[j]].q, &q);
+    }
+    for (uint32_t i = 0; i < s->n_tris; i ++)
+    {
+        update_tri_error(s, &s->tris[i]);
+    }
+}
+
+// checks if moving v0 to p flips one of its triangles
+int flipped(lod_state_t *s, vec3_t p, uint32_t i1, lod_vertex_t *v0,
+            int *deleted)
+{
+    for (uint32_t k = 0; k < v0->tcount; k ++)
+    {
+        lod_ref_t *r = &s->refs[v0->tstart + k];
+        lod_tri_t *t = &s->tris[r->tid];
+        if (t->deleted) continue;
+
+        uint32_t id1 = t->v[(r->tvertex + 1) % 3];
+        uint32_t id2 = t->v[(r->tvertex + 2) % 3];
+        if (id1 == i1 || id2 == i1)
+        {
+            // the triangle shares the edge and is removed by the collapse
+            deleted[k] = 1;
+            continue;
+        }
+        vec3_t d1 = vec3_sub(s->verts[id1].p, p);
+        vec3_t d2 = vec3_sub(s->verts[id2].p, p);
+        float l1 = sqrtf(vec3_dot(d1, d1)), l2 = sqrtf(vec3_dot(d2, d2));
+        if (l1 <= 0.0f || l2 <= 0.0f) return 1;
+        d1 = vec3_div(d1, l1);
+        d2 = vec3_div(d2, l2);
+        if (fabsf(vec3_dot(d1, d2)) > 0.999f) return 1;
+        vec3_t n = vec3_normalize(vec3_cross(d1, d2));
+        deleted[k] = 0;
+        if (vec3_dot(n, t->n) < 0.2f) return 1;
+    }
+    return 0;
+}
+
+// moves the triangles of v to i0, removes the collapsed ones
+void update_triangles(lod_state_t *s, uint32_t i0, lod_vertex_t *v,
+                      int *deleted)
+{
+    uint32_t tstart = v->tstart, tcount = v->tcount;
+    for (uint32_t k = 0; k < tcount; k ++)
+    {
+        lod_ref_t r = s->refs[tstart + k];
+        lod_tri_t *t = &s->tris[r.tid];
+        if (t->deleted) continue;
+        if (deleted[k])
+        {
+            t->deleted = 1;
+            s->alive --;
+            continue;
+        }
+        t->v[r.tvertex] = i0;
+        t->dirty = 1;
+        update_tri_error(s, t);
+        push_ref(s, r);
+    }
+}
+
+void reserve_deleted(lod_state_t *s, uint32_t n)
+{
+    if (n <= s->cap_deleted) return;
+    s->cap_deleted = n * 2;
+    s->deleted0 = realloc(s->deleted0, s->cap_deleted * sizeof(int));
+    s->deleted1 = realloc(s->deleted1, s->cap_deleted * sizeof(int));
+}
+
+// runs collapse rounds until target triangles are alive
+void simplify_to(lod_state_t *s, uint32_t target)
+{
+    for (; s->alive > target && s->iteration < LOD_MAX_ITERATIONS;
+         s->iteration ++)
+    {
+        // references grow on every collapse, compact them once in a while
+        if (s->iteration % 5 == 0) update_refs(s);
+        for (uint32_t i = 0; i < s->n_tris; i ++) s->tris[i].dirty = 0;
+
+        double threshold = 1e-9 * pow(s->iteration + 3.0, LOD_AGGRESSIVENESS);
+        for (uint32_t i = 0; i < s->n_tris && s->alive > target; i ++)
+        {
+            lod_tri_t *t = &s->tris[i];
+            if (t->deleted || t->dirty || t->err[3] > threshold) continue;
+
+            for (int j = 0; j < 3; j ++)
+            {
+                if (t->err[j] > threshold) continue;
+                uint32_t i0 = t->v[j], i1 = t->v[(j + 1) % 3];
+                lod_vertex_t *v0 = &s->verts[i0], *v1 = &s->verts[i1];
+                if (v0->border != v1->border) continue;
+
+                vec3_t p;
+                double err = collapse_error(s, i0, i1, &p);
+                reserve_deleted(s, v0->tcount > v1->tcount ?
+                    v0->tcount : v1->tcount);
+                if (flipped(s, p, i1, v0, s->deleted0)) continue;
+                if (flipped(s, p, i0, v1, s->deleted1)) continue;
+
+                v0->p = p;
+                quadric_add(&v0->q, &v1->q);
+                uint32_t tstart = s->n_refs;
+                update_triangles(s, i0, v0, s->deleted0);
+                update_triangles(s, i0, v1, s->deleted1);
+                uint32_t tcount = s->n_refs - tstart;
+                if (tcount <= v0->tcount)
+                {
+                    // reuse the slot of v0
+                    memmove(&s->refs[v0->tstart], &s->refs[tstart],
+                        tcount * sizeof(lod_ref_t));
+                }
+                else
+                {
+                    v0->tstart = tstart;
+                }
+                v0->tcount = tcount;
+                v1->tcount = 0;
+                s->max_error = fmax(s->max_error, err);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Maps every vertex to the first vertex at the same position. OBJ
+ *      duplicates positions along uv / normal seams, which would otherwise
+ *      be treated as borders and crack open.
+ */
+uint32_t *weld_vertices(mesh_t *mesh)
+{
+    uint32_t n = mesh->n_vertices, cap = 1;
+    uint32_t *remap = malloc(n * sizeof(uint32_t));
+    uint32_t *table;
+
+    while (cap < n * 2) cap <<= 1;
+    table = malloc(cap * sizeof(uint32_t));
+    memset(table, 0xff, cap * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i ++)
+    {
+        uint32_t key[3], h;
+        memcpy(key, &mesh->vertices[i], sizeof(key));
+        h = (key[0] * 73856093u) ^ (key[1] * 19349663u) ^ (key[2] * 83492791u);
+        for (h &= cap - 1; table[h] != UINT32_MAX; h = (h + 1) & (cap - 1))
+        {
+            if (memcmp(&mesh->vertices[table[h]], key, sizeof(key)) == 0) break;
+        }
+        if (table[h] == UINT32_MAX) table[h] = i;
+        remap[i] = table[h];
+    }
+    free(table);
+    return remap;
+}
+
+void init_lod_state(lod_state_t *s, mesh_t *mesh)
+{
+    uint32_t *remap = weld_vertices(mesh);
+    vec3_t mi = mesh->vertices[0], mx = mesh->vertices[0];
+    memset(s, 0, sizeof(lod_state_t));
+
+    for (uint32_t i = 1; i < mesh->n_vertices; i ++)
+    {
+        vec3_t v = mesh->vertices[i];
+        mi = (vec3_t){ fminf(mi.x, v.x), fminf(mi.y, v.y), fminf(mi.z, v.z) };
+        mx = (vec3_t){ fmaxf(mx.x, v.x), fmaxf(mx.y, v.y), fmaxf(mx.z, v.z) };
+    }
+    vec3_t d = vec3_sub(mx, mi);
+    s->scale = sqrt(vec3_dot(d, d));
+    if (s->scale <= 0.0) s->scale = 1.0;
+    s->offset = mi;
+
+    s->n_verts = mesh->n_vertices;
+    s->verts = calloc(s->n_verts, sizeof(lod_vertex_t));
+    for (uint32_t i = 0; i < s->n_verts; i ++)
+    {
+        s->verts[i].p = vec3_div(vec3_sub(mesh->vertices[i], mi),
+            (float)s->scale);
+    }
+
+    s->n_tris = mesh->n_faces;
+    s->tris = calloc(s->n_tris, sizeof(lod_tri_t));
+    for (uint32_t i = 0; i < s->n_tris; i ++)
+    {
+        lod_tri_t *t = &s->tris[i];
+        t->face = i;
+        for (int j = 0; j < 3; j ++)
+        {
+            t->v[j] = remap[mesh->vertex_idx[i * 3 + j] - 1];
+        }
+        if (t->v[0] == t->v[1] || t->v[1] == t->v[2] || t->v[2] == t->v[0])
+        {
+            t->deleted = 1;
+            continue;
+        }
+        s->alive ++;
+    }
+    free(remap);
+    update_refs(s);
+    init_quadrics(s);
+}
+
+void free_lod_state(lod_state_t *s)
+{
+    free(s->tris);
+    free(s->verts);
+    free(s->refs);
+    free(s->deleted0);
+    free(s->deleted1);
+}
+
+// counts alive triangles whose source face is in [first, first + n)
+uint32_t count_alive(lod_state_t *s, uint32_t first, uint32_t n)
+{
+    uint32_t count = 0;
+    for (uint32_t i = first; i < first + n; i ++)
+    {
+        count += !s->tris[i].deleted;
+    }
+    return count;
+}
+
+// maps a 1-based index to the next compact one on first use
+uint32_t compact_index(uint32_t *remap, uint32_t *n, uint32_t idx)
+{
+    if (remap[idx - 1] == 0) remap[idx - 1] = ++ (*n);
+    return remap[idx - 1];
+}
+
+/**
+ * @brief Builds a mesh from the alive triangles, keeping face order. Only
+ *      the vertices, normals and texcoords still referenced are copied.
+ */
+mesh_t *emit_lod_mesh(lod_state_t *s, mesh_t *src)
+{
+    mesh_t *mesh = calloc(1, sizeof(mesh_t));
+    uint32_t *vremap = calloc(s->n_verts, sizeof(uint32_t));
+    uint32_t *nremap = calloc(src->n_normals, sizeof(uint32_t));
+    uint32_t *tremap = calloc(src->n_texcoords, sizeof(uint32_t));
+    uint32_t fi = 0;
+
+    mesh->mesh_type = src->mesh_type;
+    mesh->n_faces = s->alive;
+    mesh->vertex_idx = malloc(s->alive * 3 * sizeof(uint32_t));
+    mesh->texcoord_idx = malloc(s->alive * 3 * sizeof(uint32_t));
+    mesh->normal_idx = malloc(s->alive * 3 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < s->n_tris; i ++)
+    {
+        lod_tri_t *t = &s->tris[i];
+        if (t->deleted) continue;
+        for (int j = 0; j < 3; j ++)
+        {
+            mesh->vertex_idx[fi * 3 + j] = compact_index(vremap,
+                &mesh->n_vertices, t->v[j] + 1);
+            mesh->texcoord_idx[fi * 3 + j] = compact_index(tremap,
+                &mesh->n_texcoords, src->texcoord_idx[t->face * 3 + j]);
+            mesh->normal_idx[fi * 3 + j] = compact_index(nremap,
+                &mesh->n_normals, src->normal_idx[t->face * 3 + j]);
+        }
+        fi ++;
+    }
+
+    mesh->vertices = malloc(mesh->n_vertices * sizeof(vec3_t));
+    for (uint32_t i = 0; i < s->n_verts; i ++)
+    {
+        if (vremap[i] == 0) continue;
+        mesh->vertices[vremap[i] - 1] = vec3_add(
+            vec3_mul(s->verts[i].p, (float)s->scale), s->offset);
+    }
+    mesh->normals = malloc(mesh->n_normals * sizeof(vec3_t));
+    for (uint32_t i = 0; i < src->n_normals; i ++)
+    {
+        if (nremap[i] > 0) mesh->normals[nremap[i] - 1] = src->normals[i];
+    }
+    mesh->texcoords = malloc(mesh->n_texcoords * sizeof(vec2_t));
+    for (uint32_t i = 0; i < src->n_texcoords; i ++)
+    {
+        if (tremap[i] > 0) mesh->texcoords[tremap[i] - 1] = src->texcoords[i];
+    }
+    free(vremap);
+    free(nremap);
+    free(tremap);
+
+    // faces keep their order, so ranges shrink in place
+    mesh->n_materials = src->n_materials;
+    mesh->material_names = malloc(src->n_materials * MESH_NAME_LEN);
+    memcpy(mesh->material_names, src->material_names,
+        src->n_materials * MESH_NAME_LEN);
+
+    fi = 0;
+    mesh->n_submeshes = src->n_submeshes;
+    mesh->submeshes = malloc(src->n_submeshes * sizeof(submesh_t));
+    for (uint32_t i = 0; i < src->n_submeshes; i ++)
+    {
+        submesh_t sm = src->submeshes[i];
+        sm.n_faces = count_alive(s, sm.first_face, sm.n_faces);
+        sm.first_face = fi;
+        fi += sm.n_faces;
+        mesh->submeshes[i] = sm;
+    }
+
+    fi = 0;
+    mesh->n_batches = src->n_batches;
+    mesh->batches = malloc(src->n_batches * sizeof(draw_range_t));
+    for (uint32_t i = 0; i < src->n_batches; i ++)
+    {
+        draw_range_t b = src->batches[i];
+        b.n_faces = count_alive(s, b.first_face, b.n_faces);
+        b.first_face = fi;
+        fi += b.n_faces;
+        mesh->batches[i] = b;
+    }
+    return mesh;
+}
+
+mesh_t *simplify_mesh(mesh_t *mesh, uint32_t target_faces, float *error)
+{
+    lod_state_t s;
+    mesh_t *res;
+    if (mesh->n_vertices == 0) return NULL;
+
+    init_lod_state(&s, mesh);
+    simplify_to(&s, target_faces);
+    res = emit_lod_mesh(&s, mesh);
+    if (error) *error = (float)(sqrt(s.max_error) * s.scale);
+    free_lod_state(&s);
+    return res;
+}
+
+mesh_lod_t *build_mesh_lod(mesh_t *mesh, uint32_t n_levels, float ratio)
+{
+    mesh_lod_t *lod = calloc(1, sizeof(mesh_lod_t));
+    lod_state_t s;
+
+    lod->levels[0] = mesh;
+    lod->errors[0] = 0.0f;
+    lod->center = mesh_center(mesh);
+    lod->n_levels = 1;
+    if (n_levels > MESH_LOD_MAX) n_levels = MESH_LOD_MAX;
+    if (mesh->n_vertices == 0) return lod;
+
+    // one collapse sequence, a level is emitted at each target
+    init_lod_state(&s, mesh);
+    uint32_t target = mesh->n_faces;
+    while (lod->n_levels < n_levels)
+    {
+        uint32_t alive = s.alive;
+        target = (uint32_t)(target * ratio);
+        if (target < LOD_MIN_FACES) break;
+        simplify_to(&s, target);
+        if (s.alive >= alive) break;    // can't go any further
+
+        lod->levels[lod->n_levels] = emit_lod_mesh(&s, mesh);
+        if (mesh->n_meshlets > 0)
+        {
+            build_meshlets(lod->levels[lod->n_levels], MESHLET_MAX_FACES);
+        }
+        lod->errors[lod->n_levels] = (float)(sqrt(s.max_error) * s.scale);
+        lod->n_levels ++;
+        if (s.alive > target) break;
+    }
+    free_lod_state(&s);
+    return lod;
+}
+
+void destroy_mesh_lod(mesh_lod_t *lod)
+{
+    for (uint32_t i = 1; i < lod->n_levels; i ++)
+    {
+        destroy_mesh(lod->levels[i]);
+        free(lod->levels[i]);
+    }
+    free(lod);
+}
+
+uint32_t select_mesh_lod(mesh_lod_t *lod, float pixels_per_unit,
+                         float error_budget)
+{
+    uint32_t level = 0;
+    for (uint32_t i = 1; i < lod->n_levels; i ++)
+    {
+        if (lod->errors[i] * pixels_per_unit > error_budget) break;
+        level = i;
+    }
+    return level;
+}
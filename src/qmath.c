@@ -2,6 +2,19 @@
 #include <string.h>
 #include "qmath.h"
 
+// SIMD kernels. AVX is used on top of SSE when compiled with -mavx.
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define QMATH_SSE
+#include <xmmintrin.h>
+#if defined(__AVX__)
+#define QMATH_AVX
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define QMATH_NEON
+#include <arm_neon.h>
+#endif
+
 void get_identity_mat(mat4_t * m)
 {
     memset(m->m, 0, sizeof(int) * 16);
@@ -40,23 +53,17 @@ void get_lookat_mat(mat4_t * m, vec3_t eye, vec3_t center, vec3_t up)
 void get_world_mat(mat4_t * m, vec3_t translation, quat_t rotation,
     vec3_t scale)
 {
-    mat4_t s;
-    // translation
-    get_identity_mat(m);
+    // t * r * s: columns of r scaled, translation in the last column
+    mat4_from_quat(m, rotation);
+    for (int i = 0; i < 3; i ++)
+    {
+        m->m[i][0] *= scale.x;
+        m->m[i][1] *= scale.y;
+        m->m[i][2] *= scale.z;
+    }
     m->m[0][3] = translation.x;
     m->m[1][3] = translation.y;
     m->m[2][3] = translation.z;
-
-    // translation * rotation
-    mat4_from_quat(&s, rotation);
-    mat4_mul(m, &s);
-
-    // t * r * s
-    get_identity_mat(&s);
-    s.m[0][0] = scale.x;
-    s.m[1][1] = scale.y;
-    s.m[2][2] = scale.z;
-    mat4_mul(m, &s);
 }
 
 // Returns Determinant of MINOR
@@ -102,21 +109,181 @@ float calc_adjugate_mat(mat4_t * m, mat4_t * out)
     return det;
 }
 
-void mat4_mul(mat4_t * a, mat4_t * b)
+// row i of a * b is the sum of the rows of b weighted by row i of a, so out
+//   can be written row by row once b is loaded
+void mat4_mul_to(mat4_t * a, mat4_t * b, mat4_t * out)
 {
-    mat4_t res;
+#if defined(QMATH_AVX)
+    // two rows per iteration, one in each 128 bit lane
+    __m256 b0 = _mm256_broadcast_ps((const __m128 *)b->m[0]);
+    __m256 b1 = _mm256_broadcast_ps((const __m128 *)b->m[1]);
+    __m256 b2 = _mm256_broadcast_ps((const __m128 *)b->m[2]);
+    __m256 b3 = _mm256_broadcast_ps((const __m128 *)b->m[3]);
+    for (int i = 0; i < 4; i += 2)
+    {
+        float *r = a->m[i], *q = a->m[i + 1];
+        __m256 s = _mm256_mul_ps(b0, _mm256_setr_ps(
+            r[0], r[0], r[0], r[0], q[0], q[0], q[0], q[0]));
+        s = _mm256_add_ps(s, _mm256_mul_ps(b1, _mm256_setr_ps(
+            r[1], r[1], r[1], r[1], q[1], q[1], q[1], q[1])));
+        s = _mm256_add_ps(s, _mm256_mul_ps(b2, _mm256_setr_ps(
+            r[2], r[2], r[2], r[2], q[2], q[2], q[2], q[2])));
+        s = _mm256_add_ps(s, _mm256_mul_ps(b3, _mm256_setr_ps(
+            r[3], r[3], r[3], r[3], q[3], q[3], q[3], q[3])));
+        _mm256_storeu_ps(out->m[i], s);
+    }
+#elif defined(QMATH_SSE)
+    __m128 b0 = _mm_loadu_ps(b->m[0]);
+    __m128 b1 = _mm_loadu_ps(b->m[1]);
+    __m128 b2 = _mm_loadu_ps(b->m[2]);
+    __m128 b3 = _mm_loadu_ps(b->m[3]);
+    for (int i = 0; i < 4; i ++)
+    {
+        float *r = a->m[i];
+        __m128 s = _mm_mul_ps(_mm_set1_ps(r[0]), b0);
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(r[1]), b1));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(r[2]), b2));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(r[3]), b3));
+        _mm_storeu_ps(out->m[i], s);
+    }
+#elif defined(QMATH_NEON)
+    float32x4_t b0 = vld1q_f32(b->m[0]);
+    float32x4_t b1 = vld1q_f32(b->m[1]);
+    float32x4_t b2 = vld1q_f32(b->m[2]);
+    float32x4_t b3 = vld1q_f32(b->m[3]);
+    for (int i = 0; i < 4; i ++)
+    {
+        float *r = a->m[i];
+        float32x4_t s = vmulq_n_f32(b0, r[0]);
+        s = vmlaq_n_f32(s, b1, r[1]);
+        s = vmlaq_n_f32(s, b2, r[2]);
+        s = vmlaq_n_f32(s, b3, r[3]);
+        vst1q_f32(out->m[i], s);
+    }
+#else
+    mat4_t copy;
+    if (out == b)
+    {
+        copy = *b;
+        b = &copy;
+    }
     for (int i = 0; i < 4; i ++)
     {
+        float r0 = a->m[i][0], r1 = a->m[i][1], r2 = a->m[i][2], r3 = a->m[i][3];
         for (int j = 0; j < 4; j ++)
         {
-            res.m[i][j] = 0;
-            for (int k = 0; k < 4; k ++)
-            {
-                res.m[i][j] += a->m[i][k] * b->m[k][j];
-            }
+            out->m[i][j] = r0 * b->m[0][j] + r1 * b->m[1][j]
+                         + r2 * b->m[2][j] + r3 * b->m[3][j];
+        }
+    }
+#endif
+}
+
+void mat4_mul(mat4_t * a, mat4_t * b)
+{
+    mat4_mul_to(a, b, a);
+}
+
+#if defined(QMATH_SSE)
+// 4 products, one per lane: the matrices are transposed so that a register
+//   holds the same element of each, and the 64 multiply-adds of a product
+//   run for all of them at once
+void mat4_mul_x4(mat4_t ** a, mat4_t ** b, mat4_t ** out)
+{
+    __m128 as[4][4], bs[4][4];
+    for (int r = 0; r < 4; r ++)
+    {
+        for (int k = 0; k < 4; k ++)
+        {
+            as[r][k] = _mm_loadu_ps(a[k]->m[r]);
+            bs[r][k] = _mm_loadu_ps(b[k]->m[r]);
+        }
+        _MM_TRANSPOSE4_PS(as[r][0], as[r][1], as[r][2], as[r][3]);
+        _MM_TRANSPOSE4_PS(bs[r][0], bs[r][1], bs[r][2], bs[r][3]);
+    }
+    // every input is loaded, out[i] may be a[i] or b[i]
+    for (int r = 0; r < 4; r ++)
+    {
+        __m128 o[4];
+        for (int c = 0; c < 4; c ++)
+        {
+            __m128 s = _mm_mul_ps(as[r][0], bs[0][c]);
+            s = _mm_add_ps(s, _mm_mul_ps(as[r][1], bs[1][c]));
+            s = _mm_add_ps(s, _mm_mul_ps(as[r][2], bs[2][c]));
+            s = _mm_add_ps(s, _mm_mul_ps(as[r][3], bs[3][c]));
+            o[c] = s;
+        }
+        _MM_TRANSPOSE4_PS(o[0], o[1], o[2], o[3]);
+        for (int k = 0; k < 4; k ++) _mm_storeu_ps(out[k]->m[r], o[k]);
+    }
+}
+#endif
+
+#if defined(QMATH_AVX)
+// transpose of the 4x4 block in each 128 bit lane
+void transpose4_lanes(__m256 *r)
+{
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    __m256 t1 = _mm256_unpacklo_ps(r[2], r[3]);
+    __m256 t2 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    r[0] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    r[1] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    r[2] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    r[3] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+// as mat4_mul_x4 for 8 products, products 0-3 in the low lane and 4-7 in
+//   the high lane
+void mat4_mul_x8(mat4_t ** a, mat4_t ** b, mat4_t ** out)
+{
+    __m256 as[4][4], bs[4][4];
+    for (int r = 0; r < 4; r ++)
+    {
+        for (int k = 0; k < 4; k ++)
+        {
+            as[r][k] = _mm256_insertf128_ps(_mm256_castps128_ps256(
+                _mm_loadu_ps(a[k]->m[r])), _mm_loadu_ps(a[k + 4]->m[r]), 1);
+            bs[r][k] = _mm256_insertf128_ps(_mm256_castps128_ps256(
+                _mm_loadu_ps(b[k]->m[r])), _mm_loadu_ps(b[k + 4]->m[r]), 1);
         }
+        transpose4_lanes(as[r]);
+        transpose4_lanes(bs[r]);
+    }
+    for (int r = 0; r < 4; r ++)
+    {
+        __m256 o[4];
+        for (int c = 0; c < 4; c ++)
+        {
+            __m256 s = _mm256_mul_ps(as[r][0], bs[0][c]);
+            s = _mm256_add_ps(s, _mm256_mul_ps(as[r][1], bs[1][c]));
+            s = _mm256_add_ps(s, _mm256_mul_ps(as[r][2], bs[2][c]));
+            s = _mm256_add_ps(s, _mm256_mul_ps(as[r][3], bs[3][c]));
+            o[c] = s;
+        }
+        transpose4_lanes(o);
+        for (int k = 0; k < 4; k ++)
+        {
+            _mm_storeu_ps(out[k]->m[r], _mm256_castps256_ps128(o[k]));
+            _mm_storeu_ps(out[k + 4]->m[r], _mm256_extractf128_ps(o[k], 1));
+        }
+    }
+}
+#endif
+
+void mat4_mul_batch(mat4_t ** a, mat4_t ** b, mat4_t ** out, uint32_t n)
+{
+    uint32_t i = 0;
+#if defined(QMATH_AVX)
+    for (; i + 8 <= n; i += 8) mat4_mul_x8(a + i, b + i, out + i);
+#endif
+#if defined(QMATH_SSE)
+    for (; i + 4 <= n; i += 4) mat4_mul_x4(a + i, b + i, out + i);
+#endif
+    for (; i < n; i ++)
+    {
+        mat4_mul_to(a[i], b[i], out[i]);
     }
-    memcpy(a, &res, sizeof(mat4_t));
 }
 
 // A' = A* / det(A)
@@ -133,6 +300,62 @@ void calc_inv_mat(mat4_t * m, mat4_t * out)
     }
 }
 
+void calc_affine_inv_mat(mat4_t * m, mat4_t * out)
+{
+    // columns of the upper 3x3, its inverse has rows c1 x c2, c2 x c0, c0 x c1
+    vec3_t c0 = (vec3_t){ m->m[0][0], m->m[1][0], m->m[2][0] };
+    vec3_t c1 = (vec3_t){ m->m[0][1], m->m[1][1], m->m[2][1] };
+    vec3_t c2 = (vec3_t){ m->m[0][2], m->m[1][2], m->m[2][2] };
+    vec3_t t = (vec3_t){ m->m[0][3], m->m[1][3], m->m[2][3] };
+    vec3_t r[3] = { vec3_cross(c1, c2), vec3_cross(c2, c0), vec3_cross(c0, c1) };
+    float inv_det = 1.0f / vec3_dot(c0, r[0]);
+
+    for (int i = 0; i < 3; i ++)
+    {
+        r[i] = vec3_mul(r[i], inv_det);
+        out->m[i][0] = r[i].x;
+        out->m[i][1] = r[i].y;
+        out->m[i][2] = r[i].z;
+        out->m[i][3] = - vec3_dot(r[i], t);
+    }
+    out->m[3][0] = out->m[3][1] = out->m[3][2] = 0.0f;
+    out->m[3][3] = 1.0f;
+}
+
+void calc_rigid_inv_mat(mat4_t * m, mat4_t * out)
+{
+    vec3_t t = (vec3_t){ m->m[0][3], m->m[1][3], m->m[2][3] };
+    for (int i = 0; i < 3; i ++)
+    {
+        vec3_t r = (vec3_t){ m->m[0][i], m->m[1][i], m->m[2][i] };
+        out->m[i][0] = r.x;
+        out->m[i][1] = r.y;
+        out->m[i][2] = r.z;
+        out->m[i][3] = - vec3_dot(r, t);
+    }
+    out->m[3][0] = out->m[3][1] = out->m[3][2] = 0.0f;
+    out->m[3][3] = 1.0f;
+}
+
+void calc_normal_mat(mat4_t * m, mat4_t * out)
+{
+    // (A^-1)^T has columns c1 x c2, c2 x c0, c0 x c1 over det
+    vec3_t c0 = (vec3_t){ m->m[0][0], m->m[1][0], m->m[2][0] };
+    vec3_t c1 = (vec3_t){ m->m[0][1], m->m[1][1], m->m[2][1] };
+    vec3_t c2 = (vec3_t){ m->m[0][2], m->m[1][2], m->m[2][2] };
+    vec3_t c[3] = { vec3_cross(c1, c2), vec3_cross(c2, c0), vec3_cross(c0, c1) };
+    float inv_det = 1.0f / vec3_dot(c0, c[0]);
+
+    memset(out->m, 0, sizeof(float) * 16);
+    for (int j = 0; j < 3; j ++)
+    {
+        out->m[0][j] = c[j].x * inv_det;
+        out->m[1][j] = c[j].y * inv_det;
+        out->m[2][j] = c[j].z * inv_det;
+    }
+    out->m[3][3] = 1.0f;
+}
+
 // clip float
 float clip_float(float x, float a, float b)
 {
@@ -169,10 +392,27 @@ vec4_t vec4_normalize(vec4_t v)
 vec4_t vec4_mat_mul(vec4_t v, mat4_t * m)
 {
     vec4_t res;
+#if defined(QMATH_SSE)
+    __m128 x = _mm_loadu_ps(&v.x);
+    __m128 p0 = _mm_mul_ps(_mm_loadu_ps(m->m[0]), x);
+    __m128 p1 = _mm_mul_ps(_mm_loadu_ps(m->m[1]), x);
+    __m128 p2 = _mm_mul_ps(_mm_loadu_ps(m->m[2]), x);
+    __m128 p3 = _mm_mul_ps(_mm_loadu_ps(m->m[3]), x);
+    // horizontal sums of the four products at once
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    _mm_storeu_ps(&res.x, _mm_add_ps(_mm_add_ps(p0, p1), _mm_add_ps(p2, p3)));
+#elif defined(QMATH_NEON)
+    float32x4_t x = vld1q_f32(&v.x);
+    res.x = vaddvq_f32(vmulq_f32(vld1q_f32(m->m[0]), x));
+    res.y = vaddvq_f32(vmulq_f32(vld1q_f32(m->m[1]), x));
+    res.z = vaddvq_f32(vmulq_f32(vld1q_f32(m->m[2]), x));
+    res.w = vaddvq_f32(vmulq_f32(vld1q_f32(m->m[3]), x));
+#else
     res.x = v.x * m->m[0][0] + v.y * m->m[0][1] + v.z * m->m[0][2] + v.w * m->m[0][3];
     res.y = v.x * m->m[1][0] + v.y * m->m[1][1] + v.z * m->m[1][2] + v.w * m->m[1][3];
     res.z = v.x * m->m[2][0] + v.y * m->m[2][1] + v.z * m->m[2][2] + v.w * m->m[2][3];
     res.w = v.x * m->m[3][0] + v.y * m->m[3][1] + v.z * m->m[3][2] + v.w * m->m[3][3];
+#endif
     return res;
 }
 
@@ -211,10 +451,29 @@ float  vec3_dot(vec3_t a, vec3_t b)
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
+// 1 / sqrt(x), estimate refined by Newton-Raphson on SIMD targets
+float rsqrt(float x)
+{
+#if defined(QMATH_SSE)
+    __m128 s = _mm_set_ss(x);
+    __m128 r = _mm_rsqrt_ss(s);
+    __m128 h = _mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), s), _mm_mul_ss(r, r));
+    r = _mm_mul_ss(r, _mm_sub_ss(_mm_set_ss(1.5f), h));
+    return _mm_cvtss_f32(r);
+#elif defined(QMATH_NEON)
+    float32x2_t s = vdup_n_f32(x);
+    float32x2_t r = vrsqrte_f32(s);
+    r = vmul_f32(r, vrsqrts_f32(vmul_f32(s, r), r));
+    r = vmul_f32(r, vrsqrts_f32(vmul_f32(s, r), r));
+    return vget_lane_f32(r, 0);
+#else
+    return 1.0f / sqrtf(x);
+#endif
+}
+
 vec3_t vec3_normalize(vec3_t v)
 {
-    float norm = v.x * v.x + v.y * v.y + v.z * v.z;
-    norm = 1.0f / sqrtf(norm);
+    float norm = rsqrt(v.x * v.x + v.y * v.y + v.z * v.z);
     return (vec3_t){v.x * norm, v.y * norm, v.z * norm};
 }
 
@@ -227,6 +486,109 @@ vec3_t vec3_mat_mul(vec3_t v, mat4_t * m)
     return res;
 }
 
+void mat4_transform_points(mat4_t * m, const vec3_t * in, vec4_t * out,
+    uint32_t n)
+{
+    uint32_t i = 0;
+#if defined(QMATH_SSE)
+    // columns of m, out = c0 * x + c1 * y + c2 * z + c3
+    __m128 c0 = _mm_setr_ps(m->m[0][0], m->m[1][0], m->m[2][0], m->m[3][0]);
+    __m128 c1 = _mm_setr_ps(m->m[0][1], m->m[1][1], m->m[2][1], m->m[3][1]);
+    __m128 c2 = _mm_setr_ps(m->m[0][2], m->m[1][2], m->m[2][2], m->m[3][2]);
+    __m128 c3 = _mm_setr_ps(m->m[0][3], m->m[1][3], m->m[2][3], m->m[3][3]);
+#if defined(QMATH_AVX)
+    // two points per iteration, one in each 128 bit lane
+    __m256 d0 = _mm256_insertf128_ps(_mm256_castps128_ps256(c0), c0, 1);
+    __m256 d1 = _mm256_insertf128_ps(_mm256_castps128_ps256(c1), c1, 1);
+    __m256 d2 = _mm256_insertf128_ps(_mm256_castps128_ps256(c2), c2, 1);
+    __m256 d3 = _mm256_insertf128_ps(_mm256_castps128_ps256(c3), c3, 1);
+    for (; i + 2 <= n; i += 2)
+    {
+        const vec3_t *a = &in[i], *b = &in[i + 1];
+        __m256 s = _mm256_mul_ps(d0, _mm256_setr_ps(
+            a->x, a->x, a->x, a->x, b->x, b->x, b->x, b->x));
+        s = _mm256_add_ps(s, _mm256_mul_ps(d1, _mm256_setr_ps(
+            a->y, a->y, a->y, a->y, b->y, b->y, b->y, b->y)));
+        s = _mm256_add_ps(s, _mm256_mul_ps(d2, _mm256_setr_ps(
+            a->z, a->z, a->z, a->z, b->z, b->z, b->z, b->z)));
+        s = _mm256_add_ps(s, d3);
+        _mm256_storeu_ps(&out[i].x, s);
+    }
+#endif
+    for (; i < n; i ++)
+    {
+        __m128 s = _mm_mul_ps(c0, _mm_set1_ps(in[i].x));
+        s = _mm_add_ps(s, _mm_mul_ps(c1, _mm_set1_ps(in[i].y)));
+        s = _mm_add_ps(s, _mm_mul_ps(c2, _mm_set1_ps(in[i].z)));
+        _mm_storeu_ps(&out[i].x, _mm_add_ps(s, c3));
+    }
+#elif defined(QMATH_NEON)
+    float32x4_t c0 = { m->m[0][0], m->m[1][0], m->m[2][0], m->m[3][0] };
+    float32x4_t c1 = { m->m[0][1], m->m[1][1], m->m[2][1], m->m[3][1] };
+    float32x4_t c2 = { m->m[0][2], m->m[1][2], m->m[2][2], m->m[3][2] };
+    float32x4_t c3 = { m->m[0][3], m->m[1][3], m->m[2][3], m->m[3][3] };
+    for (; i < n; i ++)
+    {
+        float32x4_t s = vmlaq_n_f32(c3, c0, in[i].x);
+        s = vmlaq_n_f32(s, c1, in[i].y);
+        s = vmlaq_n_f32(s, c2, in[i].z);
+        vst1q_f32(&out[i].x, s);
+    }
+#else
+    for (; i < n; i ++)
+    {
+        out[i] = vec4_mat_mul(get_vec4(in[i]), m);
+    }
+#endif
+}
+
+void mat4_transform_vectors(mat4_t * m, const vec3_t * in, vec3_t * out,
+    uint32_t n)
+{
+    uint32_t i = 0;
+#if defined(QMATH_SSE)
+    __m128 c0 = _mm_setr_ps(m->m[0][0], m->m[1][0], m->m[2][0], 0.0f);
+    __m128 c1 = _mm_setr_ps(m->m[0][1], m->m[1][1], m->m[2][1], 0.0f);
+    __m128 c2 = _mm_setr_ps(m->m[0][2], m->m[1][2], m->m[2][2], 0.0f);
+    for (; i < n; i ++)
+    {
+        __m128 s = _mm_mul_ps(c0, _mm_set1_ps(in[i].x));
+        s = _mm_add_ps(s, _mm_mul_ps(c1, _mm_set1_ps(in[i].y)));
+        s = _mm_add_ps(s, _mm_mul_ps(c2, _mm_set1_ps(in[i].z)));
+        // 12 byte store, in and out may be the same array
+        _mm_storel_pi((__m64 *)&out[i].x, s);
+        _mm_store_ss(&out[i].z, _mm_movehl_ps(s, s));
+    }
+#elif defined(QMATH_NEON)
+    float32x4_t c0 = { m->m[0][0], m->m[1][0], m->m[2][0], 0.0f };
+    float32x4_t c1 = { m->m[0][1], m->m[1][1], m->m[2][1], 0.0f };
+    float32x4_t c2 = { m->m[0][2], m->m[1][2], m->m[2][2], 0.0f };
+    for (; i < n; i ++)
+    {
+        float32x4_t s = vmulq_n_f32(c0, in[i].x);
+        s = vmlaq_n_f32(s, c1, in[i].y);
+        s = vmlaq_n_f32(s, c2, in[i].z);
+        vst1_f32(&out[i].x, vget_low_f32(s));
+        out[i].z = vgetq_lane_f32(s, 2);
+    }
+#else
+    for (; i < n; i ++)
+    {
+        out[i] = vec3_mat_mul(in[i], m);
+    }
+#endif
+}
+
+void mat4_transform_normals(mat4_t * m, const vec3_t * in, vec3_t * out,
+    uint32_t n)
+{
+    mat4_transform_vectors(m, in, out, n);
+    for (uint32_t i = 0; i < n; i ++)
+    {
+        out[i] = vec3_normalize(out[i]);
+    }
+}
+
 vec3_t vec3_clip(vec3_t v, float a, float b)
 {
     vec3_t r;
@@ -263,3 +625,26 @@ void mat4_from_quat(mat4_t * m, quat_t q)
 
     m->m[3][3] = 1;
 }
+
+quat_t quat_slerp(quat_t a, quat_t b, float t)
+{
+    float d = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+    if (d < 0.0f)
+    {
+        // q and -q are the same rotation, take the short way
+        b = (quat_t){ -b.w, -b.x, -b.y, -b.z };
+        d = -d;
+    }
+    float wa = 1.0f - t, wb = t;
+    if (d < 0.9995f)
+    {
+        float theta = acosf(d);
+        float s = 1.0f / sinf(theta);
+        wa = sinf(wa * theta) * s;
+        wb = sinf(wb * theta) * s;
+    }
+    quat_t q = { wa * a.w + wb * b.w, wa * a.x + wb * b.x,
+        wa * a.y + wb * b.y, wa * a.z + wb * b.z };
+    float n = rsqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+    return (quat_t){ q.w * n, q.x * n, q.y * n, q.z * n };
+}
@@ -1,9 +1,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <float.h>
 #include "qmesh.h"
 
-#define MAX_LINE_LEN 256
+#define MAX_LINE_LEN 1024
+#define OBJ_DELIMS " \t\r\n"
+
+// strtok_s of the MS CRT has the signature of POSIX strtok_r
+#ifdef _WIN32
+#define strtok_r strtok_s
+#endif
 
 const char *get_extension(const char *fn)
 {
@@ -21,36 +29,62 @@ int strequ(const char *str0, const char *str1)
     return strcmp(str0, str1) == 0;
 }
 
-typedef enum
+// reads up to dim floats following the keyword
+void read_floats(char **line_cpy, float *buffer, const int dim)
 {
-    TYPE_UINT32,
-    TYPE_FLOAT,
-} type_t;
+    for (int i = 0; i < dim; ++ i)
+    {
+        const char *token = strtok_r(NULL, OBJ_DELIMS, line_cpy);
+        buffer[i] = token ? (float)atof(token) : 0.0f;
+    }
+}
 
-int read_line(char *line, void *buffer, const int dim, const type_t format)
+// copies the rest of the line (a name) without surrounding white spaces
+void read_name(char **line_cpy, char *name)
 {
-    char *line_cpy;
-    char *token = strtok_s(line, " ", &line_cpy);
-    for (int i = 0; i < dim; ++ i)
+    const char *token = strtok_r(NULL, "\r\n", line_cpy);
+    size_t len;
+    name[0] = '\0';
+    if (token == NULL) return;
+    while (*token == ' ' || *token == '\t') ++ token;
+    len = strlen(token);
+    while (len > 0 && (token[len - 1] == ' ' || token[len - 1] == '\t')) -- len;
+    if (len >= MESH_NAME_LEN) len = MESH_NAME_LEN - 1;
+    memcpy(name, token, len);
+    name[len] = '\0';
+}
+
+/**
+ * @brief Parses a face corner "v", "v/vt", "v//vn" or "v/vt/vn" into
+ *      1-based indices. Negative (relative) indices are resolved against the
+ *      number of elements read so far. Missing elements are left 0.
+ * 
+ * @return int  0 if ok, -1 if an index is out of range
+ */
+int read_face_corner(const char *token, const uint32_t n_read[3],
+    uint32_t idx[3])
+{
+    char *end;
+    idx[0] = idx[1] = idx[2] = 0;
+    for (int i = 0; i < 3; i ++)
     {
-        token = strtok_s(NULL, " ", &line_cpy);
-        token[strcspn(token, "\n")] = '\0';
-        switch (format)
+        long v = strtol(token, &end, 10);
+        if (end != token)
         {
-            case TYPE_FLOAT:
-                ((float*)buffer)[i] = atof(token);
-                break;
-            case TYPE_UINT32:
-                ((uint32_t*)buffer)[i] = atoi(token);
-                break;
-            default: break;
+            if (v < 0) v += (long)n_read[i] + 1;
+            if (v <= 0 || v > (long)n_read[i]) return -1;
+            idx[i] = (uint32_t)v;
         }
+        if (*end != '/') break;
+        token = end + 1;
     }
-    return 0;
+    return idx[0] > 0 ? 0 : -1;
 }
 
 mesh_t *load_obj(const char *fn);
 
+vec3_t face_normal(mesh_t *mesh, uint32_t face);
+
 mesh_t *get_mesh()
 {
     mesh_t *mesh = (mesh_t *)malloc(sizeof(mesh_t));
@@ -67,6 +101,17 @@ mesh_t *get_mesh()
     mesh->n_texcoords = 0;
     mesh->n_faces = 0;
 
+    mesh->submeshes = NULL;
+    mesh->n_submeshes = 0;
+    mesh->material_names = NULL;
+    mesh->n_materials = 0;
+    mesh->batches = NULL;
+    mesh->n_batches = 0;
+    mesh->meshlets = NULL;
+    mesh->n_meshlets = 0;
+    mesh->joints = NULL;
+    mesh->weights = NULL;
+
     mesh->mesh_type = 0;
 
     return mesh;
@@ -81,6 +126,13 @@ void destroy_mesh(mesh_t *mesh)
     free(mesh->vertex_idx);
     free(mesh->texcoord_idx);
     free(mesh->normal_idx);
+
+    free(mesh->submeshes);
+    free(mesh->material_names);
+    free(mesh->batches);
+    free(mesh->meshlets);
+    free(mesh->joints);
+    free(mesh->weights);
 }
 
 mesh_t *load_mesh(const char *fn)
@@ -96,7 +148,16 @@ mesh_t *load_mesh(const char *fn)
     return NULL;
 }
 
-int load_obj_dimensions(mesh_t *mesh, FILE *file, char* err_msg)
+/**
+ * @brief First pass of obj loading. Counts elements, triangles after fan
+ *      triangulation, and upper bounds of submeshes and materials. Face
+ *      indices are validated here. Corners without texcoord share one extra
+ *      (0, 0) texcoord, polygons lacking normals get one flat normal per
+ *      triangle; both are appended after the elements of the file.
+ */
+int load_obj_dimensions(mesh_t *mesh, FILE *file,
+    uint32_t *max_submeshes, uint32_t *max_materials, uint32_t *n_flat,
+    char* err_msg)
 {
     char buffer[MAX_LINE_LEN] = {0};
     char *buffer_cpy;
@@ -106,13 +167,18 @@ int load_obj_dimensions(mesh_t *mesh, FILE *file, char* err_msg)
     uint32_t n_normals = 0;
     uint32_t n_texcoords = 0;
     uint32_t n_faces = 0;
+    uint32_t n_switches = 0;
+    uint32_t n_usemtl = 0;
+    uint32_t n_flat_normals = 0;
+    int no_texcoord = 0;
     
     while (fgets(buffer, sizeof(buffer), file))
     {
         ++ line_no;
         const char *token;
 
-        token = strtok_s(buffer, " ", &buffer_cpy);
+        token = strtok_r(buffer, OBJ_DELIMS, &buffer_cpy);
+        if (token == NULL) continue;
         if (strequ(token, "v"))     // Vertex
         {
             ++ n_vertices;
@@ -125,21 +191,40 @@ int load_obj_dimensions(mesh_t *mesh, FILE *file, char* err_msg)
         {
             ++ n_texcoords;
         }
-        else if (strequ(token, "f"))    // Face
+        else if (strequ(token, "f"))    // Face, n corners -> n - 2 triangles
         {
-            ++ n_faces;
+            const uint32_t n_read[3] = { n_vertices, n_texcoords, n_normals };
+            uint32_t n_corners = 0, idx[3];
+            int no_normal = 0;
+            while ((token = strtok_r(NULL, OBJ_DELIMS, &buffer_cpy)))
+            {
+                if (read_face_corner(token, n_read, idx) != 0)
+                {
+                    snprintf(err_msg, 256, "Line %u: invalid face corner %s",
+                        line_no, token);
+                    return -1;
+                }
+                no_texcoord |= idx[1] == 0;
+                no_normal |= idx[2] == 0;
+                ++ n_corners;
+            }
+            if (n_corners > 2)
+            {
+                n_faces += n_corners - 2;
+                if (no_normal) n_flat_normals += n_corners - 2;
+            }
+        }
+        else if (strequ(token, "o") || strequ(token, "g"))  // Name
+        {
+            ++ n_switches;
         }
-        else if (strequ(token, "o"))    // Name
+        else if (strequ(token, "usemtl"))   // Material
         {
-            // TODO:
+            ++ n_switches;
+            ++ n_usemtl;
         }
     }
 
-    mesh->n_vertices = n_vertices;
-    mesh->n_normals = n_normals;
-    mesh->n_texcoords = n_texcoords;
-    mesh->n_faces = n_faces;
-
     if (n_texcoords > 0)
     {
         mesh->mesh_type |= T_TEXCOORD;
@@ -149,19 +234,100 @@ int load_obj_dimensions(mesh_t *mesh, FILE *file, char* err_msg)
         mesh->mesh_type |= T_NORMAL;
     }
 
+    mesh->n_vertices = n_vertices;
+    mesh->n_normals = n_normals + n_flat_normals;
+    mesh->n_texcoords = n_texcoords + (no_texcoord ? 1 : 0);
+    mesh->n_faces = n_faces;
+    *max_submeshes = n_switches + 1;
+    *max_materials = n_usemtl + 1;
+    *n_flat = n_flat_normals;
+
     return 0;
 }
 
+// returns the index of material name, appends it if not found
+uint32_t find_material(mesh_t *mesh, const char *name)
+{
+    for (uint32_t i = 0; i < mesh->n_materials; i ++)
+    {
+        if (strequ(mesh->material_names[i], name)) return i;
+    }
+    strcpy(mesh->material_names[mesh->n_materials], name);
+    return mesh->n_materials ++;
+}
+
+/**
+ * @brief Stable-sorts submeshes by material, moves their faces accordingly and
+ *      builds one draw range per material.
+ */
+void build_mesh_batches(mesh_t *mesh)
+{
+    uint32_t n = mesh->n_faces;
+    uint32_t *vidx = malloc(n * 3 * sizeof(uint32_t));
+    uint32_t *tidx = malloc(n * 3 * sizeof(uint32_t));
+    uint32_t *nidx = malloc(n * 3 * sizeof(uint32_t));
+    uint32_t fi = 0;
+
+    // insertion sort, keeps file order within a material
+    for (uint32_t i = 1; i < mesh->n_submeshes; i ++)
+    {
+        submesh_t sm = mesh->submeshes[i];
+        uint32_t j = i;
+        for (; j > 0 && mesh->submeshes[j - 1].material > sm.material; j --)
+        {
+            mesh->submeshes[j] = mesh->submeshes[j - 1];
+        }
+        mesh->submeshes[j] = sm;
+    }
+
+    mesh->batches = calloc(mesh->n_materials, sizeof(draw_range_t));
+    mesh->n_batches = 0;
+    for (uint32_t i = 0; i < mesh->n_submeshes; i ++)
+    {
+        submesh_t *sm = &mesh->submeshes[i];
+        size_t from = (size_t)sm->first_face * 3, count = (size_t)sm->n_faces * 3;
+        memcpy(vidx + fi * 3, mesh->vertex_idx + from, count * sizeof(uint32_t));
+        memcpy(tidx + fi * 3, mesh->texcoord_idx + from, count * sizeof(uint32_t));
+        memcpy(nidx + fi * 3, mesh->normal_idx + from, count * sizeof(uint32_t));
+        sm->first_face = fi;
+        fi += sm->n_faces;
+        if (sm->n_faces == 0) continue;
+
+        draw_range_t *last = mesh->n_batches > 0 ? 
+            &mesh->batches[mesh->n_batches - 1] : NULL;
+        if (last != NULL && last->material == sm->material)
+        {
+            last->n_faces += sm->n_faces;
+        }
+        else
+        {
+            mesh->batches[mesh->n_batches ++] = (draw_range_t){
+                sm->material, sm->first_face, sm->n_faces };
+        }
+    }
+
+    free(mesh->vertex_idx);
+    free(mesh->texcoord_idx);
+    free(mesh->normal_idx);
+    mesh->vertex_idx = vidx;
+    mesh->texcoord_idx = tidx;
+    mesh->normal_idx = nidx;
+}
+
 mesh_t *load_obj(const char *fn)
 {
     char err_msg[256];
     char line_buffer[MAX_LINE_LEN];
     char *line_buffer_cpy;
     uint32_t vi = 0, ti = 0, ni = 0, fi = 0;
+    uint32_t max_submeshes, max_materials, n_flat, flat_ni;
+    char name[MESH_NAME_LEN] = "";
+    uint32_t material;
+    int new_submesh = 1;
     mesh_t *mesh;
 
     FILE *file;
-    fopen_s(&file, fn, "r");
+    file = fopen(fn, "r");
     if (!file)
     {
         // FILE NOT FOUND
@@ -171,11 +337,16 @@ mesh_t *load_obj(const char *fn)
 
     // Get object dimensions
     mesh = get_mesh();
-    if (load_obj_dimensions(mesh, file, err_msg) != 0)
+    if (load_obj_dimensions(mesh, file, &max_submeshes, &max_materials,
+        &n_flat, err_msg) != 0)
     {
+        printf("%s: %s. Mesh load failed.\n", fn, err_msg);
+        fclose(file);
         destroy_mesh(mesh);
+        free(mesh);
         return NULL;
     }
+    flat_ni = mesh->n_normals - n_flat;
 
     // Allocation
     mesh->vertices = calloc(mesh->n_vertices, sizeof(vec3_t));
@@ -184,67 +355,96 @@ mesh_t *load_obj(const char *fn)
     mesh->vertex_idx = calloc(mesh->n_faces * 3, sizeof(uint32_t));
     mesh->texcoord_idx = calloc(mesh->n_faces * 3, sizeof(uint32_t));
     mesh->normal_idx = calloc(mesh->n_faces * 3, sizeof(uint32_t));
+    mesh->submeshes = calloc(max_submeshes, sizeof(submesh_t));
+    mesh->material_names = calloc(max_materials, MESH_NAME_LEN);
+    material = find_material(mesh, "");
 
     // Scan for data
     fseek(file, 0, SEEK_SET);
     while (fgets(line_buffer, sizeof(line_buffer), file))
     {
-        const char *token = strtok_s(line_buffer, " ", &line_buffer_cpy);
-        void *buffer = NULL;
-        int dim;
-        type_t format;
+        const char *token = strtok_r(line_buffer, OBJ_DELIMS, &line_buffer_cpy);
+        if (token == NULL) continue;
 
         if (strequ(token, "v"))
         {
-            buffer = (void*)(&mesh->vertices[vi]);
-            dim = 3;
-            format = TYPE_FLOAT;
-            ++ vi;
+            read_floats(&line_buffer_cpy, (float *)&mesh->vertices[vi ++], 3);
         }
         else if (strequ(token, "vn"))
         {
-            buffer = (void*)(&mesh->normals[ni]);
-            dim = 3;
-            format = TYPE_FLOAT;
-            ++ ni;
+            read_floats(&line_buffer_cpy, (float *)&mesh->normals[ni ++], 3);
         }
         else if (strequ(token, "vt"))
         {
-            buffer = (void*)(&mesh->texcoords[ti]);
-            dim = 2;
-            format = TYPE_FLOAT;
-            ++ ti;
+            read_floats(&line_buffer_cpy, (float *)&mesh->texcoords[ti ++], 2);
+        }
+        else if (strequ(token, "o") || strequ(token, "g"))
+        {
+            read_name(&line_buffer_cpy, name);
+            new_submesh = 1;
+        }
+        else if (strequ(token, "usemtl"))
+        {
+            char mtl[MESH_NAME_LEN];
+            read_name(&line_buffer_cpy, mtl);
+            material = find_material(mesh, mtl);
+            new_submesh = 1;
         }
         else if (strequ(token, "f"))
         {
-            for (int i = 0; i < 3; i++)
+            // fan triangulation: (c0, c1, c2), (c0, c2, c3), ...
+            const uint32_t n_read[3] = { vi, ti, ni };
+            uint32_t first[3], prev[3], cur[3];
+            uint32_t first_fi = fi;
+            int n_corners = 0, no_normal = 0;
+
+            if (new_submesh)
             {
-                token = strtok_s(NULL, "/ ", &line_buffer_cpy);
-                mesh->vertex_idx[fi * 3 + i] = atoi(token);
-                if ((mesh->mesh_type & T_TEXCOORD)
-                 || (mesh->mesh_type & T_NORMAL))
+                submesh_t *sm = &mesh->submeshes[mesh->n_submeshes ++];
+                strcpy(sm->name, name);
+                sm->material = material;
+                sm->first_face = fi;
+                sm->n_faces = 0;
+                new_submesh = 0;
+            }
+
+            while ((token = strtok_r(NULL, OBJ_DELIMS, &line_buffer_cpy)))
+            {
+                read_face_corner(token, n_read, cur);
+                if (cur[1] == 0) cur[1] = mesh->n_texcoords;
+                no_normal |= cur[2] == 0;
+                if (n_corners >= 2)
                 {
-                    token = strtok_s(NULL, "/ ", &line_buffer_cpy);
-                    if (mesh->mesh_type & T_TEXCOORD)
-                    {
-                        mesh->texcoord_idx[fi * 3 + i] = atoi(token);
-                    }
-                    token = strtok_s(NULL, " ", &line_buffer_cpy);
-                    if (mesh->mesh_type & T_NORMAL)
+                    const uint32_t *corners[3] = { first, prev, cur };
+                    for (int i = 0; i < 3; i ++)
                     {
-                        mesh->normal_idx[fi * 3 + i] = atoi(token);
+                        mesh->vertex_idx[fi * 3 + i] = corners[i][0];
+                        mesh->texcoord_idx[fi * 3 + i] = corners[i][1];
+                        mesh->normal_idx[fi * 3 + i] = corners[i][2];
                     }
+                    ++ fi;
+                    ++ mesh->submeshes[mesh->n_submeshes - 1].n_faces;
                 }
+                if (n_corners == 0) memcpy(first, cur, sizeof(cur));
+                memcpy(prev, cur, sizeof(cur));
+                ++ n_corners;
             }
-            ++ fi;
-            continue;
-        }
 
-        line_buffer[strcspn(token, "\0")] = ' ';
-        if (buffer != NULL) read_line(line_buffer, buffer, dim, format);
+            // no (complete) normals, shade the polygon flat
+            for (uint32_t i = first_fi; no_normal && i < fi; i ++)
+            {
+                mesh->normals[flat_ni] = face_normal(mesh, i);
+                ++ flat_ni;
+                for (int j = 0; j < 3; j ++)
+                {
+                    mesh->normal_idx[i * 3 + j] = flat_ni;
+                }
+            }
+        }
     }
 
     fclose(file);
+    build_mesh_batches(mesh);
     return mesh;
 }
 
@@ -269,3 +469,197 @@ vec3_t mesh_center(mesh_t *mesh)
     };
     return res;
 }
+
+vec3_t face_normal(mesh_t *mesh, uint32_t face)
+{
+    uint32_t *vidx = &mesh->vertex_idx[face * 3];
+    vec3_t a = mesh->vertices[vidx[0] - 1];
+    vec3_t b = mesh->vertices[vidx[1] - 1];
+    vec3_t c = mesh->vertices[vidx[2] - 1];
+    vec3_t n = vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+    float len = sqrtf(vec3_dot(n, n));
+    return len > 0.0f ? vec3_div(n, len) : n;
+}
+
+// bounding sphere and normal cone of faces [first, first + n)
+void meshlet_bounds(mesh_t *mesh, meshlet_t *m, vec3_t *normals)
+{
+    vec3_t mi = (vec3_t){ 1e30f, 1e30f, 1e30f };
+    vec3_t mx = (vec3_t){ -1e30f, -1e30f, -1e30f };
+    vec3_t axis = (vec3_t){ 0.0f, 0.0f, 0.0f };
+    float radius = 0.0f, mindp = 1.0f, len;
+
+    for (uint32_t i = m->first_face * 3; i < (m->first_face + m->n_faces) * 3; i ++)
+    {
+        vec3_t v = mesh->vertices[mesh->vertex_idx[i] - 1];
+        mi = (vec3_t){ fminf(mi.x, v.x), fminf(mi.y, v.y), fminf(mi.z, v.z) };
+        mx = (vec3_t){ fmaxf(mx.x, v.x), fmaxf(mx.y, v.y), fmaxf(mx.z, v.z) };
+    }
+    m->center = vec3_mul(vec3_add(mi, mx), 0.5f);
+    for (uint32_t i = m->first_face * 3; i < (m->first_face + m->n_faces) * 3; i ++)
+    {
+        vec3_t d = vec3_sub(mesh->vertices[mesh->vertex_idx[i] - 1], m->center);
+        radius = fmaxf(radius, vec3_dot(d, d));
+    }
+    m->radius = sqrtf(radius);
+
+    for (uint32_t i = m->first_face; i < m->first_face + m->n_faces; i ++)
+    {
+        axis = vec3_add(axis, normals[i]);
+    }
+    len = sqrtf(vec3_dot(axis, axis));
+    for (uint32_t i = m->first_face; i < m->first_face + m->n_faces && len > 0.0f; i ++)
+    {
+        if (vec3_dot(normals[i], normals[i]) == 0.0f) continue;
+        mindp = fminf(mindp, vec3_dot(normals[i], axis) / len);
+    }
+    m->cone_axis = len > 0.0f ? vec3_div(axis, len) : axis;
+    // wider than a hemisphere (or no normal at all), never backfacing as a whole
+    m->cone_cutoff = (len > 0.0f && mindp > 0.0f) ? 
+        sqrtf(1.0f - mindp * mindp) : 2.0f;
+}
+
+/**
+ * @brief Greedily grows meshlets over faces sharing a vertex, preferring the
+ *      faces that keep the normal cone narrow.
+ */
+void build_submesh_meshlets(mesh_t *mesh, submesh_t *sm, uint32_t max_faces,
+    vec3_t *normals, uint32_t *vstart, uint32_t *vfaces, uint8_t *used,
+    uint32_t *order)
+{
+    uint32_t first = sm->first_face, end = sm->first_face + sm->n_faces;
+    uint32_t n_order = 0, seed = first;
+    uint32_t *cand = malloc(max_faces * 3 * 16 * sizeof(uint32_t));
+    uint32_t max_cand = max_faces * 3 * 16;
+
+    while (n_order < sm->n_faces)
+    {
+        meshlet_t *m = &mesh->meshlets[mesh->n_meshlets ++];
+        vec3_t axis = (vec3_t){ 0.0f, 0.0f, 0.0f };
+        uint32_t n_cand = 0;
+
+        m->first_face = first + n_order;
+        m->n_faces = 0;
+        while (seed < end && used[seed - first]) seed ++;
+        cand[n_cand ++] = seed;
+
+        while (m->n_faces < max_faces)
+        {
+            // best candidate by normal
+            int best = -1;
+            float best_dp = -FLT_MAX;
+            for (uint32_t i = 0; i < n_cand; i ++)
+            {
+                if (used[cand[i] - first]) continue;
+                float dp = vec3_dot(normals[cand[i]], axis);
+                if (dp > best_dp)
+                {
+                    best_dp = dp;
+                    best = i;
+                }
+            }
+            if (best < 0)
+            {
+                // disconnected, keep small meshlets filling in file order
+                if (m->n_faces >= max_faces / 4) break;
+                while (seed < end && used[seed - first]) seed ++;
+                if (seed >= end) break;
+                n_cand = 0;
+                cand[n_cand ++] = seed;
+                best = 0;
+            }
+
+            uint32_t f = cand[best];
+            cand[best] = cand[-- n_cand];
+            used[f - first] = 1;
+            order[n_order ++] = f;
+            m->n_faces ++;
+            axis = vec3_add(axis, normals[f]);
+
+            // neighbours sharing a vertex
+            for (int j = 0; j < 3; j ++)
+            {
+                uint32_t v = mesh->vertex_idx[f * 3 + j] - 1;
+                for (uint32_t k = vstart[v]; k < vstart[v + 1]; k ++)
+                {
+                    uint32_t g = vfaces[k];
+                    if (g < first || g >= end || used[g - first]) continue;
+                    if (n_cand < max_cand) cand[n_cand ++] = g;
+                }
+            }
+        }
+    }
+    free(cand);
+}
+
+void build_meshlets(mesh_t *mesh, uint32_t max_faces)
+{
+    uint32_t n = mesh->n_faces, max_meshlets = 0;
+    vec3_t *normals = malloc(n * sizeof(vec3_t));
+    uint32_t *vstart = calloc(mesh->n_vertices + 1, sizeof(uint32_t));
+    uint32_t *vfaces = malloc(n * 3 * sizeof(uint32_t));
+    uint8_t *used = calloc(n, sizeof(uint8_t));
+    uint32_t *order = malloc(n * sizeof(uint32_t));
+    uint32_t *tmp = malloc((n * 3 + mesh->n_vertices) * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < n; i ++) normals[i] = face_normal(mesh, i);
+
+    // vertex -> faces
+    for (uint32_t i = 0; i < n * 3; i ++) vstart[mesh->vertex_idx[i]] ++;
+    for (uint32_t i = 0; i < mesh->n_vertices; i ++) vstart[i + 1] += vstart[i];
+    memcpy(tmp, vstart, mesh->n_vertices * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n * 3; i ++)
+    {
+        vfaces[tmp[mesh->vertex_idx[i] - 1] ++] = i / 3;
+    }
+
+    // small meshlets can be emitted for disconnected parts, reserve for all
+    for (uint32_t i = 0; i < mesh->n_submeshes; i ++)
+    {
+        max_meshlets += mesh->submeshes[i].n_faces;
+    }
+    free(mesh->meshlets);
+    mesh->meshlets = malloc((max_meshlets + 1) * sizeof(meshlet_t));
+    mesh->n_meshlets = 0;
+
+    // submeshes are laid out in face order after loading
+    for (uint32_t i = 0; i < mesh->n_submeshes; i ++)
+    {
+        submesh_t *sm = &mesh->submeshes[i];
+        uint32_t m0 = mesh->n_meshlets;
+        if (sm->n_faces == 0) continue;
+        memset(used, 0, sm->n_faces);
+        build_submesh_meshlets(mesh, sm, max_faces, normals, vstart, vfaces,
+            used, order);
+
+        // move faces into meshlet order
+        uint32_t *idx[3] = {
+            mesh->vertex_idx, mesh->texcoord_idx, mesh->normal_idx };
+        for (int k = 0; k < 3; k ++)
+        {
+            for (uint32_t j = 0; j < sm->n_faces; j ++)
+            {
+                memcpy(tmp + j * 3, idx[k] + order[j] * 3, 3 * sizeof(uint32_t));
+            }
+            memcpy(idx[k] + sm->first_face * 3, tmp,
+                sm->n_faces * 3 * sizeof(uint32_t));
+        }
+        for (uint32_t j = sm->first_face; j < sm->first_face + sm->n_faces; j ++)
+        {
+            normals[j] = face_normal(mesh, j);
+        }
+        for (uint32_t j = m0; j < mesh->n_meshlets; j ++)
+        {
+            meshlet_bounds(mesh, &mesh->meshlets[j], normals);
+        }
+    }
+
+    mesh->meshlets = realloc(mesh->meshlets,
+        (mesh->n_meshlets + 1) * sizeof(meshlet_t));
+    free(normals);
+    free(vstart);
+    free(vfaces);
+    free(used);
+    free(order);
+    free(tmp);
+}
@@ -0,0 +1,474 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "qpbr.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define QPBR_SSE
+#include <xmmintrin.h>
+#endif
+
+#define PBR_MIN_ROUGHNESS 0.03f     // keeps the GGX peak finite
+#define PBR_SUN_COS 0.997f          // cosine of the sun's angular radius
+
+// ==================
+// Octahedral maps
+// ==================
+
+// direction -> [0, 1]^2, the lower hemisphere folded over the corners
+void oct_encode(vec3_t d, float *u, float *v)
+{
+    float s = fabsf(d.x) + fabsf(d.y) + fabsf(d.z);
+    float x = d.x / s, y = d.y / s;
+    if (d.z < 0.0f)
+    {
+        float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    *u = x * 0.5f + 0.5f;
+    *v = y * 0.5f + 0.5f;
+}
+
+vec3_t oct_decode(float u, float v)
+{
+    float x = u * 2.0f - 1.0f, y = v * 2.0f - 1.0f;
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f)
+    {
+        float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    return vec3_normalize((vec3_t){ x, y, z });
+}
+
+// bilinear RGBA of a size x size map, edges clamped
+void oct_sample(const float *map, int size, vec3_t d, float out[4])
+{
+    float u, v;
+    oct_encode(d, &u, &v);
+    float tx = u * size - 0.5f, ty = v * size - 0.5f;
+    tx = tx < 0.0f ? 0.0f : (tx > size - 1 ? size - 1 : tx);
+    ty = ty < 0.0f ? 0.0f : (ty > size - 1 ? size - 1 : ty);
+    int x0 = (int)tx, y0 = (int)ty;
+    int x1 = x0 + 1 < size ? x0 + 1 : x0;
+    int y1 = y0 + 1 < size ? y0 + 1 : y0;
+    float fx = tx - x0, fy = ty - y0;
+    const float *t00 = map + (x0 + y0 * size) * 4;
+    const float *t10 = map + (x1 + y0 * size) * 4;
+    const float *t01 = map + (x0 + y1 * size) * 4;
+    const float *t11 = map + (x1 + y1 * size) * 4;
+#ifdef QPBR_SSE
+    __m128 wx = _mm_set1_ps(fx), wy = _mm_set1_ps(fy);
+    __m128 a = _mm_loadu_ps(t00), b = _mm_loadu_ps(t10);
+    __m128 c = _mm_loadu_ps(t01), e = _mm_loadu_ps(t11);
+    __m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), wx));
+    __m128 bot = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(e, c), wx));
+    _mm_storeu_ps(out, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bot, top), wy)));
+#else
+    for (int i = 0; i < 4; i ++)
+    {
+        float top = t00[i] + (t10[i] - t00[i]) * fx;
+        float bot = t01[i] + (t11[i] - t01[i]) * fx;
+        out[i] = top + (bot - top) * fy;
+    }
+#endif
+}
+
+// ==================
+// Precomputation, load time only
+// ==================
+
+float radical_inverse(uint32_t bits)
+{
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+    bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+    bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+    bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+    return bits * 2.3283064365386963e-10f;
+}
+
+// GGX distributed half vector around n, alpha = roughness^2
+vec3_t importance_sample_ggx(float xi1, float xi2, vec3_t n, float alpha)
+{
+    float phi = 2.0f * (float)PI * xi1;
+    float cos_t = sqrtf((1.0f - xi2) / (1.0f + (alpha * alpha - 1.0f) * xi2));
+    float sin_t = sqrtf(1.0f - cos_t * cos_t);
+    vec3_t up = fabsf(n.z) < 0.999f
+        ? (vec3_t){ 0.0f, 0.0f, 1.0f } : (vec3_t){ 1.0f, 0.0f, 0.0f };
+    vec3_t tx = vec3_normalize(vec3_cross(up, n));
+    vec3_t ty = vec3_cross(n, tx);
+    vec3_t h = vec3_add(vec3_mul(tx, sin_t * cosf(phi)),
+        vec3_mul(ty, sin_t * sinf(phi)));
+    return vec3_normalize(vec3_add(h, vec3_mul(n, cos_t)));
+}
+
+float ggx_d(float n_dot_h, float alpha)
+{
+    float a2 = alpha * alpha;
+    float d = n_dot_h * n_dot_h * (a2 - 1.0f) + 1.0f;
+    return a2 / ((float)PI * d * d);
+}
+
+// GGX prefiltered environment with n = v = r. The samples read a box
+// filtered chain of the source, the blurrier the less likely they are,
+// so a small bright sun doesn't sparkle.
+void prefilter_level(float *dst, int size, float roughness, float **chain,
+                     int n_chain)
+{
+    float alpha = roughness * roughness;
+    float texel_sa = 4.0f * (float)PI / (PBR_ENV_SIZE * PBR_ENV_SIZE);
+
+    for (int y = 0; y < size; y ++)
+    {
+        for (int x = 0; x < size; x ++)
+        {
+            vec3_t n = oct_decode((x + 0.5f) / size, (y + 0.5f) / size);
+            float sum[3] = { 0.0f, 0.0f, 0.0f }, weight = 0.0f;
+            for (int s = 0; s < PBR_PREFILTER_SAMPLES; s ++)
+            {
+                vec3_t h = importance_sample_ggx(
+                    (float)s / PBR_PREFILTER_SAMPLES, radical_inverse(s),
+                    n, alpha);
+                float n_dot_h = vec3_dot(n, h);
+                vec3_t l = vec3_sub(vec3_mul(h, 2.0f * n_dot_h), n);
+                float n_dot_l = vec3_dot(n, l);
+                if (n_dot_l <= 0.0f) continue;
+
+                // pdf of l is D / 4 with n = v
+                float pdf = ggx_d(n_dot_h, alpha) * 0.25f;
+                float sample_sa = 1.0f / (PBR_PREFILTER_SAMPLES * pdf);
+                float mip = 0.5f * log2f(sample_sa / texel_sa);
+                int m = mip < 0.0f ? 0 : (int)(mip + 0.5f);
+                m = m < n_chain - 1 ? m : n_chain - 1;
+
+                float c[4];
+                oct_sample(chain[m], PBR_ENV_SIZE >> m, l, c);
+                for (int i = 0; i < 3; i ++) sum[i] += c[i] * n_dot_l;
+                weight += n_dot_l;
+            }
+            float *t = dst + (x + y * size) * 4;
+            for (int i = 0; i < 3; i ++) t[i] = sum[i] / weight;
+            t[3] = 1.0f;
+        }
+    }
+}
+
+// split-sum scale and bias of F0, Karis 2013
+void build_brdf_lut(pbr_env_t *env)
+{
+    vec3_t n = { 0.0f, 0.0f, 1.0f };
+    for (int j = 0; j < PBR_LUT_SIZE; j ++)
+    {
+        float roughness = (j + 0.5f) / PBR_LUT_SIZE;
+        float alpha = roughness * roughness;
+        float k = alpha * 0.5f;
+        for (int i = 0; i < PBR_LUT_SIZE; i ++)
+        {
+            float n_dot_v = (i + 0.5f) / PBR_LUT_SIZE;
+            vec3_t v = { sqrtf(1.0f - n_dot_v * n_dot_v), 0.0f, n_dot_v };
+            float a = 0.0f, b = 0.0f;
+            for (int s = 0; s < PBR_LUT_SAMPLES; s ++)
+            {
+                vec3_t h = importance_sample_ggx((float)s / PBR_LUT_SAMPLES,
+                    radical_inverse(s), n, alpha);
+                float v_dot_h = vec3_dot(v, h);
+                vec3_t l = vec3_sub(vec3_mul(h, 2.0f * v_dot_h), v);
+                float n_dot_l = l.z, n_dot_h = h.z;
+                if (n_dot_l <= 0.0f) continue;
+
+                float g = n_dot_v / (n_dot_v * (1.0f - k) + k)
+                    * n_dot_l / (n_dot_l * (1.0f - k) + k);
+                float g_vis = g * v_dot_h / (n_dot_h * n_dot_v);
+                float fc = powf(1.0f - v_dot_h, 5.0f);
+                a += (1.0f - fc) * g_vis;
+                b += fc * g_vis;
+            }
+            env->lut[i + j * PBR_LUT_SIZE][0] = a / PBR_LUT_SAMPLES;
+            env->lut[i + j * PBR_LUT_SIZE][1] = b / PBR_LUT_SAMPLES;
+        }
+    }
+}
+
+// projects the source onto SH and convolves with the cosine lobe
+void build_sh(pbr_env_t *env, const float *source)
+{
+    // basis constants, they appear once projecting and once evaluating
+    const float k[9] = {
+        0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f,
+        0.315392f, 1.092548f, 0.546274f
+    };
+    // the cosine lobe per band, over pi
+    const float band[9] = {
+        1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f,
+        0.25f, 0.25f, 0.25f, 0.25f, 0.25f
+    };
+    float golden = (float)PI * (3.0f - sqrtf(5.0f));
+    memset(env->sh, 0, sizeof(env->sh));
+
+    // Fibonacci sphere, every direction covers the same solid angle
+    for (int s = 0; s < PBR_SH_SAMPLES; s ++)
+    {
+        float z = 1.0f - (2.0f * s + 1.0f) / PBR_SH_SAMPLES;
+        float r = sqrtf(1.0f - z * z);
+        vec3_t d = { r * cosf(golden * s), r * sinf(golden * s), z };
+        float c[4], y[9];
+        oct_sample(source, PBR_ENV_SIZE, d, c);
+        y[0] = 1.0f;
+        y[1] = d.y;
+        y[2] = d.z;
+        y[3] = d.x;
+        y[4] = d.x * d.y;
+        y[5] = d.y * d.z;
+        y[6] = 3.0f * d.z * d.z - 1.0f;
+        y[7] = d.x * d.z;
+        y[8] = d.x * d.x - d.y * d.y;
+        for (int i = 0; i < 9; i ++)
+        {
+            for (int ch = 0; ch < 3; ch ++) env->sh[i][ch] += c[ch] * y[i];
+        }
+    }
+    float w = 4.0f * (float)PI / PBR_SH_SAMPLES;
+    for (int i = 0; i < 9; i ++)
+    {
+        for (int ch = 0; ch < 3; ch ++)
+        {
+            env->sh[i][ch] *= w * k[i] * k[i] * band[i];
+        }
+        env->sh[i][3] = 0.0f;
+    }
+}
+
+int pbr_env_build(pbr_env_t *env, radiance_fn_t radiance, void *user)
+{
+    float *chain[PBR_ENV_LEVELS + 8];
+    int n_chain = 0;
+
+    memset(env, 0, sizeof(pbr_env_t));
+    for (int l = 0; l < PBR_ENV_LEVELS; l ++)
+    {
+        int size = PBR_ENV_SIZE >> l;
+        env->levels[l] = malloc((size_t)size * size * 4 * sizeof(float));
+        if (env->levels[l] == NULL)
+        {
+            pbr_env_destroy(env);
+            return -1;
+        }
+    }
+
+    // the source, then box filtered down to 1 texel for the prefilter
+    for (int size = PBR_ENV_SIZE; size >= 1; size >>= 1)
+    {
+        float *map = malloc((size_t)size * size * 4 * sizeof(float));
+        for (int y = 0; y < size; y ++)
+        {
+            for (int x = 0; x < size; x ++)
+            {
+                float *t = map + (x + y * size) * 4;
+                if (n_chain == 0)
+                {
+                    vec3_t c = radiance(user,
+                        oct_decode((x + 0.5f) / size, (y + 0.5f) / size));
+                    t[0] = c.x;
+                    t[1] = c.y;
+                    t[2] = c.z;
+                    t[3] = 1.0f;
+                    continue;
+                }
+                const float *p = chain[n_chain - 1];
+                int ps = size * 2;
+                for (int i = 0; i < 4; i ++)
+                {
+                    t[i] = 0.25f * (p[(2 * x + 2 * y * ps) * 4 + i]
+                        + p[(2 * x + 1 + 2 * y * ps) * 4 + i]
+                        + p[(2 * x + (2 * y + 1) * ps) * 4 + i]
+                        + p[(2 * x + 1 + (2 * y + 1) * ps) * 4 + i]);
+                }
+            }
+        }
+        chain[n_chain ++] = map;
+    }
+
+    memcpy(env->levels[0], chain[0],
+        (size_t)PBR_ENV_SIZE * PBR_ENV_SIZE * 4 * sizeof(float));
+    for (int l = 1; l < PBR_ENV_LEVELS; l ++)
+    {
+        prefilter_level(env->levels[l], PBR_ENV_SIZE >> l,
+            (float)l / (PBR_ENV_LEVELS - 1), chain, n_chain);
+    }
+    build_sh(env, chain[0]);
+    build_brdf_lut(env);
+
+    for (int i = 0; i < n_chain; i ++) free(chain[i]);
+    return 0;
+}
+
+void pbr_env_destroy(pbr_env_t *env)
+{
+    for (int l = 0; l < PBR_ENV_LEVELS; l ++)
+    {
+        free(env->levels[l]);
+        env->levels[l] = NULL;
+    }
+}
+
+vec3_t pbr_sky_radiance(void *user, vec3_t dir)
+{
+    vec3_t sun = user != NULL ? vec3_normalize(*(vec3_t *)user)
+        : (vec3_t){ 0.0f, 1.0f, 0.0f };
+    vec3_t c;
+    if (dir.y >= 0.0f)
+    {
+        float t = dir.y;
+        c = vec3_add(vec3_mul((vec3_t){ 0.9f, 0.9f, 0.85f }, 1.0f - t),
+            vec3_mul((vec3_t){ 0.25f, 0.45f, 0.9f }, t));
+    }
+    else
+    {
+        float t = clip_float(-dir.y * 4.0f, 0.0f, 1.0f);
+        c = vec3_add(vec3_mul((vec3_t){ 0.5f, 0.45f, 0.4f }, 1.0f - t),
+            vec3_mul((vec3_t){ 0.25f, 0.2f, 0.15f }, t));
+    }
+    if (vec3_dot(dir, sun) > PBR_SUN_COS)
+    {
+        c = vec3_add(c, (vec3_t){ 40.0f, 38.0f, 34.0f });
+    }
+    return c;
+}
+
+// ==================
+// Shading, per fragment
+// ==================
+
+vec3_t pbr_sample_env(const pbr_env_t *env, vec3_t dir, float roughness)
+{
+    float lod = clip_float(roughness, 0.0f, 1.0f) * (PBR_ENV_LEVELS - 1);
+    int l0 = (int)lod;
+    int l1 = l0 + 1 < PBR_ENV_LEVELS ? l0 + 1 : l0;
+    float f = lod - l0;
+    float a[4], b[4];
+    oct_sample(env->levels[l0], PBR_ENV_SIZE >> l0, dir, a);
+    oct_sample(env->levels[l1], PBR_ENV_SIZE >> l1, dir, b);
+    return (vec3_t){ a[0] + (b[0] - a[0]) * f, a[1] + (b[1] - a[1]) * f,
+        a[2] + (b[2] - a[2]) * f };
+}
+
+vec3_t pbr_irradiance(const pbr_env_t *env, vec3_t n)
+{
+    float y[9] = {
+        1.0f, n.y, n.z, n.x, n.x * n.y, n.y * n.z,
+        3.0f * n.z * n.z - 1.0f, n.x * n.z, n.x * n.x - n.y * n.y
+    };
+#ifdef QPBR_SSE
+    __m128 acc = _mm_setzero_ps();
+    for (int i = 0; i < 9; i ++)
+    {
+        acc = _mm_add_ps(acc,
+            _mm_mul_ps(_mm_loadu_ps(env->sh[i]), _mm_set1_ps(y[i])));
+    }
+    float out[4];
+    _mm_storeu_ps(out, _mm_max_ps(acc, _mm_setzero_ps()));
+    return (vec3_t){ out[0], out[1], out[2] };
+#else
+    float out[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 9; i ++)
+    {
+        for (int ch = 0; ch < 3; ch ++) out[ch] += env->sh[i][ch] * y[i];
+    }
+    return (vec3_t){ out[0] > 0.0f ? out[0] : 0.0f,
+        out[1] > 0.0f ? out[1] : 0.0f, out[2] > 0.0f ? out[2] : 0.0f };
+#endif
+}
+
+// bilinear split-sum terms
+void brdf_lut(const pbr_env_t *env, float n_dot_v, float roughness,
+              float *a, float *b)
+{
+    float tx = n_dot_v * PBR_LUT_SIZE - 0.5f;
+    float ty = roughness * PBR_LUT_SIZE - 0.5f;
+    tx = clip_float(tx, 0.0f, PBR_LUT_SIZE - 1);
+    ty = clip_float(ty, 0.0f, PBR_LUT_SIZE - 1);
+    int x0 = (int)tx, y0 = (int)ty;
+    int x1 = x0 + 1 < PBR_LUT_SIZE ? x0 + 1 : x0;
+    int y1 = y0 + 1 < PBR_LUT_SIZE ? y0 + 1 : y0;
+    float fx = tx - x0, fy = ty - y0;
+    const float *t00 = env->lut[x0 + y0 * PBR_LUT_SIZE];
+    const float *t10 = env->lut[x1 + y0 * PBR_LUT_SIZE];
+    const float *t01 = env->lut[x0 + y1 * PBR_LUT_SIZE];
+    const float *t11 = env->lut[x1 + y1 * PBR_LUT_SIZE];
+    float ab[2];
+    for (int i = 0; i < 2; i ++)
+    {
+        float top = t00[i] + (t10[i] - t00[i]) * fx;
+        float bot = t01[i] + (t11[i] - t01[i]) * fx;
+        ab[i] = top + (bot - top) * fy;
+    }
+    *a = ab[0];
+    *b = ab[1];
+}
+
+vec3_t pbr_shade(const pbr_env_t *env, const pbr_material_t *m, vec3_t n,
+                 vec3_t v, vec3_t l, vec3_t light)
+{
+    float rough = m->roughness > PBR_MIN_ROUGHNESS
+        ? m->roughness : PBR_MIN_ROUGHNESS;
+    float alpha = rough * rough;
+    float n_dot_v = vec3_dot(n, v);
+    float n_dot_l = vec3_dot(n, l);
+    n_dot_v = n_dot_v > 1e-4f ? n_dot_v : 1e-4f;
+
+    // F0 is 4% for dielectrics, the albedo for metals
+    float f0[3] = {
+        0.04f + (m->albedo.x - 0.04f) * m->metallic,
+        0.04f + (m->albedo.y - 0.04f) * m->metallic,
+        0.04f + (m->albedo.z - 0.04f) * m->metallic
+    };
+    float kd = 1.0f - m->metallic;
+    float c[3] = { 0.0f, 0.0f, 0.0f };
+
+    if (n_dot_l > 0.0f)
+    {
+        // n.h and l.h from |l + v|, the only square root
+        float l_dot_v = vec3_dot(l, v);
+        float inv_len = rsqrt(2.0f + 2.0f * l_dot_v + 1e-6f);
+        float n_dot_h = clip_float((n_dot_l + n_dot_v) * inv_len, 0.0f, 1.0f);
+        float l_dot_h = clip_float((1.0f + l_dot_v) * inv_len, 0.0f, 1.0f);
+
+        float d = ggx_d(n_dot_h, alpha);
+        // height correlated Smith, Hammon's approximation
+        float vis = 0.5f / (2.0f * n_dot_l * n_dot_v * (1.0f - alpha)
+            + (n_dot_l + n_dot_v) * alpha);
+        float fc = 1.0f - l_dot_h, fc2 = fc * fc;
+        fc = fc2 * fc2 * fc;
+        float albedo[3] = { m->albedo.x, m->albedo.y, m->albedo.z };
+        float lc[3] = { light.x, light.y, light.z };
+        for (int i = 0; i < 3; i ++)
+        {
+            float f = f0[i] + (1.0f - f0[i]) * fc;
+            float diffuse = kd * albedo[i] * (1.0f - f) * (1.0f / (float)PI);
+            c[i] += (diffuse + d * vis * f) * lc[i] * n_dot_l;
+        }
+    }
+
+    if (env != NULL)
+    {
+        float a, b;
+        vec3_t r = vec3_sub(vec3_mul(n, 2.0f * n_dot_v), v);
+        vec3_t pre = pbr_sample_env(env, r, rough);
+        vec3_t irr = pbr_irradiance(env, n);
+        brdf_lut(env, n_dot_v, rough, &a, &b);
+        float p[3] = { pre.x, pre.y, pre.z }, e[3] = { irr.x, irr.y, irr.z };
+        float albedo[3] = { m->albedo.x, m->albedo.y, m->albedo.z };
+        for (int i = 0; i < 3; i ++)
+        {
+            float spec = f0[i] * a + b;
+            c[i] += (kd * albedo[i] * (1.0f - spec) * e[i] + p[i] * spec)
+                * m->ao;
+        }
+    }
+    return (vec3_t){ c[0], c[1], c[2] };
+}
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+#include "qpipe.h"
+
+// render thread, executes snapshots in submit order until told to quit
+static void render_loop(void *arg)
+{
+    frame_pipeline_t *p = (frame_pipeline_t *)arg;
+
+    mutex_lock(&p->lock);
+    while (1)
+    {
+        while (p->completed == p->submitted && !p->quit)
+        {
+            cond_wait(&p->cond, &p->lock);
+        }
+        if (p->completed == p->submitted) break;
+        frame_snapshot_t *frame =
+            &p->snapshots[p->completed % p->n_snapshots];
+        mutex_unlock(&p->lock);
+
+        p->device->m_project = frame->m_project;
+        p->device->m_camera = frame->m_camera;
+        p->render(p->user, p->device, frame);
+
+        mutex_lock(&p->lock);
+        p->completed ++;
+        cond_broadcast(&p->cond);
+    }
+    mutex_unlock(&p->lock);
+}
+
+
+int pipeline_init(frame_pipeline_t *p, int latency, device_t *device,
+                  frame_render_fn_t render, void *user)
+{
+    memset(p, 0, sizeof(frame_pipeline_t));
+    if (latency < 1 || latency > PIPELINE_MAX_LATENCY) return -1;
+    p->latency = latency;
+    p->n_snapshots = latency + 1;
+    p->device = device;
+    p->render = render;
+    p->user = user;
+
+    // recording only reads the view and the LOD budget
+    p->front.width = device->width;
+    p->front.height = device->height;
+    p->front.lod_error = device->lod_error;
+
+    mutex_init(&p->lock);
+    cond_init(&p->cond);
+    if (thread_create(&p->thread, &render_loop, p) != 0)
+    {
+        mutex_destroy(&p->lock);
+        cond_destroy(&p->cond);
+        return -1;
+    }
+    return 0;
+}
+
+
+void pipeline_destroy(frame_pipeline_t *p)
+{
+    mutex_lock(&p->lock);
+    p->quit = 1;
+    cond_broadcast(&p->cond);
+    mutex_unlock(&p->lock);
+    thread_join(&p->thread);
+
+    mutex_destroy(&p->lock);
+    cond_destroy(&p->cond);
+    for (int i = 0; i < p->n_snapshots; i ++)
+    {
+        draw_list_free(&p->snapshots[i].draws);
+        free(p->snapshots[i].lights);
+    }
+}
+
+
+frame_snapshot_t *pipeline_begin_frame(frame_pipeline_t *p)
+{
+    mutex_lock(&p->lock);
+    // the slot is free once at most latency frames are ahead of it
+    while (p->submitted - p->completed > (uint64_t)p->latency)
+    {
+        cond_wait(&p->cond, &p->lock);
+    }
+    frame_snapshot_t *frame = &p->snapshots[p->submitted % p->n_snapshots];
+    mutex_unlock(&p->lock);
+    return frame;
+}
+
+
+void pipeline_record(frame_pipeline_t *p, frame_snapshot_t *frame,
+                     scene_t *scene)
+{
+    p->front.m_project = frame->m_project;
+    p->front.m_camera = frame->m_camera;
+    draw_list_record(&p->front, &frame->draws, scene);
+
+    if (scene->n_lights > frame->light_capacity)
+    {
+        point_light_t *lights = realloc(frame->lights,
+            scene->n_lights * sizeof(point_light_t));
+        if (lights == NULL)
+        {
+            frame->n_lights = 0;
+            return;
+        }
+        frame->lights = lights;
+        frame->light_capacity = scene->n_lights;
+    }
+    if (scene->n_lights > 0)
+    {
+        memcpy(frame->lights, scene->lights,
+            scene->n_lights * sizeof(point_light_t));
+    }
+    frame->n_lights = scene->n_lights;
+}
+
+
+uint64_t pipeline_submit(frame_pipeline_t *p, frame_snapshot_t *frame)
+{
+    mutex_lock(&p->lock);
+    frame->frame = ++ p->submitted;
+    cond_broadcast(&p->cond);
+    mutex_unlock(&p->lock);
+    return frame->frame;
+}
+
+
+void pipeline_wait_frame(frame_pipeline_t *p, uint64_t frame)
+{
+    mutex_lock(&p->lock);
+    while (p->completed < frame)
+    {
+        cond_wait(&p->cond, &p->lock);
+    }
+    mutex_unlock(&p->lock);
+}
+
+
+void pipeline_wait_idle(frame_pipeline_t *p)
+{
+    mutex_lock(&p->lock);
+    uint64_t frame = p->submitted;
+    mutex_unlock(&p->lock);
+    pipeline_wait_frame(p, frame);
+}
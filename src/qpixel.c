@@ -1,9 +1,39 @@
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#include <float.h>
+#include <string.h>
 #include "qpixel.h"
 
+// SSE2 for the per sample depth test of MSAA
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QPIXEL_SSE
+#include <emmintrin.h>
+#endif
+
 #define EPS 1e-6
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+#define EDGE_CLAMP (1 << 30)    // of 32 bit edge values, see clamp_edge
+#define SCENE_UPDATE_BATCH 64
+#define INSTANCE_BATCH 64
+#define DRAW_DEPTH_BUCKETS 16
+#define MSAA_PAD 6          // farthest sample from a pixel center, subpixels
+
+// rotated grid, subpixel offsets from the pixel center
+static const int msaa_offset[MSAA_SAMPLES][2] = {
+    { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 }
+};
+
+#ifdef QPIXEL_SSE
+// all ones in the lanes of the set bits of the index
+#define L(m) { -((m) & 1), -((m) >> 1 & 1), -((m) >> 2 & 1), -((m) >> 3 & 1) }
+static const int32_t msaa_lanes[16][4] = {
+    L(0), L(1), L(2), L(3), L(4), L(5), L(6), L(7),
+    L(8), L(9), L(10), L(11), L(12), L(13), L(14), L(15)
+};
+#undef L
+#endif
 
 // ================================
 // MATH
@@ -83,6 +113,47 @@ vec4_t get_homogeneous_normal_from_projection(
     return (vec4_t){ a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w };
 }
 
+/**
+ * @brief Get the frustum planes from a model-view-projection matrix. Planes
+ *      are in the space m is applied to, normalized and pointing inside.
+ * 
+ * @param m         The matrix
+ * @param planes    Output planes (6): left, right, bottom, top, near, far
+ */
+void get_frustum_planes(mat4_t *m, vec4_t *planes)
+{
+    for (int i = 0; i < 3; i ++)
+    {
+        for (int s = 0; s < 2; s ++)
+        {
+            float f = s ? -1.0f : 1.0f;
+            vec4_t p = (vec4_t){
+                m->m[3][0] + f * m->m[i][0], m->m[3][1] + f * m->m[i][1],
+                m->m[3][2] + f * m->m[i][2], m->m[3][3] + f * m->m[i][3] };
+            float len = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+            planes[i * 2 + s] = len > 0.0f ? vec4_mul(p, 1.0f / len) : p;
+        }
+    }
+}
+
+/**
+ * @brief Judges if a sphere intersects the frustum
+ * 
+ * @param planes    Normalized frustum planes (6)
+ * @param c         Center
+ * @param r         Radius
+ * @return int      0 if the sphere is completely outside
+ */
+int sphere_in_frustum(vec4_t *planes, vec3_t c, float r)
+{
+    for (int i = 0; i < 6; i ++)
+    {
+        vec4_t *p = &planes[i];
+        if (p->x * c.x + p->y * c.y + p->z * c.z + p->w < -r) return 0;
+    }
+    return 1;
+}
+
 // =====================================================
 // RENDER
 // =====================================================
@@ -96,18 +167,26 @@ typedef struct
     size_t vary_size;
 } vertex_t;
 
+/**
+ * @brief Screen space triangles of a batch in SoA layout, indexed by
+ *      [corner][triangle]. Varyings are premultiplied by 1/w.
+ */
 typedef struct
 {
-    vertex_t *tl, *tr;
-    vertex_t *bl, *br;
-} trapezoid_t;
-
-typedef struct
-{
-    float l, r, y;
-    vertex_t *p;
-    vertex_t *step;
-} scanline_t;
+    int     n;
+    float   x[3][TRIANGLE_BATCH];
+    float   y[3][TRIANGLE_BATCH];
+    float   w[3][TRIANGLE_BATCH];       // 1/w
+    float   *vary[3][TRIANGLE_BATCH];
+    int32_t fx[3][TRIANGLE_BATCH];      // snapped to 1/SUBPIXEL_ONE pixel
+    int32_t fy[3][TRIANGLE_BATCH];
+    int64_t area[TRIANGLE_BATCH];       // twice the signed area, snapped
+    int     min_x[TRIANGLE_BATCH];      // samples to visit, inclusive
+    int     min_y[TRIANGLE_BATCH];
+    int     max_x[TRIANGLE_BATCH];
+    int     max_y[TRIANGLE_BATCH];
+    int     alive[TRIANGLE_BATCH];      // in: to be set up, out: to raster
+} triangle_batch_t;
 
 // free a vertex
 void vertex_destroy(vertex_t *v)
@@ -174,7 +253,7 @@ void vertex_add(vertex_t *a, vertex_t *b)
     a->ps.x += b->ps.x;
     a->ps.y += b->ps.y;
     a->w += b->w;
-    for (int i = 0; i < a->vary_size; i++)
+    for (size_t i = 0; i < a->vary_size; i++)
     {
         a->vary[i] += b->vary[i];
     }
@@ -190,7 +269,7 @@ void vertex_sub(vertex_t *a, vertex_t *b)
     a->ps.x -= b->ps.x;
     a->ps.y -= b->ps.y;
     a->w -= b->w;
-    for (int i = 0; i < a->vary_size; i++)
+    for (size_t i = 0; i < a->vary_size; i++)
     {
         a->vary[i] -= b->vary[i];
     }
@@ -206,7 +285,7 @@ void vertex_mul(vertex_t *a, float b)
     a->ps.x *= b;
     a->ps.y *= b;
     a->w *= b;
-    for (int i = 0; i < a->vary_size; i++)
+    for (size_t i = 0; i < a->vary_size; i++)
     {
         a->vary[i] *= b;
     }
@@ -232,13 +311,6 @@ vertex_t *vertex_lerp(vertex_t *a, vertex_t *b, float r)
     return res;
 }
 
-void swap_ptrs(void **p1, void **p2)
-{
-    void *t = *p1;
-    *p1 = *p2;
-    *p2 = t;
-}
-
 unsigned char float_to_int(float x)
 {
     x = clip_float(x, 0.0f, 1.0f);
@@ -255,18 +327,63 @@ void fill_buffer(device_t *device, int x, int y, color3_t * color, float depth)
     device->depthBuffer[x + y * device->width] = depth;
 }
 
-/**
- * @brief Given 3 vertices, caculate the cross prod of a->b and a->c
- * 
- * @param v     Vertices (3)
- * @return int  Whether the prod is > 0
- */
-int face_side(vec2_t *v)
+// color of the samples in mask, the depth was written by the raster
+void fill_samples(device_t *device, int x, int y, color3_t *color,
+                  uint32_t mask)
+{
+    uint32_t i = x + (device->height - y - 1) * device->width;
+    uint8_t *ptr = device->msaa_color + i * MSAA_SAMPLES * 4;
+    uint8_t b = float_to_int(color->b);
+    uint8_t g = float_to_int(color->g);
+    uint8_t r = float_to_int(color->r);
+    for (int s = 0; s < MSAA_SAMPLES; s ++, ptr += 4)
+    {
+        if (!(mask & (1u << s))) continue;
+        ptr[0] = b;
+        ptr[1] = g;
+        ptr[2] = r;
+    }
+}
+
+// color of the covered pixels of a coarse shading block
+void fill_block(device_t *device, uint8_t *buffer, fragment_t *frag,
+                color3_t *color)
+{
+    uint8_t b = float_to_int(color->b);
+    uint8_t g = float_to_int(color->g);
+    uint8_t r = float_to_int(color->r);
+    for (int py = 0; py < frag->block; py ++)
+    {
+        uint8_t *ptr = buffer
+            + ((frag->y + py) * device->width + frag->x) * 4;
+        for (int px = 0; px < frag->block; px ++, ptr += 4)
+        {
+            if (!(frag->mask & (1u << (py * frag->block + px)))) continue;
+            ptr[0] = b;
+            ptr[1] = g;
+            ptr[2] = r;
+        }
+    }
+}
+
+// the colors fs wrote to mrt_out, into the other attachments of the target
+void fill_attachments(device_t *device, fragment_t *frag)
 {
-    vec3_t x = (vec3_t){v[1].x - v[0].x, v[1].y - v[0].y, 0.0f};
-    vec3_t y = (vec3_t){v[2].x - v[0].x, v[2].y - v[0].y, 0.0f};
-    vec3_t c = vec3_cross(x, y);
-    return c.z < 0.0f;
+    render_target_t *rt = device->target;
+    for (int i = 1; i < rt->n_colors; i ++)
+    {
+        color3_t *color = &device->mrt_out[i - 1];
+        if (frag->block > 0)
+        {
+            fill_block(device, rt->colors[i], frag, color);
+            continue;
+        }
+        int y = device->height - frag->y - 1;
+        uint8_t *ptr = rt->colors[i] + (frag->x + y * device->width) * 4;
+        ptr[0] = float_to_int(color->b);
+        ptr[1] = float_to_int(color->g);
+        ptr[2] = float_to_int(color->r);
+    }
 }
 
 int depth_test(device_t *device, int x, int y, float depth)
@@ -277,6 +394,32 @@ int depth_test(device_t *device, int x, int y, float depth)
 }
 
 
+// counts a depth tested sample for the pixel views
+void count_heat(device_t *device, int x, int y, int pass)
+{
+    uint32_t i = x + (device->height - y - 1) * device->width;
+    if (device->debug_view == DEBUG_VIEW_TESTED
+     || (device->debug_view == DEBUG_VIEW_DEPTH_FAIL && !pass))
+    {
+        device->heat[i] ++;
+    }
+}
+
+// counts a triangle for every tile its bounds touch
+void count_heat_tiles(device_t *device, int min_x, int min_y,
+                      int max_x, int max_y)
+{
+    int tiles_x = (device->width + DEBUG_TILE - 1) / DEBUG_TILE;
+    for (int ty = min_y / DEBUG_TILE; ty <= max_y / DEBUG_TILE; ty ++)
+    {
+        for (int tx = min_x / DEBUG_TILE; tx <= max_x / DEBUG_TILE; tx ++)
+        {
+            device->heat[tx + ty * tiles_x] ++;
+        }
+    }
+}
+
+
 int homogeneous_clip_test(vec4_t v, cvv_type_t cvv_type)
 {
     int res = 0;
@@ -408,167 +551,666 @@ int homogeneous_clip(vertex_t *v, int n, cvv_type_t cvv_type)
     return m;
 }
 
-void rasterize_scanline(device_t *device, scanline_t *scanline)
+// returns the CVV planes v is outside of
+int cvv_outcode(float x, float y, float z, float w)
+{
+    return (x < -w ? CVV_LEFT : 0) | (x > w ? CVV_RIGHT : 0)
+         | (y < -w ? CVV_TOP : 0) | (y > w ? CVV_BOTTOM : 0)
+         | (z < -w ? CVV_FRONT : 0) | (z > w ? CVV_REAR : 0);
+}
+
+float *reserve_frag_vary(device_t *device)
+{
+    if (device->vary_size > device->frag_capacity)
+    {
+        device->frag_capacity = device->vary_size;
+        device->frag_vary = realloc(device->frag_vary,
+            device->frag_capacity * sizeof(float));
+    }
+    return device->frag_vary;
+}
+
+/**
+ * @brief Snaps the triangles marked alive, computes their area and sample
+ *      bounds, and rejects backfacing, zero-area and triangles that cover no
+ *      sample. Samples sit on integer screen coordinates.
+ * 
+ * @param device    Device handle
+ * @param b         The batch. alive is cleared for rejected triangles.
+ */
+void setup_triangles(device_t *device, triangle_batch_t *b)
+{
+    const float one = (float)SUBPIXEL_ONE;
+    int n = b->n;
+    // multisampled pixels are touched by samples off their center
+    int pad = device->msaa > 1 ? MSAA_PAD : 0;
+    uint64_t t0 = prof_begin(device->profiler);
+
+    for (int i = 0; i < 3; i ++)
+    {
+        for (int t = 0; t < n; t ++)
+        {
+            float x = b->alive[t] ? b->x[i][t] : 0.0f;
+            float y = b->alive[t] ? b->y[i][t] : 0.0f;
+            b->fx[i][t] = (int32_t)floorf(x * one + 0.5f);
+            b->fy[i][t] = (int32_t)floorf(y * one + 0.5f);
+        }
+    }
+    for (int t = 0; t < n; t ++)
+    {
+        int64_t x1 = b->fx[1][t] - b->fx[0][t], y1 = b->fy[1][t] - b->fy[0][t];
+        int64_t x2 = b->fx[2][t] - b->fx[0][t], y2 = b->fy[2][t] - b->fy[0][t];
+        b->area[t] = x1 * y2 - x2 * y1;
+    }
+    for (int t = 0; t < n; t ++)
+    {
+        int32_t x0 = b->fx[0][t], x1 = b->fx[1][t], x2 = b->fx[2][t];
+        int32_t y0 = b->fy[0][t], y1 = b->fy[1][t], y2 = b->fy[2][t];
+        int32_t lx = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+        int32_t hx = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+        int32_t ly = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+        int32_t hy = y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2);
+        int min_x = (lx - pad + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+        int min_y = (ly - pad + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+        int max_x = (hx + pad) >> SUBPIXEL_BITS;
+        int max_y = (hy + pad) >> SUBPIXEL_BITS;
+        b->min_x[t] = min_x > 0 ? min_x : 0;
+        b->min_y[t] = min_y > 0 ? min_y : 0;
+        b->max_x[t] = max_x < device->width - 1 ? max_x : device->width - 1;
+        b->max_y[t] = max_y < device->height - 1 ? max_y : device->height - 1;
+    }
+
+    for (int t = 0; t < n; t ++)
+    {
+        if (!b->alive[t]) continue;
+        b->alive[t] = 0;
+        if (b->area[t] < 0)
+        {
+            device->culled_backface ++;
+        }
+        else if (b->area[t] == 0)
+        {
+            device->culled_degenerate ++;
+        }
+        else if (b->min_x[t] > b->max_x[t] || b->min_y[t] > b->max_y[t])
+        {
+            device->culled_no_sample ++;
+        }
+        else
+        {
+            b->alive[t] = 1;
+        }
+    }
+    prof_end(device->profiler, PROF_SETUP, t0);
+}
+
+/**
+ * @brief Runs the fragment shader on device->fragments, all from triangle t
+ *      of the batch, and writes color and depth.
+ */
+void shade_fragments(device_t *device, triangle_batch_t *b, int t)
 {
-    float y = scanline->y;
-    float x = scanline->l;
-    int ix = (int)ceilf(x), iy = y, ir = (int)floorf(scanline->r);
-    vertex_t *v = vertex_split(scanline->p);
-    for (; ix <= ir; ix ++)
+    float *vary = reserve_frag_vary(device);
+    float *v0 = b->vary[0][t], *v1 = b->vary[1][t], *v2 = b->vary[2][t];
+    // a per vertex color needs only its own varyings
+    int n_vary = device->fs == &fs_vertex_color ? 3 : (int)device->vary_size;
+    int mrt = device->target != NULL && device->target->n_colors > 1;
+    uint64_t t0 = prof_begin(device->profiler);
+
+    for (uint32_t f = 0; f < device->n_fragments; f ++)
     {
+        fragment_t *frag = &device->fragments[f];
         color3_t color;
-        // Test boundary
-        int inBoundary = \
-            iy >= 0 && iy < device->height && ix >= 0 && ix < device->width;
-        if (inBoundary)
-        {
-            vertex_copy(v, scanline->p);
-            float z = 1.0f / v->w;
-            for (int i = 0; i < v->vary_size; i++)
-            {
-                v->vary[i] *= z;
-            }
-            // depth test
-            // assert(v->w >= 0.0f && v->w <= 1.0f);
-            if (depth_test(device, ix, iy, v->w))
-            {
-                device->texel_count ++;
-                device->fs(device, device->unif, v->vary, v->w, &color);
-                fill_buffer(device, ix, iy, &color, v->w);
-            }
+        float z = 1.0f / frag->w;
+        for (int i = 0; i < n_vary; i ++)
+        {
+            vary[i] = (frag->l0 * v0[i] + frag->l1 * v1[i]
+                + frag->l2 * v2[i]) * z;
+        }
+        device->fs(device, device->unif, vary, frag->w, &color);
+        if (mrt)
+        {
+            fill_attachments(device, frag);
+        }
+        if (frag->block > 0)
+        {
+            fill_block(device, device->colorBuffer, frag, &color);
+        }
+        else if (device->msaa > 1)
+        {
+            fill_samples(device, frag->x, frag->y, &color, frag->mask);
+        }
+        else
+        {
+            fill_buffer(device, frag->x, frag->y, &color, frag->w);
         }
+    }
+    if (device->debug_view == DEBUG_VIEW_SHADED)
+    {
+        for (uint32_t f = 0; f < device->n_fragments; f ++)
+        {
+            // a block counts on its first pixel
+            fragment_t *frag = &device->fragments[f];
+            int y = frag->block > 0 ? frag->y : device->height - frag->y - 1;
+            device->heat[frag->x + y * device->width] ++;
+        }
+    }
+    device->texel_count += device->n_fragments;
+    device->n_fragments = 0;
+    prof_end(device->profiler, PROF_SHADE, t0);
+}
 
-        vertex_add(scanline->p, scanline->step);
+// edge functions of triangle t, e >= 0 inside. Edge j -> k is opposite to
+// corner i, row[i] is its value at the pixel (min_x, min_y) and a[i], c[i]
+// step it one pixel in x and in y. With the top-left rule a sample exactly
+// on an edge belongs to one of the two triangles sharing it
+void setup_edges(triangle_batch_t *b, int t, int64_t a[3], int64_t c[3],
+                 int64_t row[3])
+{
+    int64_t sx = (int64_t)b->min_x[t] << SUBPIXEL_BITS;
+    int64_t sy = (int64_t)b->min_y[t] << SUBPIXEL_BITS;
+    for (int i = 0; i < 3; i ++)
+    {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        int64_t dx = b->fx[k][t] - b->fx[j][t];
+        int64_t dy = b->fy[k][t] - b->fy[j][t];
+        int64_t bias = (-dy > 0 || (dy == 0 && dx > 0)) ? 0 : -1;
+        row[i] = -dy * (sx - b->fx[j][t]) + dx * (sy - b->fy[j][t]) + bias;
+        a[i] = -dy * SUBPIXEL_ONE;
+        c[i] = dx * SUBPIXEL_ONE;
     }
-    vertex_destroy(v);
 }
 
-void rasterize_trapezoid(device_t *device, trapezoid_t *trap)
+/**
+ * @brief Rasterizes triangle t of a batch with edge functions. A sample on a
+ *      shared edge belongs to exactly one of the two triangles.
+ * 
+ * @param device    Device handle
+ * @param b         The batch, set up
+ * @param t         Triangle index
+ */
+void rasterize_triangle_msaa(device_t *device, triangle_batch_t *b, int t);
+void rasterize_triangle_coarse(device_t *device, triangle_batch_t *b, int t);
+void rasterize_triangle_color(device_t *device, triangle_batch_t *b, int t);
+
+void rasterize_triangle(device_t *device, triangle_batch_t *b, int t)
 {
-    float top = trap->tl->ps.y;
-    float bottom = trap->bl->ps.y;
-    float y = ceilf(top);
+    if (device->msaa > 1)
+    {
+        rasterize_triangle_msaa(device, b, t);
+        return;
+    }
+    if (device->shading_rate > 1 || device->rate_map != NULL)
+    {
+        rasterize_triangle_coarse(device, b, t);
+        return;
+    }
+    if (device->fs == &fs_vertex_color && device->heat == NULL)
+    {
+        rasterize_triangle_color(device, b, t);
+        return;
+    }
 
-    vertex_t *left = vertex_lerp(
-        trap->tl, trap->bl, (y - top) / (bottom - top));
-    vertex_t *right = vertex_lerp(
-        trap->tr, trap->br, (y - top) / (bottom - top));
-    vertex_t *left_step = vertex_split(trap->bl);
-    vertex_t *right_step = vertex_split(trap->br);
-    vertex_sub(left_step, trap->tl);
-    vertex_div(left_step, bottom - top);
-    vertex_sub(right_step, trap->tr);
-    vertex_div(right_step, bottom - top);
-    for (; y <= bottom; y += 1.0f)
+    int64_t a[3], c[3], row[3];
+    float inv_area = 1.0f / (float)b->area[t];
+    float w0 = b->w[0][t], w1 = b->w[1][t], w2 = b->w[2][t];
+    uint64_t t0 = prof_begin(device->profiler);
+
+    device->triangle_count ++;
+    if (device->debug_view == DEBUG_VIEW_TRIANGLES)
     {
-        float l = ceilf(left->ps.x);
-        vertex_t *begin = vertex_lerp(
-            left, right, (l - left->ps.x) / (right->ps.x - left->ps.x));
-        vertex_t *step = vertex_split(right);
-        vertex_sub(step, left);
-        vertex_div(step, right->ps.x - left->ps.x);
-        scanline_t scanline = (scanline_t){left->ps.x, right->ps.x, y, begin, step};
-        
-        rasterize_scanline(device, &scanline);
+        count_heat_tiles(device, b->min_x[t], device->height - 1 - b->max_y[t],
+            b->max_x[t], device->height - 1 - b->min_y[t]);
+    }
+    setup_edges(b, t, a, c, row);
 
-        vertex_add(left, left_step);
-        vertex_add(right, right_step);
-        vertex_destroy(step);
-        vertex_destroy(begin);
+    // coverage and depth test first, the survivors are shaded in batches
+    for (int iy = b->min_y[t]; iy <= b->max_y[t]; iy ++)
+    {
+        int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+        for (int ix = b->min_x[t]; ix <= b->max_x[t]; ix ++)
+        {
+            if ((e0 | e1 | e2) >= 0)
+            {
+                float l0 = e0 * inv_area, l1 = e1 * inv_area, l2 = e2 * inv_area;
+                float w = l0 * w0 + l1 * w1 + l2 * w2;
+                int pass = depth_test(device, ix, iy, w);
+                if (device->heat != NULL) count_heat(device, ix, iy, pass);
+                if (pass)
+                {
+                    device->fragments[device->n_fragments ++] =
+                        (fragment_t){ .x = ix, .y = iy, .l0 = l0, .l1 = l1,
+                        .l2 = l2, .w = w, .mask = 0, .block = 0 };
+                    if (device->n_fragments == FRAGMENT_BATCH)
+                    {
+                        prof_end(device->profiler, PROF_RASTER, t0);
+                        shade_fragments(device, b, t);
+                        t0 = prof_begin(device->profiler);
+                    }
+                }
+            }
+            e0 += a[0];
+            e1 += a[1];
+            e2 += a[2];
+        }
+        row[0] += c[0];
+        row[1] += c[1];
+        row[2] += c[2];
     }
+    prof_end(device->profiler, PROF_RASTER, t0);
+    if (device->n_fragments > 0) shade_fragments(device, b, t);
+}
 
-    vertex_destroy(left);
-    vertex_destroy(right);
-    vertex_destroy(left_step);
-    vertex_destroy(right_step);
+void fs_vertex_color(device_t *device, float *unif, float *vary, float w,
+                     color3_t *out)
+{
+    (void)device;
+    (void)unif;
+    (void)w;
+    memcpy(out, vary, sizeof(color3_t));
 }
 
-// split triangle to trapezoids and draw
-void split_and_rasterize_triangle(device_t *device,
-                                  vertex_t *_a,
-                                  vertex_t *_b,
-                                  vertex_t *_c
-                                  )
+/**
+ * @brief rasterize_triangle for fs_vertex_color: the color is interpolated
+ *      and written where the depth test passes, no fragments are queued.
+ *      Timed as raster, there is no shading left.
+ */
+void rasterize_triangle_color(device_t *device, triangle_batch_t *b, int t)
 {
-    device->triangle_count ++;
+    int64_t a[3], c[3], row[3];
+    float inv_area = 1.0f / (float)b->area[t];
+    float w0 = b->w[0][t], w1 = b->w[1][t], w2 = b->w[2][t];
+    float *v0 = b->vary[0][t], *v1 = b->vary[1][t], *v2 = b->vary[2][t];
+    uint32_t shaded = 0;
+    uint64_t t0 = prof_begin(device->profiler);
 
-    vertex_t *a = vertex_split(_a);
-    vertex_t *b = vertex_split(_b);
-    vertex_t *c = vertex_split(_c);
-    // y: a -> b -> c
-    if (a->ps.y > b->ps.y) swap_ptrs((void **)&a, (void **)&b);
-    if (a->ps.y > c->ps.y) swap_ptrs((void **)&a, (void **)&c);
-    if (b->ps.y > c->ps.y) swap_ptrs((void **)&b, (void **)&c);
+    device->triangle_count ++;
+    setup_edges(b, t, a, c, row);
 
-    // find the other point for trapezoid
-    vertex_t *d = vertex_lerp(a, c, (b->ps.y - a->ps.y) / (c->ps.y - a->ps.y));
-    if (b->ps.x > d->ps.x)
+    for (int iy = b->min_y[t]; iy <= b->max_y[t]; iy ++)
     {
-        swap_ptrs((void **)&b, (void **)&d);
+        int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+        for (int ix = b->min_x[t]; ix <= b->max_x[t]; ix ++)
+        {
+            if ((e0 | e1 | e2) >= 0)
+            {
+                float l0 = e0 * inv_area, l1 = e1 * inv_area, l2 = e2 * inv_area;
+                float w = l0 * w0 + l1 * w1 + l2 * w2;
+                if (depth_test(device, ix, iy, w))
+                {
+                    float z = 1.0f / w;
+                    color3_t color = {
+                        (l0 * v0[0] + l1 * v1[0] + l2 * v2[0]) * z,
+                        (l0 * v0[1] + l1 * v1[1] + l2 * v2[1]) * z,
+                        (l0 * v0[2] + l1 * v1[2] + l2 * v2[2]) * z };
+                    fill_buffer(device, ix, iy, &color, w);
+                    shaded ++;
+                }
+            }
+            e0 += a[0];
+            e1 += a[1];
+            e2 += a[2];
+        }
+        row[0] += c[0];
+        row[1] += c[1];
+        row[2] += c[2];
     }
-    trapezoid_t trap1 = (trapezoid_t){a, a, b, d};
-    trapezoid_t trap2 = (trapezoid_t){b, d, c, c};
-
-    rasterize_trapezoid(device, &trap1);
-    rasterize_trapezoid(device, &trap2);
+    device->texel_count += shaded;
+    prof_end(device->profiler, PROF_RASTER, t0);
+}
 
-    vertex_destroy(a);
-    vertex_destroy(b);
-    vertex_destroy(c);
-    vertex_destroy(d);
+#ifdef QPIXEL_SSE
+// an edge value narrowed to 32 bit, keeping the sign of e plus any sample
+// offset: beyond the clamp no offset can cross 0
+int32_t clamp_edge(int64_t e)
+{
+    return e < -EDGE_CLAMP ? -EDGE_CLAMP
+        : (e > EDGE_CLAMP ? EDGE_CLAMP : (int32_t)e);
 }
+#endif
 
-void draw_triangle(device_t *device)
+/**
+ * @brief rasterize_triangle with MSAA_SAMPLES samples per pixel. Coverage
+ *      is exact per sample; on pixels an edge crosses, the four samples
+ *      are tested against the three edges in one vector. 1 / w is linear in
+ *      screen space, so a sample's depth is the center's plus a per
+ *      triangle offset and the four are tested at once too. Depth is
+ *      written here, shading only adds color.
+ */
+void rasterize_triangle_msaa(device_t *device, triangle_batch_t *b, int t)
 {
-    vec3_t *v = device->vertex;
-    vec4_t vc[3];       // camera
-    vec4_t vndc[3];     // ndc
-    vec2_t vs[3];       // 2d
-    float  z[3];
-    float  w[3];
+    int64_t a[3], c[3], row[3], so[3][MSAA_SAMPLES];
+    int64_t so_min[3], so_max[3];
+    float inv_area = 1.0f / (float)b->area[t];
+    float w0 = b->w[0][t], w1 = b->w[1][t], w2 = b->w[2][t];
+    float dw[MSAA_SAMPLES];
+    uint64_t t0 = prof_begin(device->profiler);
+
+    device->triangle_count ++;
+    if (device->debug_view == DEBUG_VIEW_TRIANGLES)
+    {
+        count_heat_tiles(device, b->min_x[t], device->height - 1 - b->max_y[t],
+            b->max_x[t], device->height - 1 - b->min_y[t]);
+    }
+
+    setup_edges(b, t, a, c, row);
+    for (int i = 0; i < 3; i ++)
+    {
+        // offsets are in subpixels, a and c step whole pixels
+        int64_t ai = a[i] / SUBPIXEL_ONE, ci = c[i] / SUBPIXEL_ONE;
+        so_min[i] = so_max[i] = 0;
+        for (int s = 0; s < MSAA_SAMPLES; s ++)
+        {
+            so[i][s] = ai * msaa_offset[s][0] + ci * msaa_offset[s][1];
+            so_min[i] = so[i][s] < so_min[i] ? so[i][s] : so_min[i];
+            so_max[i] = so[i][s] > so_max[i] ? so[i][s] : so_max[i];
+        }
+    }
+    for (int s = 0; s < MSAA_SAMPLES; s ++)
+    {
+        dw[s] = (so[0][s] * w0 + so[1][s] * w1 + so[2][s] * w2) * inv_area;
+    }
+#ifdef QPIXEL_SSE
+    // sample offsets of each edge, 32 bit: they are at most 12 times an
+    // edge delta in subpixels, far below EDGE_CLAMP
+    __m128i so4[3];
+    for (int i = 0; i < 3; i ++)
+    {
+        so4[i] = _mm_setr_epi32((int32_t)so[i][0], (int32_t)so[i][1],
+            (int32_t)so[i][2], (int32_t)so[i][3]);
+    }
+#endif
 
-    // world -> camera
-    for (int i = 0; i < 3; i++)
+    for (int iy = b->min_y[t]; iy <= b->max_y[t]; iy ++)
     {
-        vc[i] = vec4_mat_mul(get_vec4(v[i]), &device->m_world);
+        int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+        float *depth = device->msaa_depth
+            + ((device->height - iy - 1) * device->width + b->min_x[t])
+            * MSAA_SAMPLES;
+        for (int ix = b->min_x[t]; ix <= b->max_x[t];
+             ix ++, depth += MSAA_SAMPLES)
+        {
+            // only pixels an edge passes through test every sample
+            uint32_t cover = 0;
+            if (((e0 + so_min[0]) | (e1 + so_min[1]) | (e2 + so_min[2])) >= 0)
+            {
+                cover = (1u << MSAA_SAMPLES) - 1;
+            }
+            else if (((e0 + so_max[0]) | (e1 + so_max[1])
+                | (e2 + so_max[2])) >= 0)
+            {
+#ifdef QPIXEL_SSE
+                // the four samples of the three edges at once, a sample is
+                // out if any of its edge values has the sign bit set
+                __m128i out = _mm_or_si128(_mm_or_si128(
+                    _mm_add_epi32(_mm_set1_epi32(clamp_edge(e0)), so4[0]),
+                    _mm_add_epi32(_mm_set1_epi32(clamp_edge(e1)), so4[1])),
+                    _mm_add_epi32(_mm_set1_epi32(clamp_edge(e2)), so4[2]));
+                cover = ~(uint32_t)_mm_movemask_ps(_mm_castsi128_ps(out))
+                    & ((1u << MSAA_SAMPLES) - 1);
+#else
+                for (int s = 0; s < MSAA_SAMPLES; s ++)
+                {
+                    int64_t inside = (e0 + so[0][s]) | (e1 + so[1][s])
+                        | (e2 + so[2][s]);
+                    cover |= (uint32_t)(inside >= 0) << s;
+                }
+#endif
+            }
+            if (cover != 0)
+            {
+                float wc = (e0 * w0 + e1 * w1 + e2 * w2) * inv_area;
+                uint32_t pass = 0;
+#ifdef QPIXEL_SSE
+                __m128 w = _mm_add_ps(_mm_set1_ps(wc), _mm_loadu_ps(dw));
+                __m128 old = _mm_loadu_ps(depth);
+                __m128 front = _mm_cmpgt_ps(w, old);
+                pass = cover & (uint32_t)_mm_movemask_ps(front);
+                __m128 keep = _mm_castsi128_ps(
+                    _mm_loadu_si128((const __m128i *)msaa_lanes[pass]));
+                _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(keep, w),
+                    _mm_andnot_ps(keep, old)));
+#else
+                for (int s = 0; s < MSAA_SAMPLES; s ++)
+                {
+                    float ws = wc + dw[s];
+                    if ((cover & (1u << s)) && ws > depth[s])
+                    {
+                        depth[s] = ws;
+                        pass |= 1u << s;
+                    }
+                }
+#endif
+                if (device->heat != NULL) count_heat(device, ix, iy, pass != 0);
+                if (pass)
+                {
+                    // shade at the center, or a covered sample if it is out
+                    int64_t f0 = e0, f1 = e1, f2 = e2;
+                    if ((e0 | e1 | e2) < 0)
+                    {
+                        int s = 0;
+                        while (!(cover & (1u << s))) s ++;
+                        f0 += so[0][s];
+                        f1 += so[1][s];
+                        f2 += so[2][s];
+                    }
+                    float l0 = f0 * inv_area, l1 = f1 * inv_area;
+                    float l2 = f2 * inv_area;
+                    device->fragments[device->n_fragments ++] = (fragment_t){
+                        .x = ix, .y = iy, .l0 = l0, .l1 = l1, .l2 = l2,
+                        .w = l0 * w0 + l1 * w1 + l2 * w2, .mask = pass,
+                        .block = 0 };
+                    if (device->n_fragments == FRAGMENT_BATCH)
+                    {
+                        prof_end(device->profiler, PROF_RASTER, t0);
+                        shade_fragments(device, b, t);
+                        t0 = prof_begin(device->profiler);
+                    }
+                }
+            }
+            e0 += a[0];
+            e1 += a[1];
+            e2 += a[2];
+        }
+        row[0] += c[0];
+        row[1] += c[1];
+        row[2] += c[2];
     }
+    prof_end(device->profiler, PROF_RASTER, t0);
+    if (device->n_fragments > 0) shade_fragments(device, b, t);
+}
 
-    // camera -> orth
-    for (int i = 0; i < 3; i++)
+/**
+ * @brief rasterize_triangle with coarse shading. Walks the shading tiles
+ *      the triangle touches in buffer rows, top first, and each tile in
+ *      blocks of its rate, so a block never straddles two tiles.
+ */
+void rasterize_triangle_coarse(device_t *device, triangle_batch_t *b, int t)
+{
+    int64_t a[3], c[3], row[3];
+    float inv_area = 1.0f / (float)b->area[t];
+    float w0 = b->w[0][t], w1 = b->w[1][t], w2 = b->w[2][t];
+    int min_x = b->min_x[t], max_x = b->max_x[t];
+    int min_y = b->min_y[t];
+    int h = device->height;
+    // the rate map is in tiles of the output size
+    int tiles_x = (device->out_width + SHADING_TILE - 1) / SHADING_TILE;
+    int top = h - 1 - b->max_y[t], bottom = h - 1 - min_y;
+    uint64_t t0 = prof_begin(device->profiler);
+
+    device->triangle_count ++;
+    if (device->debug_view == DEBUG_VIEW_TRIANGLES)
     {
-        vndc[i] = vec4_mat_mul(vc[i], &device->m_project);
-        z[i] = vndc[i].w;
-        w[i] = 1.0f / z[i];
-        vs[i].x = clip_float(vndc[i].x * 0.5f + 0.5f, 0, 1) * device->width;
-        vs[i].y = clip_float(vndc[i].y * 0.5f + 0.5f, 0, 1) * device->height;
+        count_heat_tiles(device, min_x, top, max_x, bottom);
     }
 
-    // memcpy(device->debug, vndc, 12 * sizeof(float));
-    // device->debug[0] = 100.0;
+    setup_edges(b, t, a, c, row);
 
-    // vertex shader
-    for (int i = 0; i < 3; i++)
+    for (int ty = top / SHADING_TILE; ty <= bottom / SHADING_TILE; ty ++)
     {
-        device->vs(device,
-                   device->unif,
-                   device->attr + i * device->attr_size,
-                   device->vary + i * device->vary_size
-                   );
+        for (int tx = min_x / SHADING_TILE; tx <= max_x / SHADING_TILE; tx ++)
+        {
+            int rate = device->shading_rate;
+            if (device->rate_map != NULL)
+            {
+                int mx = tx, my = ty;
+                if (device->width != device->out_width)
+                {
+                    int half = SHADING_TILE / 2;
+                    mx = (tx * SHADING_TILE + half) * device->out_width
+                        / (device->width * SHADING_TILE);
+                    my = (ty * SHADING_TILE + half) * device->out_height
+                        / (device->height * SHADING_TILE);
+                }
+                int r = device->rate_map[mx + my * tiles_x];
+                rate = r > rate ? r : rate;
+            }
+            // the part of the tile inside the bounds, buffer rows
+            int x0 = tx * SHADING_TILE, x1 = x0 + SHADING_TILE - 1;
+            int y0 = ty * SHADING_TILE, y1 = y0 + SHADING_TILE - 1;
+            x0 = x0 > min_x ? x0 : min_x;
+            x1 = x1 < max_x ? x1 : max_x;
+            y0 = y0 > top ? y0 : top;
+            y1 = y1 < bottom ? y1 : bottom;
+
+            // full rate tiles are scanned like rasterize_triangle does
+            for (int y = h - 1 - y0; rate == 1 && y >= h - 1 - y1; y --)
+            {
+                int64_t e0 = row[0] + a[0] * (x0 - min_x) + c[0] * (y - min_y);
+                int64_t e1 = row[1] + a[1] * (x0 - min_x) + c[1] * (y - min_y);
+                int64_t e2 = row[2] + a[2] * (x0 - min_x) + c[2] * (y - min_y);
+                for (int x = x0; x <= x1; x ++, e0 += a[0], e1 += a[1],
+                     e2 += a[2])
+                {
+                    if ((e0 | e1 | e2) < 0) continue;
+
+                    float l0 = e0 * inv_area, l1 = e1 * inv_area;
+                    float l2 = e2 * inv_area;
+                    float w = l0 * w0 + l1 * w1 + l2 * w2;
+                    int pass = depth_test(device, x, y, w);
+                    if (device->heat != NULL) count_heat(device, x, y, pass);
+                    if (!pass) continue;
+                    device->fragments[device->n_fragments ++] =
+                        (fragment_t){ .x = x, .y = y, .l0 = l0, .l1 = l1,
+                        .l2 = l2, .w = w, .mask = 0, .block = 0 };
+                    if (device->n_fragments == FRAGMENT_BATCH)
+                    {
+                        prof_end(device->profiler, PROF_RASTER, t0);
+                        shade_fragments(device, b, t);
+                        t0 = prof_begin(device->profiler);
+                    }
+                }
+            }
+            if (rate == 1) continue;
+
+            for (int by = y0 - y0 % rate; by <= y1; by += rate)
+            {
+                // rows of the block inside the tile and bounds
+                int py0 = y0 > by ? y0 - by : 0;
+                int py1 = y1 < by + rate - 1 ? y1 - by : rate - 1;
+                int bx = x0 - x0 % rate;
+                // edges at the first block's top left, raster y runs the
+                // other way so rows step by -c
+                int64_t o0 = row[0] + a[0] * (bx - min_x)
+                    + c[0] * (h - 1 - by - min_y);
+                int64_t o1 = row[1] + a[1] * (bx - min_x)
+                    + c[1] * (h - 1 - by - min_y);
+                int64_t o2 = row[2] + a[2] * (bx - min_x)
+                    + c[2] * (h - 1 - by - min_y);
+                for (; bx <= x1; bx += rate, o0 += a[0] * rate,
+                     o1 += a[1] * rate, o2 += a[2] * rate)
+                {
+                    fragment_t frag = { bx, by, 0.0f, 0.0f, 0.0f, 0.0f, 0, rate };
+                    int px0 = x0 > bx ? x0 - bx : 0;
+                    int px1 = x1 < bx + rate - 1 ? x1 - bx : rate - 1;
+                    int64_t r0 = o0 + a[0] * px0 - c[0] * py0;
+                    int64_t r1 = o1 + a[1] * px0 - c[1] * py0;
+                    int64_t r2 = o2 + a[2] * px0 - c[2] * py0;
+                    for (int py = py0; py <= py1;
+                         py ++, r0 -= c[0], r1 -= c[1], r2 -= c[2])
+                    {
+                        int ry = by + py;
+                        int64_t e0 = r0, e1 = r1, e2 = r2;
+                        for (int px = px0; px <= px1;
+                             px ++, e0 += a[0], e1 += a[1], e2 += a[2])
+                        {
+                            if ((e0 | e1 | e2) < 0) continue;
+
+                            int x = bx + px;
+                            float l0 = e0 * inv_area, l1 = e1 * inv_area;
+                            float l2 = e2 * inv_area;
+                            float w = l0 * w0 + l1 * w1 + l2 * w2;
+                            float *depth = &device->depthBuffer[x
+                                + ry * device->width];
+                            int pass = w > *depth;
+                            if (device->heat != NULL)
+                            {
+                                count_heat(device, x, h - 1 - ry, pass);
+                            }
+                            if (!pass) continue;
+                            // shaded where the block is first covered
+                            if (frag.mask == 0)
+                            {
+                                frag.l0 = l0;
+                                frag.l1 = l1;
+                                frag.l2 = l2;
+                                frag.w = w;
+                            }
+                            *depth = w;
+                            frag.mask |= 1u << (py * rate + px);
+                        }
+                    }
+                    if (frag.mask == 0) continue;
+                    device->fragments[device->n_fragments ++] = frag;
+                    if (device->n_fragments == FRAGMENT_BATCH)
+                    {
+                        prof_end(device->profiler, PROF_RASTER, t0);
+                        shade_fragments(device, b, t);
+                        t0 = prof_begin(device->profiler);
+                    }
+                }
+            }
+        }
     }
+    prof_end(device->profiler, PROF_RASTER, t0);
+    if (device->n_fragments > 0) shade_fragments(device, b, t);
+}
 
-    // w = 0 plane clipping
+// sets up and rasterizes the alive triangles of a batch
+void rasterize_batch(device_t *device, triangle_batch_t *b)
+{
+    setup_triangles(device, b);
+    for (int t = 0; t < b->n; t ++)
+    {
+        if (b->alive[t]) rasterize_triangle(device, b, t);
+    }
+}
 
-    // homogeneous clipping
+/**
+ * @brief Runs the vertex shader for triangle t, clips it against the CVV and
+ *      rasterizes the resulting polygon.
+ * 
+ * @param device    Device handle
+ * @param t         Triangle index in device->vertex
+ * @param vc        Clip space corners
+ */
+void draw_clipped_triangle(device_t *device, int t, vec4_t *vc)
+{
     int n_vertices = 3;
     vertex_t vertices[9], *v_temp;
-    for (int i = 0; i < n_vertices; i ++)
+    triangle_batch_t batch;
+
+    for (int i = 0; i < 3; i ++)
     {
-        float *_vary;
-        // NOTICE: only vs & z are placeholders and 
-        //    will be updated after clipping.
-        v_temp = vertex_new(vndc[i], vs[i], z[i],
-            device->vary + i * device->vary_size,
-            device->vary_size);
+        float *vary = device->vary + (t * 3 + i) * device->vary_size;
+        device->vs(device,
+                   device->unif,
+                   device->attr + (t * 3 + i) * device->attr_size,
+                   vary
+                   );
+        // NOTICE: ps & w are placeholders and will be updated after clipping
+        v_temp = vertex_new(vc[i], (vec2_t){ 0.0f, 0.0f }, vc[i].w,
+            vary, device->vary_size);
         vertices[i] = *v_temp;
         free(v_temp);
     }
@@ -585,7 +1227,7 @@ void draw_triangle(device_t *device)
         vertex_t *v_temp = &vertices[i];
         v_temp->w = v_temp->pndc.w;
         v_temp->w = 1.0f / v_temp->w;
-        for (int j = 0; j < v_temp->vary_size; j ++)
+        for (size_t j = 0; j < v_temp->vary_size; j ++)
         {
             *(_vary ++) *= v_temp->w;
         }
@@ -596,17 +1238,23 @@ void draw_triangle(device_t *device)
             clip_float(v_temp->pndc.y * 0.5f + 0.5f, 0, 1) * device->height;
     }
 
+    // triangle fan
+    batch.n = 0;
     for (int i = 1; i < n_vertices - 1; i ++)
     {
-        vs[0] = vertices[0].ps;
-        vs[1] = vertices[i].ps;
-        vs[2] = vertices[i + 1].ps;
-        // back face culling
-        if (!face_side(vs))
+        vertex_t *corners[3] = { &vertices[0], &vertices[i], &vertices[i + 1] };
+        for (int j = 0; j < 3; j ++)
+        {
+            batch.x[j][batch.n] = corners[j]->ps.x;
+            batch.y[j][batch.n] = corners[j]->ps.y;
+            batch.w[j][batch.n] = corners[j]->w;
+            batch.vary[j][batch.n] = corners[j]->vary;
+        }
+        batch.alive[batch.n ++] = 1;
+        if (batch.n == TRIANGLE_BATCH || i == n_vertices - 2)
         {
-            // fragment shader
-            split_and_rasterize_triangle(device,
-                &vertices[0], &vertices[i], &vertices[i + 1]);
+            rasterize_batch(device, &batch);
+            batch.n = 0;
         }
     }
     for (int i = 0; i < n_vertices; i ++)
@@ -615,62 +1263,1184 @@ void draw_triangle(device_t *device)
     }
 }
 
-void setup_device(device_t *device, 
-                  uint32_t width,
-                  uint32_t height,
-                  uint8_t *screen_buffer)
-{
-    device->width = width;
-    device->height = height;
-    device->colorBuffer = screen_buffer;
-    device->depthBuffer = calloc(width * height, sizeof(float));
-}
-
-void clear_buffer(device_t *device)
+/**
+ * @brief draw_triangles with the model -> clip matrix m.
+ */
+void draw_triangles_mvp(device_t *device, int n, mat4_t *m)
 {
-    uint32_t width = device->width;
-    uint32_t height = device->height;
+    vec4_t clip[3 * TRIANGLE_BATCH];
+    float cx[3][TRIANGLE_BATCH], cy[3][TRIANGLE_BATCH];
+    float cz[3][TRIANGLE_BATCH], cw[3][TRIANGLE_BATCH];
+    int clipped[TRIANGLE_BATCH];
+    triangle_batch_t batch;
+    profiler_t *prof = device->profiler;
+    uint64_t t0 = prof_begin(prof);
 
-    uint8_t *line = device->colorBuffer;
-    float *depth_ptr = device->depthBuffer;
-    for (int i = 0; i < height; i ++)
+    // model -> clip, then to SoA
+    mat4_transform_points(m, device->vertex, clip, n * 3);
+    for (int i = 0; i < 3; i ++)
     {
-        uint8_t *p = line;
-        line += width * 4;
-        for (int j = 0; j < width; j ++)
+        for (int t = 0; t < n; t ++)
         {
-            *(p ++) = 127;
-            *(p ++) = 127;
-            *(p ++) = 127;
-            *(p ++) = 255;
-            *(depth_ptr ++) = 0.0f;
+            vec4_t *c = &clip[t * 3 + i];
+            cx[i][t] = c->x;
+            cy[i][t] = c->y;
+            cz[i][t] = c->z;
+            cw[i][t] = c->w;
         }
     }
-    device->object_count = 0;
-    device->triangle_count = 0;
-    device->texel_count = 0;
-}
 
-void draw_mesh(device_t *device, mesh_t *mesh, void *material)
-{
-    // device->debug[0] = 99.0;
-    device->drawer(device, mesh, material);
-    device->object_count ++;
-}
+    // all corners outside one plane -> rejected, any outside -> clipped
+    for (int t = 0; t < n; t ++)
+    {
+        int all = CVV_LEFT | CVV_RIGHT | CVV_TOP | CVV_BOTTOM | CVV_FRONT | CVV_REAR;
+        int any = 0;
+        for (int i = 0; i < 3; i ++)
+        {
+            int code = cvv_outcode(cx[i][t], cy[i][t], cz[i][t], cw[i][t]);
+            all &= code;
+            any |= code;
+        }
+        if (all) device->culled_frustum ++;
+        clipped[t] = !all && any;
+        batch.alive[t] = !any;
+    }
 
-void draw_scene(device_t *device, scene_t *scene)
-{
-    for (int i = 0; i < scene->n_objects; i ++)
+    // clip -> screen, the triangles inside the CVV only
+    batch.n = n;
+    for (int i = 0; i < 3; i ++)
     {
-        object3d_t * obj = scene->objects[i];
-        device->m_world = device->m_camera;
-        mat4_mul(&device->m_world, &obj->m_world);
-        // memcpy(device->debug, &device->m_world, 16 * sizeof(float));
-        draw_mesh(device, obj->mesh, obj->material);
+        for (int t = 0; t < n; t ++)
+        {
+            float w = batch.alive[t] ? 1.0f / cw[i][t] : 0.0f;
+            batch.x[i][t] = (cx[i][t] * w * 0.5f + 0.5f) * device->width;
+            batch.y[i][t] = (cy[i][t] * w * 0.5f + 0.5f) * device->height;
+            batch.w[i][t] = w;
+        }
     }
-}
+    prof_end(prof, PROF_VERTEX, t0);
+    setup_triangles(device, &batch);
 
-void object_update_m_world(object3d_t * obj)
-{
-    get_world_mat(&obj->m_world, obj->position, obj->rotation, obj->scale);
+    // vertex shader for what is left
+    t0 = prof_begin(prof);
+    for (int t = 0; t < n; t ++)
+    {
+        if (!batch.alive[t]) continue;
+        for (int i = 0; i < 3; i ++)
+        {
+            float *vary = device->vary + (t * 3 + i) * device->vary_size;
+            device->vs(device,
+                       device->unif,
+                       device->attr + (t * 3 + i) * device->attr_size,
+                       vary
+                       );
+            for (size_t j = 0; j < device->vary_size; j ++)
+            {
+                vary[j] *= batch.w[i][t];
+            }
+            batch.vary[i][t] = vary;
+        }
+    }
+    prof_end(prof, PROF_VERTEX, t0);
+
+    // in submission order
+    for (int t = 0; t < n; t ++)
+    {
+        if (clipped[t])
+        {
+            vec4_t vc[3];
+            for (int i = 0; i < 3; i ++)
+            {
+                vc[i] = (vec4_t){ cx[i][t], cy[i][t], cz[i][t], cw[i][t] };
+            }
+            t0 = prof_begin(prof);
+            draw_clipped_triangle(device, t, vc);
+            prof_end(prof, PROF_CLIP, t0);
+        }
+        else if (batch.alive[t])
+        {
+            rasterize_triangle(device, &batch, t);
+        }
+    }
+}
+
+void draw_triangles(device_t *device, int n)
+{
+    if (device->n_instances == 0)
+    {
+        mat4_t m = device->m_project;
+        mat4_mul(&m, &device->m_world);
+        draw_triangles_mvp(device, n, &m);
+        return;
+    }
+
+    // the fetched batch is reused by every instance
+    for (uint32_t i = 0; i < device->n_instances; i ++)
+    {
+        instance_t *inst = &device->instances[i];
+        device->m_world = inst->m_world;
+        device->m_world_inv = inst->m_world_inv;
+        device->m_normal = inst->m_normal;
+        device->instance = inst->unif;
+        draw_triangles_mvp(device, n, &inst->m_mvp);
+    }
+}
+
+void draw_triangle(device_t *device)
+{
+    draw_triangles(device, 1);
+}
+
+void setup_device(device_t *device, 
+                  uint32_t width,
+                  uint32_t height,
+                  uint8_t *screen_buffer)
+{
+    setup_device_offscreen(device, width, height, screen_buffer, NULL);
+}
+
+void setup_device_offscreen(device_t *device,
+                            uint32_t width,
+                            uint32_t height,
+                            uint8_t *color_buffer,
+                            float *depth_buffer)
+{
+    device->width = device->out_width = width;
+    device->height = device->out_height = height;
+    device->colorBuffer = color_buffer;
+    device->depthBuffer = depth_buffer;
+    device->owns_depth = depth_buffer == NULL;
+    if (device->owns_depth)
+    {
+        device->depthBuffer = calloc(width * height, sizeof(float));
+    }
+    device->lod_error = 1.0f;
+    device->ranges = NULL;
+    device->n_ranges = 0;
+    device->range_buffer = NULL;
+    device->range_capacity = 0;
+    device->frag_vary = NULL;
+    device->frag_capacity = 0;
+    device->instances = NULL;
+    device->n_instances = 0;
+    device->instance_capacity = 0;
+    device->instance = NULL;
+    device->n_fragments = 0;
+    device->profiler = NULL;
+    device->msaa = 1;
+    device->msaa_color = NULL;
+    device->msaa_depth = NULL;
+    device->shading_rate = 1;
+    device->rate_map = NULL;
+    device->render_scale = 1.0f;
+    device->out_color = NULL;
+    device->scaled_color = NULL;
+    device->target = NULL;
+    device->debug_view = DEBUG_VIEW_NONE;
+    device->heat = NULL;
+    device->heat_scale = 0.0f;
+}
+
+void destroy_device(device_t *device)
+{
+    bind_render_target(device, NULL);
+    if (device->owns_depth) free(device->depthBuffer);
+    free(device->range_buffer);
+    free(device->frag_vary);
+    free(device->instances);
+    free(device->heat);
+    free(device->msaa_color);
+    free(device->msaa_depth);
+    free(device->rate_map);
+    free(device->scaled_color);
+    device->heat = NULL;
+    device->rate_map = NULL;
+    device->scaled_color = NULL;
+    device->msaa_color = NULL;
+    device->msaa_depth = NULL;
+    device->depthBuffer = NULL;
+    device->range_buffer = NULL;
+    device->frag_vary = NULL;
+    device->instances = NULL;
+}
+
+void clear_buffer(device_t *device)
+{
+    uint64_t t0 = prof_begin(device->profiler);
+
+    // a frame below full scale goes to scaled_color until resolved
+    if (device->colorBuffer != device->scaled_color)
+    {
+        device->out_color = device->colorBuffer;
+    }
+    device->width = device->out_width;
+    device->height = device->out_height;
+    device->colorBuffer = device->out_color;
+    if (device->render_scale < 1.0f && device->target == NULL)
+    {
+        int w = (int)(device->out_width * device->render_scale + 0.5f);
+        int h = (int)(device->out_height * device->render_scale + 0.5f);
+        device->width = w > 1 ? w : 1;
+        device->height = h > 1 ? h : 1;
+        device->colorBuffer = device->scaled_color;
+    }
+
+    uint32_t width = device->width;
+    uint32_t height = device->height;
+
+    uint8_t *line = device->colorBuffer;
+    float *depth_ptr = device->depthBuffer;
+    // resolve_msaa overwrites the single sample buffers
+    for (uint32_t i = 0; i < height && device->msaa == 1; i ++)
+    {
+        uint8_t *p = line;
+        line += width * 4;
+        for (uint32_t j = 0; j < width; j ++)
+        {
+            *(p ++) = 127;
+            *(p ++) = 127;
+            *(p ++) = 127;
+            *(p ++) = 255;
+            *(depth_ptr ++) = 0.0f;
+        }
+    }
+    if (device->msaa > 1)
+    {
+        uint32_t n = width * height * MSAA_SAMPLES;
+        const uint8_t gray[4] = { 127, 127, 127, 255 };
+        uint32_t v, *p = (uint32_t *)device->msaa_color;
+        memcpy(&v, gray, 4);
+        for (uint32_t i = 0; i < n; i ++) p[i] = v;
+        memset(device->msaa_depth, 0, n * sizeof(float));
+    }
+    if (device->heat != NULL)
+    {
+        memset(device->heat, 0, width * height * sizeof(uint32_t));
+    }
+    for (int i = 1; device->target != NULL && i < device->target->n_colors;
+         i ++)
+    {
+        memset(device->target->colors[i], 0, width * height * 4);
+    }
+    prof_end(device->profiler, PROF_CLEAR, t0);
+    device->object_count = 0;
+    device->triangle_count = 0;
+    device->texel_count = 0;
+    device->meshlet_count = 0;
+    device->meshlet_culled = 0;
+    device->instance_culled = 0;
+    device->culled_frustum = 0;
+    device->culled_backface = 0;
+    device->culled_degenerate = 0;
+    device->culled_no_sample = 0;
+}
+
+int set_msaa(device_t *device, int samples)
+{
+    if (samples != 1 && samples != MSAA_SAMPLES) return -1;
+    // sample buffers are sized for the device's own buffers
+    if (samples > 1 && device->target != NULL) return -1;
+    device->msaa = samples;
+    if (samples == 1)
+    {
+        free(device->msaa_color);
+        free(device->msaa_depth);
+        device->msaa_color = NULL;
+        device->msaa_depth = NULL;
+        return 0;
+    }
+    if (device->msaa_color == NULL)
+    {
+        size_t n = (size_t)device->out_width * device->out_height
+            * MSAA_SAMPLES;
+        device->msaa_color = malloc(n * 4);
+        device->msaa_depth = malloc(n * sizeof(float));
+    }
+    return 0;
+}
+
+void resolve_msaa(device_t *device)
+{
+    if (device->msaa <= 1) return;
+    uint32_t n = device->width * device->height;
+    uint8_t *src = device->msaa_color, *dst = device->colorBuffer;
+    float *depth = device->msaa_depth;
+    uint64_t t0 = prof_begin(device->profiler);
+
+    for (uint32_t i = 0; i < n; i ++)
+    {
+        for (int ch = 0; ch < 3; ch ++)
+        {
+            uint32_t sum = src[ch] + src[4 + ch] + src[8 + ch] + src[12 + ch];
+            dst[ch] = (uint8_t)((sum + MSAA_SAMPLES / 2) / MSAA_SAMPLES);
+        }
+        float d = depth[0];
+        for (int s = 1; s < MSAA_SAMPLES; s ++)
+        {
+            d = depth[s] > d ? depth[s] : d;
+        }
+        device->depthBuffer[i] = d;
+        src += MSAA_SAMPLES * 4;
+        dst += 4;
+        depth += MSAA_SAMPLES;
+    }
+    prof_end(device->profiler, PROF_RESOLVE, t0);
+}
+
+void set_render_scale(device_t *device, float scale)
+{
+    scale = scale < MIN_RENDER_SCALE ? MIN_RENDER_SCALE : scale;
+    device->render_scale = scale < 1.0f ? scale : 1.0f;
+    if (device->render_scale < 1.0f && device->scaled_color == NULL)
+    {
+        // sized for any scale, the render size changes every frame
+        device->scaled_color = malloc(
+            (size_t)device->out_width * device->out_height * 4);
+    }
+}
+
+void resolve_render_scale(device_t *device)
+{
+    if (device->colorBuffer != device->scaled_color) return;
+    int w = device->width, h = device->height;
+    int ow = device->out_width, oh = device->out_height;
+    uint8_t *src = device->scaled_color, *dst = device->out_color;
+    float *depth = device->depthBuffer;
+    uint64_t t0 = prof_begin(device->profiler);
+
+    // 16.16 source position of the output pixel centers
+    int32_t dx = (int32_t)(((int64_t)w << 16) / ow);
+    int32_t dy = (int32_t)(((int64_t)h << 16) / oh);
+    int32_t sy = dy / 2 - (1 << 15);
+    for (int y = 0; y < oh; y ++, sy += dy)
+    {
+        int y0 = sy < 0 ? 0 : sy >> 16;
+        int y1 = y0 + 1 < h ? y0 + 1 : h - 1;
+        uint32_t fy = sy < 0 ? 0 : (sy >> 8) & 0xff;
+        const uint8_t *r0 = src + y0 * w * 4, *r1 = src + y1 * w * 4;
+        uint8_t *p = dst + y * ow * 4;
+        int32_t sx = dx / 2 - (1 << 15);
+        for (int x = 0; x < ow; x ++, sx += dx, p += 4)
+        {
+            int x0 = sx < 0 ? 0 : sx >> 16;
+            int x1 = (x0 + 1 < w ? x0 + 1 : w - 1) * 4;
+            uint32_t fx = sx < 0 ? 0 : (sx >> 8) & 0xff;
+            x0 *= 4;
+            for (int ch = 0; ch < 4; ch ++)
+            {
+                uint32_t top = r0[x0 + ch] * (256 - fx) + r0[x1 + ch] * fx;
+                uint32_t bot = r1[x0 + ch] * (256 - fx) + r1[x1 + ch] * fx;
+                p[ch] = (uint8_t)((top * (256 - fy) + bot * fy + 32768) >> 16);
+            }
+        }
+    }
+
+    // in place, backwards, a source index is never above its output's
+    for (int y = oh - 1; y >= 0; y --)
+    {
+        float *row = depth + (int64_t)y * h / oh * w;
+        for (int x = ow - 1; x >= 0; x --)
+        {
+            depth[x + y * ow] = row[(int64_t)x * w / ow];
+        }
+    }
+
+    device->colorBuffer = device->out_color;
+    device->width = ow;
+    device->height = oh;
+    prof_end(device->profiler, PROF_RESOLVE, t0);
+}
+
+int render_target_init(render_target_t *rt, int width, int height,
+                       int n_colors)
+{
+    memset(rt, 0, sizeof(render_target_t));
+    if (n_colors < 1 || n_colors > RT_MAX_COLORS) return -1;
+    size_t n = (size_t)width * height;
+    rt->width = width;
+    rt->height = height;
+    rt->n_colors = n_colors;
+    rt->depth = calloc(n, sizeof(float));
+    for (int i = 0; i < n_colors; i ++)
+    {
+        rt->colors[i] = calloc(n, 4);
+        if (rt->colors[i] == NULL) break;
+    }
+    if (rt->depth == NULL || rt->colors[n_colors - 1] == NULL)
+    {
+        render_target_destroy(rt);
+        return -1;
+    }
+    return 0;
+}
+
+void render_target_destroy(render_target_t *rt)
+{
+    for (int i = 0; i < RT_MAX_COLORS; i ++) free(rt->colors[i]);
+    free(rt->depth);
+    memset(rt, 0, sizeof(render_target_t));
+}
+
+int bind_render_target(device_t *device, render_target_t *rt)
+{
+    screen_binding_t *s = &device->screen;
+    if (rt != NULL && device->msaa > 1) return -1;
+    if (device->target == NULL && rt != NULL)
+    {
+        s->width = device->width;
+        s->height = device->height;
+        s->out_width = device->out_width;
+        s->out_height = device->out_height;
+        s->color = device->colorBuffer;
+        s->out_color = device->out_color;
+        s->depth = device->depthBuffer;
+        s->rate_map = device->rate_map;
+        s->debug_view = device->debug_view;
+        s->heat = device->heat;
+        // both are sized for the screen
+        device->rate_map = NULL;
+        device->debug_view = DEBUG_VIEW_NONE;
+        device->heat = NULL;
+    }
+    else if (device->target != NULL && rt == NULL)
+    {
+        device->width = s->width;
+        device->height = s->height;
+        device->out_width = s->out_width;
+        device->out_height = s->out_height;
+        device->colorBuffer = s->color;
+        device->out_color = s->out_color;
+        device->depthBuffer = s->depth;
+        device->rate_map = s->rate_map;
+        device->debug_view = s->debug_view;
+        device->heat = s->heat;
+    }
+    device->target = rt;
+    if (rt == NULL) return 0;
+
+    device->width = device->out_width = rt->width;
+    device->height = device->out_height = rt->height;
+    device->colorBuffer = device->out_color = rt->colors[0];
+    device->depthBuffer = rt->depth;
+    return 0;
+}
+
+// texel of an attachment, x and y clamped, y in raster rows
+const uint8_t *render_target_texel(const render_target_t *rt, int index,
+                                   int x, int y)
+{
+    x = x < 0 ? 0 : (x < rt->width ? x : rt->width - 1);
+    y = y < 0 ? 0 : (y < rt->height ? y : rt->height - 1);
+    return rt->colors[index] + (x + (rt->height - y - 1) * rt->width) * 4;
+}
+
+color3_t render_target_sample(const render_target_t *rt, int index,
+                              vec2_t uv)
+{
+    // texel centers at half integers
+    float fx = uv.x * rt->width - 0.5f, fy = uv.y * rt->height - 0.5f;
+    int x = (int)floorf(fx), y = (int)floorf(fy);
+    float ax = fx - x, ay = fy - y;
+    const uint8_t *p00 = render_target_texel(rt, index, x, y);
+    const uint8_t *p10 = render_target_texel(rt, index, x + 1, y);
+    const uint8_t *p01 = render_target_texel(rt, index, x, y + 1);
+    const uint8_t *p11 = render_target_texel(rt, index, x + 1, y + 1);
+    float c[3];
+    for (int ch = 0; ch < 3; ch ++)
+    {
+        float bottom = p00[ch] + (p10[ch] - p00[ch]) * ax;
+        float top = p01[ch] + (p11[ch] - p01[ch]) * ax;
+        c[ch] = (bottom + (top - bottom) * ay) * (1.0f / 255.0f);
+    }
+    return (color3_t){ c[0], c[1], c[2] };
+}
+
+float render_target_depth(const render_target_t *rt, vec2_t uv)
+{
+    int x = (int)floorf(uv.x * rt->width), y = (int)floorf(uv.y * rt->height);
+    x = x < 0 ? 0 : (x < rt->width ? x : rt->width - 1);
+    y = y < 0 ? 0 : (y < rt->height ? y : rt->height - 1);
+    return rt->depth[x + (rt->height - y - 1) * rt->width];
+}
+
+void set_shading_rate_map(device_t *device, const uint8_t *rates)
+{
+    int tiles_x = (device->out_width + SHADING_TILE - 1) / SHADING_TILE;
+    int tiles_y = (device->out_height + SHADING_TILE - 1) / SHADING_TILE;
+    if (rates == NULL)
+    {
+        free(device->rate_map);
+        device->rate_map = NULL;
+        return;
+    }
+    if (device->rate_map == NULL)
+    {
+        device->rate_map = malloc(tiles_x * tiles_y);
+    }
+    for (int i = 0; i < tiles_x * tiles_y; i ++)
+    {
+        // 1, 2 or 4, the blocks have to tile SHADING_TILE
+        int r = rates[i];
+        device->rate_map[i] = r >= 4 ? 4 : (r >= 2 ? 2 : 1);
+    }
+}
+
+void set_foveated_rate_map(device_t *device, float inner, float outer)
+{
+    int tiles_x = (device->out_width + SHADING_TILE - 1) / SHADING_TILE;
+    int tiles_y = (device->out_height + SHADING_TILE - 1) / SHADING_TILE;
+    uint8_t *rates = malloc(tiles_x * tiles_y);
+    float cx = 0.5f * device->out_width, cy = 0.5f * device->out_height;
+    float corner = sqrtf(cx * cx + cy * cy);
+
+    for (int ty = 0; ty < tiles_y; ty ++)
+    {
+        for (int tx = 0; tx < tiles_x; tx ++)
+        {
+            float dx = (tx + 0.5f) * SHADING_TILE - cx;
+            float dy = (ty + 0.5f) * SHADING_TILE - cy;
+            float d = sqrtf(dx * dx + dy * dy) / corner;
+            rates[tx + ty * tiles_x] = d < inner ? 1 : (d < outer ? 2 : 4);
+        }
+    }
+    set_shading_rate_map(device, rates);
+    free(rates);
+}
+
+void set_debug_view(device_t *device, debug_view_t view)
+{
+    device->debug_view = view;
+    if (view == DEBUG_VIEW_NONE)
+    {
+        free(device->heat);
+        device->heat = NULL;
+        return;
+    }
+    if (device->heat == NULL)
+    {
+        device->heat = calloc(device->out_width * device->out_height,
+            sizeof(uint32_t));
+    }
+    // red at 8 layers, or at one triangle per pixel of a tile
+    device->heat_scale = view == DEBUG_VIEW_TRIANGLES
+        ? (float)(DEBUG_TILE * DEBUG_TILE) : 8.0f;
+}
+
+// black, blue, green, yellow, red for x in [0, 1]
+color3_t heat_color(float x)
+{
+    static const color3_t ramp[5] = {
+        { 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+        { 0.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, 1.0f }
+    };
+    x = clip_float(x, 0.0f, 1.0f) * 4.0f;
+    int i = x < 4.0f ? (int)x : 3;
+    float r = x - i;
+    return (color3_t){
+        ramp[i].b + (ramp[i + 1].b - ramp[i].b) * r,
+        ramp[i].g + (ramp[i + 1].g - ramp[i].g) * r,
+        ramp[i].r + (ramp[i + 1].r - ramp[i].r) * r };
+}
+
+void resolve_debug_view(device_t *device)
+{
+    int tiles_x = (device->width + DEBUG_TILE - 1) / DEBUG_TILE;
+    if (device->heat == NULL) return;
+
+    for (int y = 0; y < device->height; y ++)
+    {
+        uint8_t *p = device->colorBuffer + y * device->width * 4;
+        for (int x = 0; x < device->width; x ++)
+        {
+            uint32_t count = device->debug_view == DEBUG_VIEW_TRIANGLES
+                ? device->heat[x / DEBUG_TILE + y / DEBUG_TILE * tiles_x]
+                : device->heat[x + y * device->width];
+            color3_t c = heat_color(count / device->heat_scale);
+            *(p ++) = float_to_int(c.b);
+            *(p ++) = float_to_int(c.g);
+            *(p ++) = float_to_int(c.r);
+            p ++;
+        }
+    }
+}
+
+void get_cull_view(mat4_t *m_mvp, mat4_t *m_world_inv, cull_view_t *view)
+{
+    get_frustum_planes(m_mvp, view->planes);
+    view->eye = (vec3_t){
+        m_world_inv->m[0][3], m_world_inv->m[1][3], m_world_inv->m[2][3] };
+}
+
+void reserve_ranges(device_t *device, uint32_t n)
+{
+    if (n <= device->range_capacity) return;
+    device->range_capacity = n * 2;
+    device->range_buffer = realloc(device->range_buffer,
+        device->range_capacity * sizeof(face_range_t));
+}
+
+int meshlet_visible(meshlet_t *m, cull_view_t *view)
+{
+    // frustum
+    if (!sphere_in_frustum(view->planes, m->center, m->radius)) return 0;
+    // every normal of the cone faces away from the eye
+    vec3_t d = vec3_sub(m->center, view->eye);
+    float dist = sqrtf(vec3_dot(d, d));
+    return vec3_dot(d, m->cone_axis) < m->cone_cutoff * dist + m->radius;
+}
+
+/**
+ * @brief Writes the faces of visible meshlets within a face range to
+ *      device->ranges. Neighbouring visible meshlets are merged. Inside
+ *      draw_instanced a meshlet is visible if any instance sees it.
+ */
+void cull_meshlets(device_t *device, mesh_t *mesh, cull_view_t *view,
+                   uint32_t first_face, uint32_t n_faces)
+{
+    uint32_t lo = 0, hi = mesh->n_meshlets;
+    uint32_t end = first_face + n_faces;
+    face_range_t *last = NULL;
+
+    // first meshlet of the range
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (mesh->meshlets[mid].first_face < first_face) lo = mid + 1;
+        else hi = mid;
+    }
+    reserve_ranges(device, mesh->n_meshlets);
+    device->ranges = device->range_buffer;
+    device->n_ranges = 0;
+
+    for (uint32_t i = lo; i < mesh->n_meshlets; i ++)
+    {
+        meshlet_t *m = &mesh->meshlets[i];
+        if (m->first_face >= end) break;
+        device->meshlet_count ++;
+
+        int visible = device->n_instances == 0 && meshlet_visible(m, view);
+        for (uint32_t j = 0; j < device->n_instances && !visible; j ++)
+        {
+            visible = meshlet_visible(m, &device->instances[j].view);
+        }
+        if (!visible)
+        {
+            device->meshlet_culled ++;
+            continue;
+        }
+
+        if (last != NULL && last->first + last->count == m->first_face)
+        {
+            last->count += m->n_faces;
+        }
+        else
+        {
+            last = &device->ranges[device->n_ranges ++];
+            *last = (face_range_t){ m->first_face, m->n_faces };
+        }
+    }
+}
+
+// calls drawer for a face range
+void draw_mesh_range(device_t *device, mesh_t *mesh, void *material,
+                     uint32_t first_face, uint32_t n_faces, cull_view_t *view)
+{
+    face_range_t range = (face_range_t){ first_face, n_faces };
+    device->ranges = &range;
+    device->n_ranges = 1;
+    if (view != NULL)
+    {
+        uint64_t t0 = prof_begin(device->profiler);
+        cull_meshlets(device, mesh, view, first_face, n_faces);
+        prof_end(device->profiler, PROF_CULL, t0);
+    }
+    if (device->n_ranges > 0)
+    {
+        device->drawer(device, mesh, material);
+    }
+    device->ranges = NULL;
+    device->n_ranges = 0;
+}
+
+void draw_mesh(device_t *device, mesh_t *mesh, void *material)
+{
+    draw_mesh_batches(device, mesh, NULL, material);
+}
+
+void draw_mesh_batches(device_t *device, mesh_t *mesh, void **materials,
+                       void *material)
+{
+    cull_view_t view, *pview = NULL;
+    if (mesh->n_meshlets > 0)
+    {
+        mat4_t m = device->m_project, inv;
+        mat4_mul(&m, &device->m_world);
+        calc_affine_inv_mat(&device->m_world, &inv);
+        get_cull_view(&m, &inv, &view);
+        pview = &view;
+    }
+
+    if (materials == NULL || mesh->n_batches == 0)
+    {
+        draw_mesh_range(device, mesh, material, 0, mesh->n_faces, pview);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < mesh->n_batches; i ++)
+        {
+            draw_range_t *batch = &mesh->batches[i];
+            void *mtl = materials[batch->material];
+            draw_mesh_range(device, mesh, mtl ? mtl : material,
+                batch->first_face, batch->n_faces, pview);
+        }
+    }
+    device->object_count ++;
+}
+
+void reserve_instances(device_t *device, uint32_t n)
+{
+    if (n <= device->instance_capacity) return;
+    device->instance_capacity = n * 2;
+    device->instances = realloc(device->instances,
+        device->instance_capacity * sizeof(instance_t));
+}
+
+// model-view and model-view-projection of instances [first, first + n)
+void update_instance_batch(device_t *device, mat4_t *m_world,
+                           uint32_t first, uint32_t n)
+{
+    mat4_t *a[INSTANCE_BATCH], *b[INSTANCE_BATCH], *out[INSTANCE_BATCH];
+
+    for (uint32_t i = 0; i < n; i ++)
+    {
+        a[i] = &device->m_camera;
+        b[i] = &m_world[first + i];
+        out[i] = &device->instances[first + i].m_world;
+    }
+    mat4_mul_batch(a, b, out, n);
+    for (uint32_t i = 0; i < n; i ++)
+    {
+        a[i] = &device->m_project;
+        b[i] = out[i];
+        out[i] = &device->instances[first + i].m_mvp;
+    }
+    mat4_mul_batch(a, b, out, n);
+}
+
+void draw_instanced(device_t *device, mesh_t *mesh, void *material,
+                    mat4_t *m_world, float *inst_unif, size_t inst_unif_size,
+                    uint32_t n_instances)
+{
+    uint32_t n = 0;
+    uint64_t t0 = prof_begin(device->profiler);
+
+    reserve_instances(device, n_instances);
+    for (uint32_t i = 0; i < n_instances; i += INSTANCE_BATCH)
+    {
+        uint32_t m = n_instances - i;
+        update_instance_batch(device, m_world, i,
+            m < INSTANCE_BATCH ? m : INSTANCE_BATCH);
+    }
+
+    // drop the instances that see no meshlet, keep the rest in order
+    for (uint32_t i = 0; i < n_instances; i ++)
+    {
+        instance_t *inst = &device->instances[i];
+        calc_affine_inv_mat(&inst->m_world, &inst->m_world_inv);
+        calc_normal_mat(&inst->m_world, &inst->m_normal);
+        inst->unif = inst_unif ? inst_unif + i * inst_unif_size : NULL;
+
+        int visible = mesh->n_meshlets == 0;
+        if (!visible)
+        {
+            get_cull_view(&inst->m_mvp, &inst->m_world_inv, &inst->view);
+            for (uint32_t j = 0; j < mesh->n_meshlets && !visible; j ++)
+            {
+                visible = meshlet_visible(&mesh->meshlets[j], &inst->view);
+            }
+        }
+        if (!visible)
+        {
+            device->instance_culled ++;
+            continue;
+        }
+        if (n != i) device->instances[n] = *inst;
+        n ++;
+    }
+    prof_end(device->profiler, PROF_CULL, t0);
+    if (n == 0) return;
+
+    // draw_triangles loads each instance's matrices, the caller's come back
+    mat4_t saved_world = device->m_world;
+    mat4_t saved_world_inv = device->m_world_inv;
+    mat4_t saved_normal = device->m_normal;
+    device->n_instances = n;
+    draw_mesh_range(device, mesh, material, 0, mesh->n_faces,
+        mesh->n_meshlets > 0 ? &device->instances[0].view : NULL);
+    device->n_instances = 0;
+    device->instance = NULL;
+    device->m_world = saved_world;
+    device->m_world_inv = saved_world_inv;
+    device->m_normal = saved_normal;
+    device->object_count += n;
+}
+
+// picks the LOD level of obj from its projected size
+mesh_t *select_object_mesh(device_t *device, object3d_t *obj)
+{
+    mesh_lod_t *lod = obj->lod;
+    if (lod == NULL || lod->n_levels < 2) return obj->mesh;
+
+    // view depth of the mesh center, device->m_world is model-view here
+    vec4_t c = vec4_mat_mul(get_vec4(lod->center), &device->m_world);
+    float depth = -c.z;
+    if (depth <= EPS) return lod->levels[0];
+
+    // the largest axis scale bounds how much the error can grow
+    float scale = 0.0f;
+    for (int j = 0; j < 3; j ++)
+    {
+        vec3_t axis = (vec3_t){
+            obj->m_world.m[0][j], obj->m_world.m[1][j], obj->m_world.m[2][j] };
+        float s = vec3_dot(axis, axis);
+        scale = s > scale ? s : scale;
+    }
+    float pixels_per_unit = 0.5f * device->height * device->m_project.m[1][1]
+        * sqrtf(scale) / depth;
+    return lod->levels[select_mesh_lod(lod, pixels_per_unit, device->lod_error)];
+}
+
+// grows the draw list to hold n items
+void reserve_draw_items(draw_list_t *list, uint32_t n)
+{
+    if (n <= list->capacity) return;
+    list->capacity = n * 2;
+    list->items = realloc(list->items, list->capacity * sizeof(draw_item_t));
+    list->keys = realloc(list->keys, 2 * list->capacity * sizeof(uint64_t));
+    list->order = realloc(list->order, 2 * list->capacity * sizeof(uint32_t));
+}
+
+void draw_list_begin(draw_list_t *list)
+{
+    list->n_items = 0;
+    list->state_changes_unsorted = 0;
+    list->state_changes = 0;
+}
+
+void draw_list_add(device_t *device, draw_list_t *list, object3d_t *obj)
+{
+    reserve_draw_items(list, list->n_items + 1);
+    list->order[list->n_items] = list->n_items;
+    draw_item_t *item = &list->items[list->n_items ++];
+
+    item->object = obj;
+    mat4_mul_to(&device->m_camera, &obj->m_world, &item->m_world);
+    calc_affine_inv_mat(&item->m_world, &item->m_world_inv);
+    calc_normal_mat(&item->m_world, &item->m_normal);
+    item->depth = -item->m_world.m[2][3];
+    item->materials = obj->materials;
+    item->material = obj->material;
+    item->state = obj->materials ? (void *)obj->materials : obj->material;
+
+    // select_object_mesh reads the model-view from the device
+    device->m_world = item->m_world;
+    item->mesh = select_object_mesh(device, obj);
+}
+
+// hash of a pointer into bits of a sort key, equal pointers stay adjacent
+uint64_t pointer_key(void *p, int bits)
+{
+    return ((uint64_t)(uintptr_t)p * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+}
+
+// counts mesh / material switches of the list in the given order
+uint32_t count_state_changes(draw_list_t *list, uint32_t *order)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 1; i < list->n_items; i ++)
+    {
+        draw_item_t *a = &list->items[order[i - 1]];
+        draw_item_t *b = &list->items[order[i]];
+        n += a->mesh != b->mesh || a->state != b->state;
+    }
+    return n;
+}
+
+/**
+ * @brief LSD radix sort of keys with their indices, 8 bits per pass. Passes
+ *      where every key has the same byte are skipped. The result ends up in
+ *      keys / order, tmp_keys / tmp_order are scratch of the same size.
+ */
+void radix_sort_keys(uint64_t *keys, uint32_t *order, uint64_t *tmp_keys,
+                     uint32_t *tmp_order, uint32_t n)
+{
+    uint64_t *src_k = keys, *dst_k = tmp_keys;
+    uint32_t *src_o = order, *dst_o = tmp_order;
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        uint32_t count[256] = { 0 };
+        for (uint32_t i = 0; i < n; i ++) count[(src_k[i] >> shift) & 0xff] ++;
+        if (count[(src_k[0] >> shift) & 0xff] == n) continue;
+
+        uint32_t sum = 0;
+        for (int i = 0; i < 256; i ++)
+        {
+            uint32_t c = count[i];
+            count[i] = sum;
+            sum += c;
+        }
+        for (uint32_t i = 0; i < n; i ++)
+        {
+            uint32_t j = count[(src_k[i] >> shift) & 0xff] ++;
+            dst_k[j] = src_k[i];
+            dst_o[j] = src_o[i];
+        }
+        uint64_t *tk = src_k; src_k = dst_k; dst_k = tk;
+        uint32_t *to = src_o; src_o = dst_o; dst_o = to;
+    }
+    if (src_k != keys)
+    {
+        memcpy(keys, src_k, n * sizeof(uint64_t));
+        memcpy(order, src_o, n * sizeof(uint32_t));
+    }
+}
+
+void draw_list_sort(draw_list_t *list)
+{
+    uint32_t n = list->n_items;
+    float d_min = FLT_MAX, d_max = 0.0f;
+    if (n == 0) return;
+
+    list->state_changes_unsorted = count_state_changes(list, list->order);
+    for (uint32_t i = 0; i < n; i ++)
+    {
+        float d = list->items[i].depth > 0.0f ? list->items[i].depth : 0.0f;
+        d_min = d < d_min ? d : d_min;
+        d_max = d > d_max ? d : d_max;
+    }
+
+    // | coarse depth 4 | mesh 14 | material 14 | depth 32 |, non negative
+    // floats compare like their bits
+    float scale = DRAW_DEPTH_BUCKETS / (d_max - d_min + EPS);
+    for (uint32_t i = 0; i < n; i ++)
+    {
+        draw_item_t *item = &list->items[i];
+        float d = item->depth > 0.0f ? item->depth : 0.0f;
+        uint32_t bucket = (uint32_t)((d - d_min) * scale);
+        uint32_t bits;
+        memcpy(&bits, &d, sizeof(float));
+        bucket = bucket < DRAW_DEPTH_BUCKETS ? bucket : DRAW_DEPTH_BUCKETS - 1;
+        list->keys[i] = (uint64_t)bucket << 60
+            | pointer_key(item->mesh, 14) << 46
+            | pointer_key(item->state, 14) << 32
+            | bits;
+        list->order[i] = i;
+    }
+    radix_sort_keys(list->keys, list->order, list->keys + list->capacity,
+        list->order + list->capacity, n);
+    list->state_changes = count_state_changes(list, list->order);
+}
+
+void draw_list_execute(device_t *device, draw_list_t *list)
+{
+    for (uint32_t i = 0; i < list->n_items; i ++)
+    {
+        draw_item_t *item = &list->items[list->order[i]];
+        device->m_world = item->m_world;
+        device->m_world_inv = item->m_world_inv;
+        device->m_normal = item->m_normal;
+        draw_mesh_batches(device, item->mesh, item->materials, item->material);
+    }
+}
+
+void draw_list_free(draw_list_t *list)
+{
+    free(list->items);
+    free(list->keys);
+    free(list->order);
+    list->items = NULL;
+    list->keys = NULL;
+    list->order = NULL;
+    list->n_items = 0;
+    list->capacity = 0;
+}
+
+void draw_list_record(device_t *device, draw_list_t *list, scene_t *scene)
+{
+    draw_list_begin(list);
+    for (int i = 0; i < scene->n_objects; i ++)
+    {
+        object3d_t * obj = scene->objects[i];
+        if (obj->mesh == NULL) continue;
+        draw_list_add(device, list, obj);
+    }
+    if (!list->keep_order)
+    {
+        draw_list_sort(list);
+    }
+    else
+    {
+        uint32_t n = count_state_changes(list, list->order);
+        list->state_changes_unsorted = list->state_changes = n;
+    }
+}
+
+void draw_scene(device_t *device, scene_t *scene)
+{
+    draw_list_record(device, &scene->draws, scene);
+    draw_list_execute(device, &scene->draws);
+}
+
+float get_overdraw(device_t *device)
+{
+    uint32_t covered = 0;
+    for (int i = 0; i < device->width * device->height; i ++)
+    {
+        covered += device->depthBuffer[i] > 0.0f;
+    }
+    return covered > 0 ? (float)device->texel_count / covered : 0.0f;
+}
+
+void object_update_m_world(object3d_t * obj)
+{
+    get_world_mat(&obj->m_local, obj->position, obj->rotation, obj->scale);
+    if (obj->parent != NULL)
+    {
+        mat4_mul_to(&obj->parent->m_world, &obj->m_local, &obj->m_world);
+    }
+    else
+    {
+        obj->m_world = obj->m_local;
+    }
+    calc_affine_inv_mat(&obj->m_world, &obj->m_world_inv);
+    calc_normal_mat(&obj->m_world, &obj->m_normal);
+    obj->dirty = 0;
+}
+
+void object_mark_dirty(object3d_t * obj)
+{
+    obj->dirty = 1;
+}
+
+int scene_set_parent(scene_t *scene, object3d_t *obj, object3d_t *parent)
+{
+    // levels above obj once attached, obj itself is at depth
+    uint32_t depth = 0;
+    for (object3d_t *p = parent; p != NULL; p = p->parent)
+    {
+        if (p == obj || ++ depth >= SCENE_MAX_DEPTH) return -1;
+    }
+
+    // the deepest descendant of obj moves along with it
+    uint32_t below = 0;
+    for (int i = 0; i < scene->n_objects; i ++)
+    {
+        uint32_t d = 0;
+        object3d_t *p = scene->objects[i];
+        while (p != NULL && p != obj && d < SCENE_MAX_DEPTH)
+        {
+            p = p->parent;
+            d ++;
+        }
+        if (p == obj && d > below) below = d;
+    }
+    if (depth + below >= SCENE_MAX_DEPTH) return -1;
+
+    obj->parent = parent;
+    obj->dirty = 1;
+    scene->order_dirty = 1;
+    return 0;
+}
+
+// counting sort of the objects by depth, parents come before children
+void scene_sort_objects(scene_t *scene)
+{
+    uint32_t count[SCENE_MAX_DEPTH + 1] = { 0 };
+    free(scene->order);
+    scene->order = malloc(scene->n_objects * sizeof(object3d_t *));
+    scene->n_order = scene->n_objects;
+    scene->order_dirty = 0;
+
+    for (int i = 0; i < scene->n_objects; i ++)
+    {
+        object3d_t *obj = scene->objects[i];
+        uint32_t depth = 0;
+        // bounded, parents assigned without scene_set_parent aren't checked
+        for (object3d_t *p = obj->parent;
+             p != NULL && depth < SCENE_MAX_DEPTH - 1; p = p->parent)
+        {
+            depth ++;
+        }
+        obj->depth = depth;
+        count[depth + 1] ++;
+    }
+    for (int i = 0; i < SCENE_MAX_DEPTH; i ++) count[i + 1] += count[i];
+    for (int i = 0; i < scene->n_objects; i ++)
+    {
+        object3d_t *obj = scene->objects[i];
+        scene->order[count[obj->depth] ++] = obj;
+    }
+}
+
+// world matrices of a batch of objects on one level
+void update_world_batch(object3d_t **objs, int n)
+{
+    mat4_t *a[SCENE_UPDATE_BATCH], *b[SCENE_UPDATE_BATCH];
+    mat4_t *out[SCENE_UPDATE_BATCH];
+    int m = 0;
+
+    for (int i = 0; i < n; i ++)
+    {
+        object3d_t *obj = objs[i];
+        if (obj->parent == NULL)
+        {
+            obj->m_world = obj->m_local;
+            continue;
+        }
+        a[m] = &obj->parent->m_world;
+        b[m] = &obj->m_local;
+        out[m ++] = &obj->m_world;
+    }
+    mat4_mul_batch(a, b, out, m);
+    for (int i = 0; i < n; i ++)
+    {
+        calc_affine_inv_mat(&objs[i]->m_world, &objs[i]->m_world_inv);
+        calc_normal_mat(&objs[i]->m_world, &objs[i]->m_normal);
+    }
+}
+
+void scene_update(scene_t *scene)
+{
+    object3d_t *batch[SCENE_UPDATE_BATCH];
+    int n = 0;
+    uint32_t depth = 0;
+
+    if (scene->order_dirty || scene->n_order != scene->n_objects)
+    {
+        scene_sort_objects(scene);
+    }
+
+    for (int i = 0; i < scene->n_order; i ++)
+    {
+        object3d_t *obj = scene->order[i];
+        // a level is finished before its children read the world matrices
+        if (n == SCENE_UPDATE_BATCH || (n > 0 && obj->depth != depth))
+        {
+            update_world_batch(batch, n);
+            n = 0;
+        }
+        depth = obj->depth;
+
+        obj->moved = obj->dirty || (obj->parent != NULL && obj->parent->moved);
+        if (!obj->moved) continue;
+        if (obj->dirty)
+        {
+            get_world_mat(&obj->m_local, obj->position, obj->rotation,
+                obj->scale);
+            obj->dirty = 0;
+        }
+        batch[n ++] = obj;
+    }
+    update_world_batch(batch, n);
 }
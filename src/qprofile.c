@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "qprofile.h"
+
+static const char *zone_names[N_PROF_ZONES] = {
+    "clear", "cull", "vertex", "clip", "setup", "raster", "shade", "resolve"
+};
+
+void prof_add(profiler_t *p, prof_zone_t zone, uint64_t start, uint64_t end)
+{
+    p->total[zone] += end - start;
+    p->count[zone] ++;
+    if (!p->record) return;
+
+    if (p->n_events == p->capacity)
+    {
+        // the totals above still count when the trace can't grow
+        uint32_t capacity = p->capacity ? p->capacity * 2 : 1024;
+        prof_event_t *events = realloc(p->events,
+            capacity * sizeof(prof_event_t));
+        if (events == NULL) return;
+        p->events = events;
+        p->capacity = capacity;
+    }
+    p->events[p->n_events ++] = (prof_event_t){ start, end, zone, p->thread };
+}
+
+void prof_reset(profiler_t *p)
+{
+    memset(p->total, 0, sizeof(p->total));
+    memset(p->count, 0, sizeof(p->count));
+    p->n_events = 0;
+}
+
+void prof_destroy(profiler_t *p)
+{
+    free(p->events);
+    p->events = NULL;
+    p->n_events = 0;
+    p->capacity = 0;
+}
+
+const char *prof_zone_name(prof_zone_t zone)
+{
+    return zone < N_PROF_ZONES ? zone_names[zone] : "unknown";
+}
+
+int prof_write_trace(const char *fn, profiler_t **profilers, int n)
+{
+    FILE *f = fopen(fn, "w");
+    uint64_t origin = UINT64_MAX;
+    int first = 1;
+
+    if (f == NULL) return -1;
+
+    // timestamps relative to the earliest event, in microseconds. Events
+    // are stored as they end, nested ones before their parent.
+    for (int i = 0; i < n; i ++)
+    {
+        profiler_t *p = profilers[i];
+        for (uint32_t j = 0; j < p->n_events; j ++)
+        {
+            origin = p->events[j].start < origin ? p->events[j].start : origin;
+        }
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (int i = 0; i < n; i ++)
+    {
+        profiler_t *p = profilers[i];
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+            "\"tid\":%u,\"args\":{\"name\":\"render %u\"}}",
+            first ? "" : ",\n", p->thread, p->thread);
+        first = 0;
+        for (uint32_t j = 0; j < p->n_events; j ++)
+        {
+            prof_event_t *e = &p->events[j];
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"qpixel\",\"ph\":\"X\","
+                "\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                prof_zone_name(e->zone), e->thread,
+                (e->start - origin) * 1e-3, (e->end - e->start) * 1e-3);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) != 0 ? -1 : 0;
+}
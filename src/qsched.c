@@ -0,0 +1,155 @@
+#include <math.h>
+#include "qsched.h"
+
+#define SCHED_MAX_STEPS 8
+#define RES_SMOOTHING 0.25      // weight of the newest frame in avg_ms
+#define RES_HEADROOM 0.8        // scale up only below this share of budget
+#define RES_DOWN_FRAMES 3       // frames over budget before scaling down
+#define RES_UP_FRAMES 30        // frames under headroom before scaling up
+#define RES_STEP 0.05f          // largest step up
+
+void scheduler_init(frame_scheduler_t *s, double frame_ms, double step_ms)
+{
+    s->frame_ms = frame_ms;
+    s->step_ms = step_ms;
+    s->max_steps = SCHED_MAX_STEPS;
+    s->virtual_clock = 0;
+    s->now = get_time_ns();
+    s->deadline = s->now;
+    s->lag_ms = 0.0;
+    s->steps = 0;
+    s->frame = 0;
+    s->frame_time_ms = 0.0;
+}
+
+
+void scheduler_begin_frame(frame_scheduler_t *s)
+{
+    uint64_t t;
+    if (s->virtual_clock)
+    {
+        t = s->frame == 0 ? s->now
+            : s->now + (uint64_t)(s->frame_ms * 1000000.0);
+    }
+    else
+    {
+        t = get_time_ns();
+    }
+    if (s->frame > 0)
+    {
+        s->frame_time_ms = (t - s->now) / 1000000.0;
+        s->lag_ms += s->frame_time_ms;
+    }
+    s->now = t;
+    s->steps = 0;
+    s->frame ++;
+}
+
+
+int scheduler_step(frame_scheduler_t *s)
+{
+    if (s->lag_ms < s->step_ms) return 0;
+    if (s->steps == s->max_steps)
+    {
+        // too far behind, e.g. after a stall, drop the rest
+        s->lag_ms = fmod(s->lag_ms, s->step_ms);
+        return 0;
+    }
+    s->lag_ms -= s->step_ms;
+    s->steps ++;
+    return 1;
+}
+
+
+float scheduler_alpha(frame_scheduler_t *s)
+{
+    return (float)(s->lag_ms / s->step_ms);
+}
+
+
+void scheduler_end_frame(frame_scheduler_t *s)
+{
+    if (s->virtual_clock || s->frame_ms <= 0.0)
+    {
+        s->deadline = s->now;
+        return;
+    }
+    uint64_t t = get_time_ns();
+    s->deadline += (uint64_t)(s->frame_ms * 1000000.0);
+    if (s->deadline < t) s->deadline = t;
+}
+
+
+double scheduler_remaining_ms(frame_scheduler_t *s)
+{
+    uint64_t t = get_time_ns();
+    return s->deadline > t ? (s->deadline - t) / 1000000.0 : 0.0;
+}
+
+
+void scheduler_wait(frame_scheduler_t *s)
+{
+    if (s->virtual_clock) return;
+    sleep_until_ns(s->deadline);
+}
+
+
+void resolution_init(resolution_controller_t *c, double target_ms,
+                     float min_scale)
+{
+    c->target_ms = target_ms;
+    c->scale = 1.0f;
+    c->min_scale = min_scale;
+    c->avg_ms = 0.0;
+    c->over = 0;
+    c->under = 0;
+}
+
+
+float resolution_update(resolution_controller_t *c, double render_ms)
+{
+    // aim between the budget and the headroom, inside the dead band
+    double goal = c->target_ms * (1.0 + RES_HEADROOM) * 0.5;
+    float scale = c->scale;
+
+    c->avg_ms = c->avg_ms > 0.0
+        ? c->avg_ms + (render_ms - c->avg_ms) * RES_SMOOTHING : render_ms;
+    if (c->avg_ms > c->target_ms)
+    {
+        c->over ++;
+        c->under = 0;
+    }
+    else if (c->avg_ms < c->target_ms * RES_HEADROOM)
+    {
+        c->under ++;
+        c->over = 0;
+    }
+    else
+    {
+        c->over = c->under = 0;
+    }
+
+    if (c->over >= RES_DOWN_FRAMES)
+    {
+        // straight to the predicted scale, a spike should not last
+        scale = c->scale * (float)sqrt(goal / c->avg_ms);
+    }
+    else if (c->under >= RES_UP_FRAMES)
+    {
+        // small steps up, never past the predicted scale
+        float predicted = c->scale * (float)sqrt(goal / c->avg_ms);
+        scale = c->scale + RES_STEP;
+        scale = scale < predicted ? scale : predicted;
+        scale = scale > c->scale ? scale : c->scale;
+    }
+    scale = scale < c->min_scale ? c->min_scale : scale;
+    scale = scale > 1.0f ? 1.0f : scale;
+    if (scale != c->scale)
+    {
+        // expected time at the new scale, no reaction to the old one
+        c->avg_ms *= (double)(scale * scale) / (c->scale * c->scale);
+        c->scale = scale;
+        c->over = c->under = 0;
+    }
+    return c->scale;
+}
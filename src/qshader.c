@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "qshader.h"
+
+void lit_drawer(device_t *device, mesh_t *mesh, void *material)
+{
+    vec3_t *v = device->vertex;
+    lit_attribute_t *attributes = (lit_attribute_t *)device->attr;
+    int textured = (mesh->mesh_type & T_TEXCOORD) != 0;
+    int n = 0;
+
+    memcpy(device->unif, material, sizeof(lit_uniform_t));
+    for (uint32_t r = 0; r < device->n_ranges; r ++)
+    {
+        face_range_t range = device->ranges[r];
+        for (uint32_t fi = range.first * 3;
+             fi < (range.first + range.count) * 3; fi += 3)
+        {
+            for (int j = 0; j < 3; j ++)
+            {
+                lit_attribute_t *a = &attributes[n * 3 + j];
+                a->normal = mesh->normals[mesh->normal_idx[fi + j] - 1];
+                a->texcoord = textured
+                    ? mesh->texcoords[mesh->texcoord_idx[fi + j] - 1]
+                    : (vec2_t){ 0.0f, 0.0f };
+                v[n * 3 + j] = mesh->vertices[mesh->vertex_idx[fi + j] - 1];
+            }
+            if (++ n == TRIANGLE_BATCH)
+            {
+                draw_triangles(device, n);
+                n = 0;
+            }
+        }
+    }
+    if (n > 0) draw_triangles(device, n);
+}
+
+
+void lit_vs(device_t *device, float *unif, float *attr, float *vary)
+{
+    lit_attribute_t *attributes = (lit_attribute_t *)attr;
+    lit_varying_t *varyings = (lit_varying_t *)vary;
+
+    (void)unif;
+    varyings->normal = vec3_normalize(
+        vec3_mat_mul(attributes->normal, &device->m_normal));
+    varyings->texcoord = attributes->texcoord;
+}
+
+
+vec3_t sample_texture(tga_t *tex, vec2_t uv)
+{
+    int x = (int)floorf((uv.x - floorf(uv.x)) * tex->width);
+    int y = (int)floorf((uv.y - floorf(uv.y)) * tex->height);
+    x = x < tex->width ? x : tex->width - 1;
+    y = y < tex->height ? y : tex->height - 1;
+    unsigned char *p = tex->buffer
+        + ((size_t)y * tex->width + x) * tex->bytes_per_pixel;
+    return (vec3_t){ p[2] / 255.0f, p[1] / 255.0f, p[0] / 255.0f };
+}
+
+
+void lit_fs(device_t *device, float *unif, float *vary, float w,
+            color3_t *out)
+{
+    lit_uniform_t *uniforms = (lit_uniform_t *)unif;
+    lit_varying_t *varyings = (lit_varying_t *)vary;
+
+    (void)device;
+    (void)w;
+    vec3_t diffuse = uniforms->texture
+        ? sample_texture(uniforms->texture, varyings->texcoord)
+        : uniforms->c_diffuse;
+    float intensity = - vec3_dot(varyings->normal, uniforms->dir_light);
+    intensity = clip_float(intensity, 0.0f, 1.0f);
+    vec3_t light = vec3_mul(uniforms->c_light, intensity);
+    light = vec3_add(light, uniforms->c_ambient);
+    vec3_t color = (vec3_t){
+        light.x * diffuse.x, light.y * diffuse.y, light.z * diffuse.z };
+    color = vec3_clip(color, 0.0f, 1.0f);
+
+    memcpy(out, &color, sizeof(float) * 3);
+}
+
+
+int lit_shader_bind(device_t *device)
+{
+    device->unif_size = sizeof(lit_uniform_t) / sizeof(float);
+    device->unif = (float *)malloc(sizeof(lit_uniform_t));
+    device->attr_size = sizeof(lit_attribute_t) / sizeof(float);
+    device->attr = (float *)malloc(
+        sizeof(lit_attribute_t) * 3 * TRIANGLE_BATCH);
+    device->vary_size = sizeof(lit_varying_t) / sizeof(float);
+    device->vary = (float *)malloc(
+        sizeof(lit_varying_t) * 3 * TRIANGLE_BATCH);
+    device->drawer = &lit_drawer;
+    device->vs = &lit_vs;
+    device->fs = &lit_fs;
+    if (device->unif == NULL || device->attr == NULL || device->vary == NULL)
+    {
+        lit_shader_release(device);
+        return -1;
+    }
+    return 0;
+}
+
+
+void lit_shader_release(device_t *device)
+{
+    free(device->unif);
+    free(device->attr);
+    free(device->vary);
+    device->unif = NULL;
+    device->attr = NULL;
+    device->vary = NULL;
+}
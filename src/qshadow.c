@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "qshadow.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define QSHADOW_SSE
+#include <xmmintrin.h>
+#endif
+
+// same 28.4 snapping as the color rasterizer, texels sit on integers
+#define SHADOW_SUBPIXEL_BITS 4
+#define SHADOW_SUBPIXEL_ONE (1 << SHADOW_SUBPIXEL_BITS)
+
+int shadow_map_init(shadow_map_t *sm, int size)
+{
+    memset(sm, 0, sizeof(shadow_map_t));
+    sm->depth = malloc((size_t)size * size * sizeof(float));
+    if (sm->depth == NULL) return -1;
+    sm->size = size;
+    sm->bias = SHADOW_BIAS;
+    sm->slope_bias = SHADOW_SLOPE_BIAS;
+    shadow_map_set_light(sm, (vec3_t){ 0.0f, 0.0f, -1.0f },
+        (vec3_t){ 0.0f, 0.0f, 0.0f }, 1.0f);
+    shadow_map_clear(sm);
+    return 0;
+}
+
+
+void shadow_map_destroy(shadow_map_t *sm)
+{
+    free(sm->depth);
+    free(sm->clip);
+    sm->depth = NULL;
+    sm->clip = NULL;
+    sm->clip_capacity = 0;
+}
+
+
+void shadow_map_set_light(shadow_map_t *sm, vec3_t dir, vec3_t center,
+                          float radius)
+{
+    mat4_t m_view, m_ortho, m_bias;
+    dir = vec3_normalize(dir);
+    vec3_t up = fabsf(dir.y) > 0.99f
+        ? (vec3_t){ 1.0f, 0.0f, 0.0f } : (vec3_t){ 0.0f, 1.0f, 0.0f };
+    vec3_t eye = vec3_sub(center, vec3_mul(dir, radius));
+    get_lookat_mat(&m_view, eye, center, up);
+
+    // the sphere spans view depth 0 to 2 * radius, mapped to z -1 to 1
+    memset(&m_ortho, 0, sizeof(mat4_t));
+    m_ortho.m[0][0] = 1.0f / radius;
+    m_ortho.m[1][1] = 1.0f / radius;
+    m_ortho.m[2][2] = -1.0f / radius;
+    m_ortho.m[2][3] = -1.0f;
+    m_ortho.m[3][3] = 1.0f;
+    mat4_mul_to(&m_ortho, &m_view, &sm->m_light);
+
+    // clip -> texels and [0, 1] depth
+    float half = 0.5f * sm->size;
+    memset(&m_bias, 0, sizeof(mat4_t));
+    m_bias.m[0][0] = half;
+    m_bias.m[0][3] = half;
+    m_bias.m[1][1] = half;
+    m_bias.m[1][3] = half;
+    m_bias.m[2][2] = 0.5f;
+    m_bias.m[2][3] = 0.5f;
+    m_bias.m[3][3] = 1.0f;
+    mat4_mul_to(&m_bias, &sm->m_light, &sm->m_texture);
+}
+
+
+void shadow_map_clear(shadow_map_t *sm)
+{
+    size_t n = (size_t)sm->size * sm->size;
+    for (size_t i = 0; i < n; i ++) sm->depth[i] = 1.0f;
+    sm->triangle_count = 0;
+}
+
+
+/**
+ * @brief Rasterizes one triangle, corners in texels and depth, keeping the
+ *      nearest depth. Edge functions as in rasterize_triangle, depth is
+ *      affine in texel space under an orthographic light.
+ */
+void shadow_raster_triangle(shadow_map_t *sm, vec4_t *p0, vec4_t *p1,
+                            vec4_t *p2)
+{
+    const float one = (float)SHADOW_SUBPIXEL_ONE;
+    vec4_t *p[3] = { p0, p1, p2 };
+    int64_t fx[3], fy[3], a[3], c[3], row[3];
+
+    for (int i = 0; i < 3; i ++)
+    {
+        fx[i] = (int64_t)floorf(p[i]->x * one + 0.5f);
+        fy[i] = (int64_t)floorf(p[i]->y * one + 0.5f);
+    }
+    int64_t area = (fx[1] - fx[0]) * (fy[2] - fy[0])
+        - (fx[2] - fx[0]) * (fy[1] - fy[0]);
+    if (area == 0) return;
+
+    // both faces cast, a back face is turned around
+    if (area < 0)
+    {
+        int64_t t = fx[1]; fx[1] = fx[2]; fx[2] = t;
+        t = fy[1]; fy[1] = fy[2]; fy[2] = t;
+        vec4_t *v = p[1]; p[1] = p[2]; p[2] = v;
+        area = -area;
+    }
+
+    int64_t lx = fx[0] < fx[1] ? (fx[0] < fx[2] ? fx[0] : fx[2])
+        : (fx[1] < fx[2] ? fx[1] : fx[2]);
+    int64_t hx = fx[0] > fx[1] ? (fx[0] > fx[2] ? fx[0] : fx[2])
+        : (fx[1] > fx[2] ? fx[1] : fx[2]);
+    int64_t ly = fy[0] < fy[1] ? (fy[0] < fy[2] ? fy[0] : fy[2])
+        : (fy[1] < fy[2] ? fy[1] : fy[2]);
+    int64_t hy = fy[0] > fy[1] ? (fy[0] > fy[2] ? fy[0] : fy[2])
+        : (fy[1] > fy[2] ? fy[1] : fy[2]);
+    int min_x = (int)((lx + SHADOW_SUBPIXEL_ONE - 1) >> SHADOW_SUBPIXEL_BITS);
+    int min_y = (int)((ly + SHADOW_SUBPIXEL_ONE - 1) >> SHADOW_SUBPIXEL_BITS);
+    int max_x = (int)(hx >> SHADOW_SUBPIXEL_BITS);
+    int max_y = (int)(hy >> SHADOW_SUBPIXEL_BITS);
+    min_x = min_x > 0 ? min_x : 0;
+    min_y = min_y > 0 ? min_y : 0;
+    max_x = max_x < sm->size - 1 ? max_x : sm->size - 1;
+    max_y = max_y < sm->size - 1 ? max_y : sm->size - 1;
+    if (min_x > max_x || min_y > max_y) return;
+
+    // depth plane over texels, pushed back by the slope scaled offset
+    float ux = p[1]->x - p[0]->x, uy = p[1]->y - p[0]->y;
+    float vx = p[2]->x - p[0]->x, vy = p[2]->y - p[0]->y;
+    float uz = p[1]->z - p[0]->z, vz = p[2]->z - p[0]->z;
+    float det = ux * vy - vx * uy;
+    float dzdx = (uz * vy - vz * uy) / det;
+    float dzdy = (vz * ux - uz * vx) / det;
+    float slope = fabsf(dzdx) > fabsf(dzdy) ? fabsf(dzdx) : fabsf(dzdy);
+    float z_row = p[0]->z + dzdx * (min_x - p[0]->x) + dzdy * (min_y - p[0]->y)
+        + sm->bias + sm->slope_bias * slope;
+
+    int64_t sx = (int64_t)min_x << SHADOW_SUBPIXEL_BITS;
+    int64_t sy = (int64_t)min_y << SHADOW_SUBPIXEL_BITS;
+    for (int i = 0; i < 3; i ++)
+    {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        int64_t dx = fx[k] - fx[j];
+        int64_t dy = fy[k] - fy[j];
+        int64_t bias = (-dy > 0 || (dy == 0 && dx > 0)) ? 0 : -1;
+        a[i] = -dy;
+        c[i] = dx;
+        row[i] = a[i] * (sx - fx[j]) + c[i] * (sy - fy[j]) + bias;
+        a[i] *= SHADOW_SUBPIXEL_ONE;
+        c[i] *= SHADOW_SUBPIXEL_ONE;
+    }
+
+    for (int y = min_y; y <= max_y; y ++)
+    {
+        // the covered span of the row, straight from the edge functions
+        int x0 = min_x, x1 = max_x;
+        for (int i = 0; i < 3; i ++)
+        {
+            if (a[i] > 0 && row[i] < 0)
+            {
+                int x = min_x + (int)((-row[i] + a[i] - 1) / a[i]);
+                x0 = x > x0 ? x : x0;
+            }
+            else if (a[i] < 0)
+            {
+                int x = row[i] < 0 ? min_x - 1 : min_x + (int)(row[i] / -a[i]);
+                x1 = x < x1 ? x : x1;
+            }
+            else if (a[i] == 0 && row[i] < 0)
+            {
+                x1 = x0 - 1;
+            }
+        }
+        row[0] += c[0];
+        row[1] += c[1];
+        row[2] += c[2];
+
+        float *d = sm->depth + y * sm->size;
+        float z = z_row + dzdx * (x0 - min_x);
+        int x = x0;
+        z_row += dzdy;
+        // casters in front of the light are clamped onto it
+#ifdef QSHADOW_SSE
+        __m128 zv = _mm_add_ps(_mm_set1_ps(z),
+            _mm_mul_ps(_mm_set1_ps(dzdx), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)));
+        __m128 step = _mm_set1_ps(dzdx * 4.0f), zero = _mm_setzero_ps();
+        for (; x + 3 <= x1; x += 4, zv = _mm_add_ps(zv, step))
+        {
+            __m128 zc = _mm_max_ps(zv, zero);
+            _mm_storeu_ps(d + x, _mm_min_ps(_mm_loadu_ps(d + x), zc));
+        }
+        z += dzdx * (x - x0);
+#endif
+        for (; x <= x1; x ++, z += dzdx)
+        {
+            float zc = z > 0.0f ? z : 0.0f;
+            d[x] = zc < d[x] ? zc : d[x];
+        }
+    }
+    sm->triangle_count ++;
+}
+
+
+// mesh vertices by m (model -> texels) into sm->clip, 0 on success. The
+// mesh can't be drawn if the buffer can't grow to it
+int shadow_transform_vertices(shadow_map_t *sm, mesh_t *mesh, mat4_t *m)
+{
+    if (mesh->n_vertices > sm->clip_capacity)
+    {
+        vec4_t *clip = realloc(sm->clip, mesh->n_vertices * sizeof(vec4_t));
+        if (clip == NULL) return -1;
+        sm->clip = clip;
+        sm->clip_capacity = mesh->n_vertices;
+    }
+    mat4_transform_points(m, mesh->vertices, sm->clip, mesh->n_vertices);
+    return 0;
+}
+
+
+void shadow_draw_faces(shadow_map_t *sm, mesh_t *mesh)
+{
+    float size = (float)sm->size;
+    for (uint32_t f = 0; f < mesh->n_faces; f ++)
+    {
+        uint32_t *idx = &mesh->vertex_idx[f * 3];
+        vec4_t *p0 = &sm->clip[idx[0] - 1];
+        vec4_t *p1 = &sm->clip[idx[1] - 1];
+        vec4_t *p2 = &sm->clip[idx[2] - 1];
+
+        // all corners off one side of the map or beyond far
+        if ((p0->x < 0.0f && p1->x < 0.0f && p2->x < 0.0f)
+            || (p0->x > size && p1->x > size && p2->x > size)
+            || (p0->y < 0.0f && p1->y < 0.0f && p2->y < 0.0f)
+            || (p0->y > size && p1->y > size && p2->y > size)
+            || (p0->z > 1.0f && p1->z > 1.0f && p2->z > 1.0f))
+        {
+            continue;
+        }
+        shadow_raster_triangle(sm, p0, p1, p2);
+    }
+}
+
+
+void shadow_map_draw(shadow_map_t *sm, mesh_t *mesh, mat4_t *m_model)
+{
+    mat4_t m;
+    mat4_mul_to(&sm->m_texture, m_model, &m);
+    if (shadow_transform_vertices(sm, mesh, &m) != 0) return;
+    shadow_draw_faces(sm, mesh);
+}
+
+
+void shadow_map_view_mat(shadow_map_t *sm, mat4_t *m_camera, mat4_t *out)
+{
+    mat4_t inv;
+    calc_affine_inv_mat(m_camera, &inv);
+    mat4_mul_to(&sm->m_texture, &inv, out);
+}
+
+
+void shadow_map_draw_list(shadow_map_t *sm, draw_list_t *list,
+                          mat4_t *m_camera)
+{
+    mat4_t m_view, m;
+    shadow_map_view_mat(sm, m_camera, &m_view);
+    for (uint32_t i = 0; i < list->n_items; i ++)
+    {
+        draw_item_t *item = &list->items[i];
+        if (item->mesh == NULL) continue;
+        mat4_mul_to(&m_view, &item->m_world, &m);
+        if (shadow_transform_vertices(sm, item->mesh, &m) != 0) continue;
+        shadow_draw_faces(sm, item->mesh);
+    }
+}
+
+
+float shadow_pcf(shadow_map_t *sm, vec3_t p)
+{
+    int size = sm->size;
+    float px = p.x - 1.0f, py = p.y - 1.0f;
+    float bx = floorf(px), by = floorf(py);
+    float fx = px - bx, fy = py - by;
+    int ix = (int)bx, iy = (int)by;
+
+    // tent weights of the 4x4 texels around p, they sum to 9
+    float wx[4] = { 1.0f - fx, 1.0f, 1.0f, fx };
+    float wy[4] = { 1.0f - fy, 1.0f, 1.0f, fy };
+
+    if (ix + 1 < 0 || iy + 1 < 0 || ix + 2 >= size || iy + 2 >= size)
+    {
+        return 1.0f;
+    }
+    if (ix < 0 || iy < 0 || ix + 3 >= size || iy + 3 >= size)
+    {
+        // on the border, clamped texels one at a time
+        float lit = 0.0f;
+        for (int j = 0; j < 4; j ++)
+        {
+            int y = iy + j < 0 ? 0 : (iy + j >= size ? size - 1 : iy + j);
+            for (int i = 0; i < 4; i ++)
+            {
+                int x = ix + i < 0 ? 0 : (ix + i >= size ? size - 1 : ix + i);
+                lit += sm->depth[x + y * size] >= p.z ? wx[i] * wy[j] : 0.0f;
+            }
+        }
+        return lit * (1.0f / 9.0f);
+    }
+
+    const float *d = sm->depth + ix + iy * size;
+#ifdef QSHADOW_SSE
+    __m128 ref = _mm_set1_ps(p.z);
+    __m128 w = _mm_loadu_ps(wx);
+    __m128 acc = _mm_setzero_ps();
+    for (int j = 0; j < 4; j ++, d += size)
+    {
+        __m128 lit = _mm_cmpge_ps(_mm_loadu_ps(d), ref);
+        __m128 wj = _mm_mul_ps(w, _mm_set1_ps(wy[j]));
+        acc = _mm_add_ps(acc, _mm_and_ps(lit, wj));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc) * (1.0f / 9.0f);
+#else
+    float lit = 0.0f;
+    for (int j = 0; j < 4; j ++, d += size)
+    {
+        for (int i = 0; i < 4; i ++)
+        {
+            lit += d[i] >= p.z ? wx[i] * wy[j] : 0.0f;
+        }
+    }
+    return lit * (1.0f / 9.0f);
+#endif
+}
@@ -0,0 +1,332 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "qskin.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define QSKIN_SSE
+#include <xmmintrin.h>
+#endif
+
+int mesh_set_skin(mesh_t *mesh, const uint8_t (*joints)[MESH_MAX_INFLUENCES],
+                  const float (*weights)[MESH_MAX_INFLUENCES])
+{
+    uint32_t n = mesh->n_vertices;
+    free(mesh->joints);
+    free(mesh->weights);
+    mesh->joints = malloc(n * sizeof(*mesh->joints));
+    mesh->weights = malloc(n * sizeof(*mesh->weights));
+    if (mesh->joints == NULL || mesh->weights == NULL)
+    {
+        free(mesh->joints);
+        free(mesh->weights);
+        mesh->joints = NULL;
+        mesh->weights = NULL;
+        return -1;
+    }
+
+    for (uint32_t v = 0; v < n; v ++)
+    {
+        float sum = 0.0f;
+        for (int k = 0; k < MESH_MAX_INFLUENCES; k ++)
+        {
+            mesh->joints[v][k] = joints[v][k];
+            mesh->weights[v][k] = weights[v][k] > 0.0f ? weights[v][k] : 0.0f;
+            sum += mesh->weights[v][k];
+        }
+        if (sum <= 0.0f)
+        {
+            memset(mesh->joints[v], 0, sizeof(mesh->joints[v]));
+            memset(mesh->weights[v], 0, sizeof(mesh->weights[v]));
+            mesh->weights[v][0] = 1.0f;
+            continue;
+        }
+        for (int k = 0; k < MESH_MAX_INFLUENCES; k ++)
+        {
+            mesh->weights[v][k] /= sum;
+        }
+    }
+    return 0;
+}
+
+int skeleton_init(skeleton_t *s, uint32_t n_joints)
+{
+    memset(s, 0, sizeof(skeleton_t));
+    if (n_joints == 0 || n_joints > SKIN_MAX_JOINTS) return -1;
+    s->parents = malloc(n_joints * sizeof(int32_t));
+    s->inv_bind = malloc(n_joints * sizeof(mat4_t));
+    s->global = malloc(n_joints * sizeof(mat4_t));
+    if (s->parents == NULL || s->inv_bind == NULL || s->global == NULL)
+    {
+        skeleton_destroy(s);
+        return -1;
+    }
+    s->n_joints = n_joints;
+    for (uint32_t j = 0; j < n_joints; j ++)
+    {
+        s->parents[j] = -1;
+        get_world_mat(&s->inv_bind[j], (vec3_t){ 0.0f, 0.0f, 0.0f },
+            (quat_t){ 1.0f, 0.0f, 0.0f, 0.0f }, (vec3_t){ 1.0f, 1.0f, 1.0f });
+    }
+    return 0;
+}
+
+void skeleton_destroy(skeleton_t *s)
+{
+    free(s->parents);
+    free(s->inv_bind);
+    free(s->global);
+    memset(s, 0, sizeof(skeleton_t));
+}
+
+// ==================
+// Pose
+// ==================
+
+void animation_sample(animation_t *anim, float time, quat_t *rotations,
+                      vec3_t *translations)
+{
+    float t = anim->duration > 0.0f ? fmodf(time, anim->duration) : 0.0f;
+    if (t < 0.0f) t += anim->duration;
+
+    for (uint32_t j = 0; j < anim->n_tracks; j ++)
+    {
+        joint_track_t *tr = &anim->tracks[j];
+        if (tr->n_keys == 0)
+        {
+            rotations[j] = (quat_t){ 1.0f, 0.0f, 0.0f, 0.0f };
+            translations[j] = (vec3_t){ 0.0f, 0.0f, 0.0f };
+            continue;
+        }
+
+        // last key at or before t, clamped to the ends
+        uint32_t lo = 0, hi = tr->n_keys - 1;
+        if (t >= tr->times[hi])
+        {
+            lo = hi;
+        }
+        while (hi - lo > 1)
+        {
+            uint32_t mid = (lo + hi) / 2;
+            if (tr->times[mid] <= t) lo = mid; else hi = mid;
+        }
+        if (lo == hi || t <= tr->times[lo])
+        {
+            rotations[j] = tr->rotations[lo];
+            translations[j] = tr->translations[lo];
+            continue;
+        }
+        float f = (t - tr->times[lo]) / (tr->times[hi] - tr->times[lo]);
+        rotations[j] = quat_slerp(tr->rotations[lo], tr->rotations[hi], f);
+        translations[j] = vec3_add(tr->translations[lo], vec3_mul(
+            vec3_sub(tr->translations[hi], tr->translations[lo]), f));
+    }
+}
+
+int skeleton_pose(skinned_mesh_t *sk, skeleton_t *s, animation_t *anim,
+                  float time)
+{
+    quat_t rotations[SKIN_MAX_JOINTS];
+    vec3_t translations[SKIN_MAX_JOINTS];
+
+    // skin has sk->n_joints matrices, the arrays above a track per joint
+    if (s->n_joints > sk->n_joints || anim->n_tracks > s->n_joints)
+    {
+        return -1;
+    }
+
+    for (uint32_t j = anim->n_tracks; j < s->n_joints; j ++)
+    {
+        rotations[j] = (quat_t){ 1.0f, 0.0f, 0.0f, 0.0f };
+        translations[j] = (vec3_t){ 0.0f, 0.0f, 0.0f };
+    }
+    animation_sample(anim, time, rotations, translations);
+
+    for (uint32_t j = 0; j < s->n_joints; j ++)
+    {
+        mat4_t local, m;
+        get_world_mat(&local, translations[j], rotations[j],
+            (vec3_t){ 1.0f, 1.0f, 1.0f });
+        if (s->parents[j] < 0)
+        {
+            s->global[j] = local;
+        }
+        else
+        {
+            mat4_mul_to(&s->global[s->parents[j]], &local, &s->global[j]);
+        }
+        mat4_mul_to(&s->global[j], &s->inv_bind[j], &m);
+
+        // columns, so a point is c0 x + c1 y + c2 z + c3
+        for (int c = 0; c < 4; c ++)
+        {
+            for (int r = 0; r < 4; r ++) sk->skin[j][c][r] = m.m[r][c];
+        }
+    }
+    return 0;
+}
+
+// ==================
+// Skinning
+// ==================
+
+int skinned_mesh_init(skinned_mesh_t *sk, mesh_t *bind, uint32_t n_joints)
+{
+    memset(sk, 0, sizeof(skinned_mesh_t));
+    if (bind->joints == NULL || n_joints == 0 || n_joints > SKIN_MAX_JOINTS)
+    {
+        return -1;
+    }
+    // blend_skin indexes skin with these unchecked
+    for (uint32_t v = 0; v < bind->n_vertices; v ++)
+    {
+        for (int k = 0; k < MESH_MAX_INFLUENCES; k ++)
+        {
+            if (bind->weights[v][k] != 0.0f && bind->joints[v][k] >= n_joints)
+            {
+                return -1;
+            }
+        }
+    }
+
+    sk->bind = bind;
+    sk->mesh = *bind;
+    sk->mesh.meshlets = NULL;
+    sk->mesh.n_meshlets = 0;
+    sk->mesh.joints = NULL;
+    sk->mesh.weights = NULL;
+    sk->mesh.vertices = malloc(bind->n_vertices * sizeof(vec3_t));
+    sk->mesh.normals = malloc(bind->n_normals * sizeof(vec3_t));
+    sk->normal_vertex = calloc(bind->n_normals, sizeof(uint32_t));
+    sk->skin = malloc(n_joints * sizeof(*sk->skin));
+    if (sk->mesh.vertices == NULL || sk->mesh.normals == NULL
+        || sk->normal_vertex == NULL || sk->skin == NULL)
+    {
+        skinned_mesh_destroy(sk);
+        return -1;
+    }
+    memcpy(sk->mesh.vertices, bind->vertices,
+        bind->n_vertices * sizeof(vec3_t));
+    memcpy(sk->mesh.normals, bind->normals, bind->n_normals * sizeof(vec3_t));
+
+    // the identity until the first pose
+    sk->n_joints = n_joints;
+    memset(sk->skin, 0, n_joints * sizeof(*sk->skin));
+    for (uint32_t j = 0; j < n_joints; j ++)
+    {
+        for (int c = 0; c < 4; c ++) sk->skin[j][c][c] = 1.0f;
+    }
+
+    // normals are indexed apart from positions, each borrows the
+    // influences of a vertex it is used with
+    for (uint32_t i = 0; i < bind->n_faces * 3; i ++)
+    {
+        sk->normal_vertex[bind->normal_idx[i] - 1] = bind->vertex_idx[i] - 1;
+    }
+    return 0;
+}
+
+void skinned_mesh_destroy(skinned_mesh_t *sk)
+{
+    free(sk->mesh.vertices);
+    free(sk->mesh.normals);
+    free(sk->normal_vertex);
+    free(sk->skin);
+    memset(sk, 0, sizeof(skinned_mesh_t));
+}
+
+#ifdef QSKIN_SSE
+// the weighted sum of the skin matrices of vertex v, by column
+void blend_skin(skinned_mesh_t *sk, uint32_t v, __m128 c[4])
+{
+    const uint8_t *j = sk->bind->joints[v];
+    const float *w = sk->bind->weights[v];
+    for (int i = 0; i < 4; i ++) c[i] = _mm_setzero_ps();
+    for (int k = 0; k < MESH_MAX_INFLUENCES; k ++)
+    {
+        if (w[k] == 0.0f) continue;
+        __m128 wk = _mm_set1_ps(w[k]);
+        const float (*m)[4] = sk->skin[j[k]];
+        c[0] = _mm_add_ps(c[0], _mm_mul_ps(wk, _mm_loadu_ps(m[0])));
+        c[1] = _mm_add_ps(c[1], _mm_mul_ps(wk, _mm_loadu_ps(m[1])));
+        c[2] = _mm_add_ps(c[2], _mm_mul_ps(wk, _mm_loadu_ps(m[2])));
+        c[3] = _mm_add_ps(c[3], _mm_mul_ps(wk, _mm_loadu_ps(m[3])));
+    }
+}
+
+void skin_mesh(skinned_mesh_t *sk)
+{
+    mesh_t *bind = sk->bind;
+    __m128 c[4];
+    float out[4];
+
+    if (sk->skin == NULL) return;
+
+    for (uint32_t v = 0; v < bind->n_vertices; v ++)
+    {
+        vec3_t p = bind->vertices[v];
+        blend_skin(sk, v, c);
+        __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(c[0], _mm_set1_ps(p.x)),
+                _mm_mul_ps(c[1], _mm_set1_ps(p.y))),
+            _mm_add_ps(_mm_mul_ps(c[2], _mm_set1_ps(p.z)), c[3]));
+        _mm_storeu_ps(out, r);
+        sk->mesh.vertices[v] = (vec3_t){ out[0], out[1], out[2] };
+    }
+    for (uint32_t n = 0; n < bind->n_normals; n ++)
+    {
+        vec3_t d = bind->normals[n];
+        blend_skin(sk, sk->normal_vertex[n], c);
+        __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(c[0], _mm_set1_ps(d.x)),
+                _mm_mul_ps(c[1], _mm_set1_ps(d.y))),
+            _mm_mul_ps(c[2], _mm_set1_ps(d.z)));
+        _mm_storeu_ps(out, r);
+        sk->mesh.normals[n] = vec3_normalize(
+            (vec3_t){ out[0], out[1], out[2] });
+    }
+}
+#else
+void blend_skin(skinned_mesh_t *sk, uint32_t v, float c[4][4])
+{
+    const uint8_t *j = sk->bind->joints[v];
+    const float *w = sk->bind->weights[v];
+    memset(c, 0, 16 * sizeof(float));
+    for (int k = 0; k < MESH_MAX_INFLUENCES; k ++)
+    {
+        if (w[k] == 0.0f) continue;
+        const float (*m)[4] = sk->skin[j[k]];
+        for (int i = 0; i < 4; i ++)
+        {
+            for (int r = 0; r < 4; r ++) c[i][r] += w[k] * m[i][r];
+        }
+    }
+}
+
+void skin_mesh(skinned_mesh_t *sk)
+{
+    mesh_t *bind = sk->bind;
+    float c[4][4];
+
+    if (sk->skin == NULL) return;
+
+    for (uint32_t v = 0; v < bind->n_vertices; v ++)
+    {
+        vec3_t p = bind->vertices[v];
+        blend_skin(sk, v, c);
+        sk->mesh.vertices[v] = (vec3_t){
+            c[0][0] * p.x + c[1][0] * p.y + c[2][0] * p.z + c[3][0],
+            c[0][1] * p.x + c[1][1] * p.y + c[2][1] * p.z + c[3][1],
+            c[0][2] * p.x + c[1][2] * p.y + c[2][2] * p.z + c[3][2] };
+    }
+    for (uint32_t n = 0; n < bind->n_normals; n ++)
+    {
+        vec3_t d = bind->normals[n];
+        blend_skin(sk, sk->normal_vertex[n], c);
+        sk->mesh.normals[n] = vec3_normalize((vec3_t){
+            c[0][0] * d.x + c[1][0] * d.y + c[2][0] * d.z,
+            c[0][1] * d.x + c[1][1] * d.y + c[2][1] * d.z,
+            c[0][2] * d.x + c[1][2] * d.y + c[2][2] * d.z });
+    }
+}
+#endif
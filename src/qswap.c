@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include "qswap.h"
+
+// present thread, takes frames in submit order until told to quit
+static void present_loop(void *arg)
+{
+    swapchain_t *sc = (swapchain_t *)arg;
+
+    mutex_lock(&sc->lock);
+    while (1)
+    {
+        while (sc->queue_count == 0 && !sc->quit)
+        {
+            cond_wait(&sc->cond, &sc->lock);
+        }
+        if (sc->queue_count == 0) break;
+
+        int i = sc->queue[sc->queue_head];
+        swap_buffer_t *buf = &sc->buffers[i];
+        sc->queue_head = (sc->queue_head + 1) % SWAPCHAIN_MAX_BUFFERS;
+        sc->queue_count --;
+        buf->state = SWAP_PRESENTING;
+        mutex_unlock(&sc->lock);
+
+        if (sc->present)
+        {
+            sc->present(sc->user, i, buf->color, sc->width, sc->height,
+                buf->fence);
+        }
+
+        mutex_lock(&sc->lock);
+        buf->state = SWAP_FREE;
+        sc->completed = buf->fence;
+        cond_broadcast(&sc->cond);
+    }
+    mutex_unlock(&sc->lock);
+}
+
+
+int swapchain_init(swapchain_t *sc, int n_buffers, int width, int height,
+                   present_fn_t present, void *user)
+{
+    memset(sc, 0, sizeof(swapchain_t));
+    if (n_buffers < 2 || n_buffers > SWAPCHAIN_MAX_BUFFERS) return -1;
+    sc->n_buffers = n_buffers;
+    sc->width = width;
+    sc->height = height;
+    sc->current = -1;
+    sc->present = present;
+    sc->user = user;
+    for (int i = 0; i < n_buffers; i ++)
+    {
+        swap_buffer_t *buf = &sc->buffers[i];
+        buf->color = (uint8_t *)calloc((size_t)width * height, 4);
+        buf->depth = (float *)calloc((size_t)width * height, sizeof(float));
+        buf->state = SWAP_FREE;
+        if (buf->color == NULL || buf->depth == NULL)
+        {
+            for (int j = 0; j <= i; j ++)
+            {
+                free(sc->buffers[j].color);
+                free(sc->buffers[j].depth);
+            }
+            return -1;
+        }
+    }
+    mutex_init(&sc->lock);
+    cond_init(&sc->cond);
+    if (thread_create(&sc->thread, &present_loop, sc) != 0)
+    {
+        sc->quit = 1;
+        swapchain_destroy(sc);
+        return -1;
+    }
+    return 0;
+}
+
+
+void swapchain_destroy(swapchain_t *sc)
+{
+    if (!sc->quit)
+    {
+        mutex_lock(&sc->lock);
+        sc->quit = 1;
+        cond_broadcast(&sc->cond);
+        mutex_unlock(&sc->lock);
+        thread_join(&sc->thread);
+    }
+    mutex_destroy(&sc->lock);
+    cond_destroy(&sc->cond);
+    for (int i = 0; i < sc->n_buffers; i ++)
+    {
+        free(sc->buffers[i].color);
+        free(sc->buffers[i].depth);
+        sc->buffers[i].color = NULL;
+        sc->buffers[i].depth = NULL;
+    }
+    sc->n_buffers = 0;
+}
+
+
+int swapchain_acquire(swapchain_t *sc, device_t *device)
+{
+    // round robin keeps presentation in order
+    int i = (sc->current + 1) % sc->n_buffers;
+    swapchain_wait_buffer(sc, i);
+    sc->buffers[i].state = SWAP_RENDERING;
+    sc->current = i;
+    device->colorBuffer = sc->buffers[i].color;
+    device->depthBuffer = sc->buffers[i].depth;
+    return i;
+}
+
+
+uint64_t swapchain_submit(swapchain_t *sc)
+{
+    mutex_lock(&sc->lock);
+    swap_buffer_t *buf = &sc->buffers[sc->current];
+    int tail = (sc->queue_head + sc->queue_count) % SWAPCHAIN_MAX_BUFFERS;
+    buf->fence = ++ sc->submitted;
+    buf->state = SWAP_QUEUED;
+    sc->queue[tail] = sc->current;
+    sc->queue_count ++;
+    uint64_t fence = buf->fence;
+    cond_broadcast(&sc->cond);
+    mutex_unlock(&sc->lock);
+    return fence;
+}
+
+
+int swapchain_fence_signaled(swapchain_t *sc, uint64_t fence)
+{
+    mutex_lock(&sc->lock);
+    int done = sc->completed >= fence;
+    mutex_unlock(&sc->lock);
+    return done;
+}
+
+
+void swapchain_wait_fence(swapchain_t *sc, uint64_t fence)
+{
+    mutex_lock(&sc->lock);
+    while (sc->completed < fence)
+    {
+        cond_wait(&sc->cond, &sc->lock);
+    }
+    mutex_unlock(&sc->lock);
+}
+
+
+void swapchain_wait_buffer(swapchain_t *sc, int index)
+{
+    mutex_lock(&sc->lock);
+    while (sc->buffers[index].state == SWAP_QUEUED
+        || sc->buffers[index].state == SWAP_PRESENTING)
+    {
+        cond_wait(&sc->cond, &sc->lock);
+    }
+    mutex_unlock(&sc->lock);
+}
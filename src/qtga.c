@@ -75,7 +75,7 @@ tga_t *read_tga(const char *fn)
     unsigned char *buffer;
     int ret;
 
-    fopen_s(&f, fn, "rb");
+    f = fopen(fn, "rb");
     if (f == NULL)
     {
         fclose(f);
@@ -124,11 +124,11 @@ tga_t *read_tga(const char *fn)
     tga->width = header.width;
     tga->height = header.height;
     tga->bytes_per_pixel = header.bitsperpixel / 8;
-    memcpy_s(&tga->header, sizeof(tga_header_t), &header, sizeof(tga_header_t));
+    memcpy(&tga->header, &header, sizeof(tga_header_t));
 
     /* Read Identity String */
     id = (char *)calloc(header.idlength + 1, sizeof(char));
-    fread_s(id, header.idlength + 1, 1, header.idlength, f);
+    fread(id, 1, header.idlength, f);
 
     /* Read RLE buffer */
     buffer = (unsigned char*)calloc((size_t)header.width * header.height, header.bitsperpixel / 8);
@@ -155,18 +155,17 @@ int read_rle_buffer(FILE *f, unsigned char *buffer, unsigned char bitsperpixel,
         int pak_type = c >> 7;
         int pak = (c & 0x7f) + 1;
 
-        fread_s(buffer, color_bytes, color_bytes, 1, f);
+        fread(buffer, color_bytes, 1, f);
         if (pak_type == 1)  /* Repeated color */
         {
             for (int i = 1; i < pak; i ++)
             {
-                memcpy_s(buffer + i * color_bytes,
-                    color_bytes, buffer, color_bytes);
+                memcpy(buffer + i * color_bytes, buffer, color_bytes);
             }
         }
         else                /* Color packet */
         {
-            fread_s(buffer + color_bytes, color_bytes * (pak - 1), color_bytes, pak - 1, f);
+            fread(buffer + color_bytes, color_bytes, pak - 1, f);
         }
         buffer += color_bytes * pak;
         count += pak;
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include "qthread.h"
+
+// owned by the new thread, freed once it has read it
+typedef struct
+{
+    thread_fn_t fn;
+    void *arg;
+} thread_start_t;
+
+#ifdef _WIN32
+#include <windows.h>
+
+static DWORD WINAPI thread_entry(LPVOID p)
+{
+    thread_start_t start = *(thread_start_t *)p;
+    free(p);
+    start.fn(start.arg);
+    return 0;
+}
+
+int thread_create(thread_t *t, thread_fn_t fn, void *arg)
+{
+    thread_start_t *start = (thread_start_t *)malloc(sizeof(thread_start_t));
+    if (start == NULL) return -1;
+    start->fn = fn;
+    start->arg = arg;
+    t->handle = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+    if (t->handle == NULL)
+    {
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void thread_join(thread_t *t)
+{
+    WaitForSingleObject((HANDLE)t->handle, INFINITE);
+    CloseHandle((HANDLE)t->handle);
+    t->handle = NULL;
+}
+
+void mutex_init(mutex_t *m) { InitializeSRWLock((PSRWLOCK)&m->ptr); }
+void mutex_destroy(mutex_t *m) { }
+void mutex_lock(mutex_t *m) { AcquireSRWLockExclusive((PSRWLOCK)&m->ptr); }
+void mutex_unlock(mutex_t *m) { ReleaseSRWLockExclusive((PSRWLOCK)&m->ptr); }
+
+void cond_init(cond_t *c)
+{
+    InitializeConditionVariable((PCONDITION_VARIABLE)&c->ptr);
+}
+
+void cond_destroy(cond_t *c) { }
+
+void cond_wait(cond_t *c, mutex_t *m)
+{
+    SleepConditionVariableSRW((PCONDITION_VARIABLE)&c->ptr,
+        (PSRWLOCK)&m->ptr, INFINITE, 0);
+}
+
+void cond_signal(cond_t *c)
+{
+    WakeConditionVariable((PCONDITION_VARIABLE)&c->ptr);
+}
+
+void cond_broadcast(cond_t *c)
+{
+    WakeAllConditionVariable((PCONDITION_VARIABLE)&c->ptr);
+}
+#else
+
+static void *thread_entry(void *p)
+{
+    thread_start_t start = *(thread_start_t *)p;
+    free(p);
+    start.fn(start.arg);
+    return NULL;
+}
+
+int thread_create(thread_t *t, thread_fn_t fn, void *arg)
+{
+    thread_start_t *start = (thread_start_t *)malloc(sizeof(thread_start_t));
+    if (start == NULL) return -1;
+    start->fn = fn;
+    start->arg = arg;
+    if (pthread_create(&t->handle, NULL, thread_entry, start) != 0)
+    {
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void thread_join(thread_t *t)
+{
+    pthread_join(t->handle, NULL);
+}
+
+void mutex_init(mutex_t *m) { pthread_mutex_init(&m->m, NULL); }
+void mutex_destroy(mutex_t *m) { pthread_mutex_destroy(&m->m); }
+void mutex_lock(mutex_t *m) { pthread_mutex_lock(&m->m); }
+void mutex_unlock(mutex_t *m) { pthread_mutex_unlock(&m->m); }
+
+void cond_init(cond_t *c) { pthread_cond_init(&c->c, NULL); }
+void cond_destroy(cond_t *c) { pthread_cond_destroy(&c->c); }
+void cond_wait(cond_t *c, mutex_t *m) { pthread_cond_wait(&c->c, &m->m); }
+void cond_signal(cond_t *c) { pthread_cond_signal(&c->c); }
+void cond_broadcast(cond_t *c) { pthread_cond_broadcast(&c->c); }
+#endif
@@ -0,0 +1,61 @@
+#include "qtime.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+uint64_t get_time_ns()
+{
+    static LARGE_INTEGER freq = { 0 };
+    LARGE_INTEGER count;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    // split to keep the multiplication in range
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ull
+        + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ull
+        / freq.QuadPart;
+}
+
+void sleep_until_ns(uint64_t t)
+{
+    // Sleep is only good to a millisecond or so, yield for the rest
+    uint64_t now = get_time_ns();
+    while (now + 2000000ull < t)
+    {
+        Sleep((DWORD)((t - now) / 1000000ull) - 1);
+        now = get_time_ns();
+    }
+    while (get_time_ns() < t)
+    {
+        SwitchToThread();
+    }
+}
+#else
+#include <errno.h>
+#include <time.h>
+
+uint64_t get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void sleep_until_ns(uint64_t t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000ull;
+    ts.tv_nsec = t % 1000000000ull;
+    // restarted when a signal interrupts it, any other error gives up.
+    // The error number is returned, errno is left alone
+    int err;
+    do
+    {
+        err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    } while (err == EINTR);
+}
+#endif
+
+double get_time_ms()
+{
+    return get_time_ns() * 1e-6;
+}
@@ -1,11 +1,136 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include "qmesh.h"
+#include "qpixel.h"
 #include "qtga.h"
 
 #define MESH_PATH "./models/helmet.obj"
+#define CUBE_PATH "./models/cube.obj"
+#define SCREEN_SIZE 64
+#define TARGET_SIZE 32
 
 mesh_t *mesh = NULL;
 
+/**
+ * @brief Meshlets of a closed mesh must cover every face exactly once
+ * 
+ * @return int  1 if passed
+ */
+int test_meshlets(const char *path)
+{
+    mesh_t *m = load_mesh(path);
+    uint32_t covered = 0;
+    if (!m)
+    {
+        printf("Load %s failed.\n", path);
+        return 0;
+    }
+    build_meshlets(m, MESHLET_MAX_FACES);
+    for (uint32_t i = 0; i < m->n_meshlets; i ++)
+    {
+        meshlet_t *ml = &m->meshlets[i];
+        if (ml->first_face != covered || ml->n_faces == 0
+         || ml->n_faces > MESHLET_MAX_FACES)
+        {
+            printf("> meshlet %u of %s is broken\n", i, path);
+            return 0;
+        }
+        covered += ml->n_faces;
+    }
+    printf("> %s: %u meshlets over %u/%u faces\n", path, m->n_meshlets,
+        covered, m->n_faces);
+    return covered == m->n_faces;
+}
+
+void vs_target(device_t *device, float *unif, float *attr, float *vary)
+{
+    vary[0] = attr[0];
+}
+
+// blue into attachment 0, green into attachment 1
+void fs_target(device_t *device, float *unif, float *vary, float w,
+               color3_t *out)
+{
+    *out = (color3_t){ 1.0f, 0.0f, 0.0f };
+    device->mrt_out[0] = (color3_t){ 0.0f, 1.0f, 0.0f };
+}
+
+/**
+ * @brief Draw the bottom half of a 2 attachment render target, read both
+ *      attachments and the depth back, then check that unbinding gives the
+ *      device its own buffers and rate map again
+ * 
+ * @return int  1 if passed
+ */
+int test_render_target()
+{
+    static uint8_t screen[SCREEN_SIZE * SCREEN_SIZE * 4];
+    // clip space with identity matrices, w = 1
+    vec3_t quad[6] = {
+        { -1.0f, -1.0f, 0.0f }, { 1.0f, -1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f },
+        { -1.0f, -1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }
+    };
+    device_t device;
+    render_target_t rt;
+
+    memset(&device, 0, sizeof(device_t));
+    setup_device_offscreen(&device, SCREEN_SIZE, SCREEN_SIZE, screen, NULL);
+    set_foveated_rate_map(&device, 0.3f, 0.6f);
+    float *own_depth = device.depthBuffer;
+    uint8_t *own_rates = device.rate_map;
+    get_identity_mat(&device.m_project);
+    get_identity_mat(&device.m_world);
+    get_identity_mat(&device.m_world_inv);
+    get_identity_mat(&device.m_normal);
+    device.attr_size = 1;
+    device.attr = (float *)calloc(3 * TRIANGLE_BATCH, sizeof(float));
+    device.vary_size = 1;
+    device.vary = (float *)calloc(3 * TRIANGLE_BATCH, sizeof(float));
+    device.vs = &vs_target;
+    device.fs = &fs_target;
+
+    if (render_target_init(&rt, TARGET_SIZE, TARGET_SIZE, 2) != 0
+     || bind_render_target(&device, &rt) != 0)
+    {
+        printf("> render target setup failed\n");
+        return 0;
+    }
+    clear_buffer(&device);
+    memcpy(device.vertex, quad, sizeof(quad));
+    draw_triangles(&device, 2);
+    bind_render_target(&device, NULL);
+
+    // v = 0 is the bottom row
+    vec2_t bottom = { 0.5f, 0.25f }, top = { 0.5f, 0.75f };
+    color3_t c0 = render_target_sample(&rt, 0, bottom);
+    color3_t c1 = render_target_sample(&rt, 1, bottom);
+    color3_t t1 = render_target_sample(&rt, 1, top);
+    int drawn = c0.b == 1.0f && c0.g == 0.0f && c1.g == 1.0f && c1.b == 0.0f
+        && t1.g == 0.0f
+        && fabsf(render_target_depth(&rt, bottom) - 1.0f) < 1e-4f
+        && render_target_depth(&rt, top) == 0.0f;
+
+    int untouched = 1;
+    for (int i = 0; i < SCREEN_SIZE * SCREEN_SIZE * 4; i ++)
+    {
+        untouched &= screen[i] == 0;
+    }
+    int restored = device.target == NULL && device.colorBuffer == screen
+        && device.depthBuffer == own_depth && device.rate_map == own_rates
+        && device.width == SCREEN_SIZE && device.height == SCREEN_SIZE;
+    printf("> render target: attachments %s, screen %s, binding %s\n",
+        drawn ? "ok" : "wrong", untouched ? "untouched" : "written",
+        restored ? "restored" : "lost");
+
+    render_target_destroy(&rt);
+    free(device.attr);
+    free(device.vary);
+    destroy_device(&device);
+    return drawn && untouched && restored;
+}
+
 int main()
 {
 
@@ -51,6 +176,18 @@ int main()
     puts("");
     */
 
+    if (!test_meshlets(CUBE_PATH))
+    {
+        printf("Meshlet test failed.\n");
+        return 1;
+    }
+
+    if (!test_render_target())
+    {
+        printf("Render target test failed.\n");
+        return 1;
+    }
+
     tga_t *tga_image;
     
     tga_image = read_tga("./models/helmet_basecolor.tga");